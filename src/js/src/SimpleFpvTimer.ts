@@ -10,6 +10,10 @@ export abstract class Page {
 
     abstract getDom(): HTMLElement;
 
+    /* Called by Mode.showPage() when the page gets shown or hidden */
+    public onVisible(visible: boolean) {
+    }
+
     constructor(name: string) {
         this.name = name;
         this.visible = false;
@@ -32,11 +36,14 @@ export class Mode {
             return;
         }
 
-        if (this.currentPage)
+        if (this.currentPage) {
             this.currentPage.visible = false;
+            this.currentPage.onVisible(false);
+        }
 
         this.currentPage = page;
         page.visible = true;
+        page.onVisible(true);
 
         root.replaceChildren(page.getDom());
     }
@@ -70,9 +77,26 @@ export interface RssiData {
 export interface RssiEvent {
     type: string;
     freq: number;
+    rate?: number;
+    floor?: number;     /* 0: manual thresholds */
+    peak?: number;
+    enter?: number;
+    leave?: number;
     data: RssiData[];
 }
 
+/*
+ * Detail of SFT_WS_SUBSCRIBE, dispatched by pages to (un)subscribe a topic
+ * of /ws/rssi: "players", "ctf" or "rssi"
+ */
+export interface WsSubscribeEvent {
+    topic: string;
+    enable: boolean;
+}
+
+/* Decoder of the binary RSSI updates, null if the frame is not one */
+export type RssiFrameDecoder = (buf: ArrayBuffer) => RssiEvent | null;
+
 export interface PlayersEvent {
     type: string;
     players: Player[];
@@ -103,10 +127,14 @@ export class RSSIConfig {
     freq: number;
     peak: number;
     filter: number;
+    filter_median: number;
+    filter_kalman_q: number;
+    filter_kalman_r: number;
     offset_enter: number;
     offset_leave: number;
     calib_max_lap_count: number;
     calib_min_rssi_peak: number;
+    auto_threshold: number;
     led_color: number;
 }
 
@@ -313,12 +341,28 @@ export class SimpleFpvTimer {
     _players: Player[];
     _root: HTMLElement;
 
+    /* Set by Signal.ts. Without it the node sends the RSSI updates as JSON */
+    static rssiDecoder: RssiFrameDecoder = null;
+
+    /* The RSSI updates only while a page shows them */
+    _topics: Set<string> = new Set<string>(["players", "ctf"]);
+
     constructor () {
         this._modes = new Map<ConfigGameMode,Mode>();
         this._currentMode = null;
 
         this.initWebsocket();
 
+        document.addEventListener("SFT_WS_SUBSCRIBE", (e: CustomEventInit<WsSubscribeEvent>) => {
+            if (!e.detail)
+                return;
+            if (e.detail.enable)
+                this._topics.add(e.detail.topic);
+            else
+                this._topics.delete(e.detail.topic);
+            this.sendSubscribe();
+        });
+
         document.addEventListener("SFT_CONFIG_UPDATE", (e: CustomEventInit<any>) => {
             this.onConfigUpdate(e.detail);
         });
@@ -337,13 +381,25 @@ export class SimpleFpvTimer {
         }
         const ws_uri = `ws://${window.location.hostname}:${window.location.port}/ws/rssi`;
         const ws = new WebSocket(ws_uri);
+        ws.binaryType = "arraybuffer";
 
         ws.addEventListener("open", () => {
             console.debug('WebSocket: connected ' + ws_uri);
-            this._ws.send(JSON.stringify({type: "hello", msg: 'Hello, server!'}));
+            this._ws.send(JSON.stringify({type: "hello", msg: 'Hello, server!',
+                                          format: SimpleFpvTimer.rssiDecoder ? "binary" : "json"}));
+            this.sendSubscribe();
         });
 
         ws.addEventListener("message", (ev) => {
+            if (ev.data instanceof ArrayBuffer) {
+                const rssi = SimpleFpvTimer.rssiDecoder ? SimpleFpvTimer.rssiDecoder(ev.data) : null;
+                if (rssi)
+                    this.dispatchRSSIUpdateEv(rssi);
+                else
+                    console.log("WebSocket: Unknown binary frame of " + ev.data.byteLength + " bytes");
+                return;
+            }
+
             try {
                 const json = JSON.parse(ev.data);
                 const wsEv = json as WsEvent;
@@ -374,6 +430,13 @@ export class SimpleFpvTimer {
         this._ws = ws;
     }
 
+    private sendSubscribe() {
+        if (!this._ws || this._ws.readyState != WebSocket.OPEN)
+            return;
+
+        this._ws.send(JSON.stringify({type: "subscribe", topics: Array.from(this._topics)}));
+    }
+
     private onConfigUpdate(cfg: Config) {
         var expected_mode = this._modes.get(Number(cfg.game_mode));
 
@@ -421,7 +484,7 @@ export class SimpleFpvTimer {
             });
 
             if (index === 0 ) {
-                tabPane.replaceChildren(page.getDom());
+                mode.showPage(page, tabPane);
             }
             tabContent.appendChild(tabPane);
         });
@@ -419,6 +419,11 @@ export class GeneralConfigGroup extends ConfigGroup {
     }
 }
 
+const threshold_map = new Map([
+    ["0", "Manual, by peak"],
+    ["1", "Automatic"],
+]);
+
 const freq_map = new Map([
             [ "5658", "R1 (5658)"  ],
             [ "5695", "R2 (5695)"  ],
@@ -476,10 +481,14 @@ export class RSSITap extends ConfigGroup {
         var fields = [
             'peak',
             'filter',
+            'filter_median',
+            'filter_kalman_q',
+            'filter_kalman_r',
             'offset_leave',
             'offset_enter',
             'calib_max_lap_count',
             'calib_min_rssi_peak',
+            'auto_threshold',
             'led_color'
         ];
 
@@ -524,6 +533,12 @@ export class RSSITap extends ConfigGroup {
 
         this.addElement(new ConfigColorElement(cfg, visible, `rssi[${idx}].led_color`, "LED color"));
 
+        this.addElement(new ConfigSelectElement(cfg, visible, `rssi[${idx}].auto_threshold`,
+            "Thresholds", threshold_map,
+            "Automatic estimates the noise floor and the peak of the recent passes" +
+            " continuously, 'RSSI Peak value' is only the start value. Offset" +
+            " enter/leave are then percentages of the way from noise floor to peak."));
+
         [{
             label: "RSSI Peak value (default: 1100)",
             name: "peak",
@@ -535,6 +550,24 @@ export class RSSITap extends ConfigGroup {
             help: "Smooth the RSSI input signals. Range is 1-100, a value near" +
                 " to 1 smooth more, a value of 100 keeps the raw RSSI value."
         },
+        {
+            name: "filter_median",
+            label: "Median filter",
+            help: "Take the median of this many RSSI samples before the filter," +
+                " removes single spikes. Range is 3-9, 0 disables it."
+        },
+        {
+            name: "filter_kalman_r",
+            label: "Kalman measurement noise (mV)",
+            help: "Noise of the RSSI input signal for the Kalman filter, which" +
+                " follows the filter. 0 disables the Kalman filter."
+        },
+        {
+            name: "filter_kalman_q",
+            label: "Kalman process noise (mV)",
+            help: "How much the true RSSI changes from one sample to the next." +
+                " Lower values smooth more."
+        },
         {
             label: "Offset enter (in %)",
             name: "offset_enter",
@@ -556,7 +589,7 @@ export class RSSITap extends ConfigGroup {
             label: "Calibration min rssi peak",
             name: "calib_min_rssi_peak",
             help: "The minimum RSSI value to detect a 'drone enter gate' during" +
-                " calibration."
+                " calibration. With automatic thresholds the lowest peak of a pass."
         }].forEach((l) => {
             this.addElement(new RSSIConfigElement(cfg, visible, idx,l.name, l.label, l.help));
         });
@@ -1,7 +1,7 @@
 import uPlot, { Options, Axis, AlignedData } from "../../lib/uPlot.js";
 import van from "../../lib/van-1.5.2.js"
 import { Notifications } from "../../Notifications.js";
-import { Config, Lap, Page, Player, RssiData, RssiEvent } from "../../SimpleFpvTimer.js";
+import { Config, Lap, Page, Player, RssiData, RssiEvent, SimpleFpvTimer } from "../../SimpleFpvTimer.js";
 import { $, enumToMap, format_ms } from "../../utils.js";
 //import uPlot  from "../../lib/uPlot.js"
 
@@ -10,6 +10,10 @@ const {button, div, pre, select, option} = van.tags
 class RssiQ {
     freq: number;
     data: Array<RssiData>;
+    /* thresholds of the node, if it sent them */
+    peak?: number;
+    enter?: number;
+    leave?: number;
 
     constructor(freq: number, data?: RssiData) {
         this.freq = freq;
@@ -48,6 +52,50 @@ class RssiQ {
 }
 
 
+/*
+ * Binary RSSI update of /ws/rssi (see rssi_update_encode_bin() in gui.c),
+ * little endian:
+ *   u8 type (1), u8 version (1), u16 cnt, u16 freq, u16 rate,
+ *   i16 floor, i16 peak, i16 enter, i16 leave, u32 t0 low, u32 t0 high,
+ *   cnt times { u16 ms since the previous sample, i16 smoothed,
+ *               u16 raw (bit 15: drone in gate) }
+ */
+const RSSI_FRAME_HDR = 24;
+const RSSI_FRAME_SAMPLE = 6;
+
+export function decodeRssiFrame(buf: ArrayBuffer): RssiEvent | null {
+    const v = new DataView(buf);
+
+    if (buf.byteLength < RSSI_FRAME_HDR || v.getUint8(0) != 1 || v.getUint8(1) != 1)
+        return null;
+
+    const cnt = v.getUint16(2, true);
+    if (buf.byteLength < RSSI_FRAME_HDR + cnt * RSSI_FRAME_SAMPLE)
+        return null;
+
+    let t = v.getUint32(16, true) + v.getUint32(20, true) * 2**32;
+    const data = new Array<RssiData>();
+    for (let i = 0, o = RSSI_FRAME_HDR; i < cnt; i++, o += RSSI_FRAME_SAMPLE) {
+        const raw = v.getUint16(o + 4, true);
+
+        t += v.getUint16(o, true);
+        data.push({t: t, s: v.getInt16(o + 2, true), r: raw & 0x7fff, i: (raw & 0x8000) != 0});
+    }
+
+    return {
+        type: "rssi",
+        freq: v.getUint16(4, true),
+        rate: v.getUint16(6, true),
+        floor: v.getInt16(8, true),
+        peak: v.getInt16(10, true),
+        enter: v.getInt16(12, true),
+        leave: v.getInt16(14, true),
+        data: data,
+    };
+}
+
+SimpleFpvTimer.rssiDecoder = decodeRssiFrame;
+
 function svg(svg_path: string) {
     const svg = document.createElementNS("http://www.w3.org/2000/svg","svg");
     svg.setAttribute("width", "16");
@@ -247,6 +295,12 @@ export class SignalPage extends Page {
         return this.root;
     }
 
+    onVisible(visible: boolean) {
+        document.dispatchEvent(
+            new CustomEvent("SFT_WS_SUBSCRIBE", {detail: {topic: "rssi", enable: visible}})
+        );
+    }
+
     private updateSeries(freqs: number[]) {
         if (!this.uplot)
             return ;
@@ -271,9 +325,16 @@ export class SignalPage extends Page {
         var enter = 0;
         var leave = 0;
         if (this.cfg) {
-            peak = this.cfg.rssi[0].peak;
-            enter = this.cfg.rssi[0].offset_enter/ 100 * peak;
-            leave = this.cfg.rssi[0].offset_leave/100 * peak;
+            const q = this.dataq.find((e) => e.freq == this.cfg.rssi[0].freq);
+            if (q && q.enter) {
+                peak = q.peak;
+                enter = q.enter;
+                leave = q.leave;
+            } else {
+                peak = this.cfg.rssi[0].peak;
+                enter = this.cfg.rssi[0].offset_enter/ 100 * peak;
+                leave = this.cfg.rssi[0].offset_leave/100 * peak;
+            }
         }
 
         var freq = new Array<number>();
@@ -346,6 +407,13 @@ export class SignalPage extends Page {
             q.expire(this.max_storage_seconds)
         }
 
+        var q = this.dataq.find((e) => e.freq == ev.freq);
+        if (q && ev.enter) {
+            q.peak = ev.peak;
+            q.enter = ev.enter;
+            q.leave = ev.leave;
+        }
+
         this.saveStorage();
         if (this.update_uplot)
             this.onNextValues();
@@ -47,6 +47,26 @@ def prepare_www_files(source, target, env):
 
 
     print('  files to copy: ' + str(files_to_copy))
+
+    # Content hash of each file, sent as ETag. The html files reference the
+    # others as 'name?v=<hash>', those URLs may be cached forever.
+    file_hashes = {}
+    for file in sorted(all_files, key=lambda f: f.endswith('.html')):
+        name = os.path.basename(file)
+        content = open(file, 'rb').read()
+        if name.endswith('.html'):
+            for ref, h in file_hashes.items():
+                content = re.sub(rb'((?:src|href)=")' + re.escape(ref.encode()) + rb'"',
+                                 rb'\g<1>' + ref.encode() + b'?v=' + h.encode() + b'"', content)
+            src = os.path.join(tmp_dir, name)
+            with open(src, 'wb') as f:
+                f.write(content)
+            if file in files_to_gzip:
+                files_to_gzip[files_to_gzip.index(file)] = src
+            else:
+                files_to_copy[files_to_copy.index(file)] = src
+        file_hashes[name] = hashlib.sha1(content).hexdigest()[:16]
+
     dst_files = []
     for file in files_to_copy:
         if PurePosixPath(file).suffix in ignore_suffix:
@@ -54,7 +74,8 @@ def prepare_www_files(source, target, env):
 
         print('  COPY: ' + file)
         dst = os.path.join(tmp_dir, os.path.basename(file))
-        shutil.copy(file, dst)
+        if file != dst:
+            shutil.copy(file, dst)
         dst_files.append(dst)
 
 
@@ -105,7 +126,7 @@ def prepare_www_files(source, target, env):
                 filetype = "audio/ogg"
             if filename.endswith('.svg'):
                 filetype = "image/svg+xml"
-            h_file_content.append((filename, gzip, filetype, "file_%02d" %fcnt, cnt))
+            h_file_content.append((filename, gzip, filetype, "file_%02d" %fcnt, cnt, file_hashes[filename]))
             fcnt+=1
 
         fdst.write("""
@@ -115,13 +136,14 @@ struct static_files {
     const char *type;
     const unsigned char *data;
     size_t data_len;
+    const char *hash;   /* of the content, 16 hex digits */
 };
 
 const struct static_files STATIC_FILES[] = {
 """)
 
         for hc in h_file_content:
-            fdst.write('    {.name = %-30s .is_gzip = %d, .type = %-18s .data = %-7s, .data_len = %-5d },\n' %('"/' + hc[0]+'",', hc[1], '"'+hc[2]+'",', hc[3], hc[4]))
+            fdst.write('    {.name = %-30s .is_gzip = %d, .type = %-18s .data = %-7s, .data_len = %-5d, .hash = "%s" },\n' %('"/' + hc[0]+'",', hc[1], '"'+hc[2]+'",', hc[3], hc[4], hc[5]))
         fdst.write("    {.name = NULL, .data = NULL}\n};\n")
 
     # Cleanup
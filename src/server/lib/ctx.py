@@ -82,8 +82,12 @@ class Ctx:
                         i.endswith("freq") or
                         i.endswith("peak") or
                         i.endswith("filter") or
+                        i.endswith("filter_median") or
+                        i.endswith("filter_kalman_q") or
+                        i.endswith("filter_kalman_r") or
                         i.endswith("offset_enter") or
                         i.endswith("offset_leave") or
+                        i.endswith("auto_threshold") or
                         i.endswith("led_color")):
                     cfg[i] = self.config.data[i]
 
@@ -102,8 +106,12 @@ class Ctx:
                         i.endswith("freq") or
                         i.endswith("peak") or
                         i.endswith("filter") or
+                        i.endswith("filter_median") or
+                        i.endswith("filter_kalman_q") or
+                        i.endswith("filter_kalman_r") or
                         i.endswith("offset_enter") or
                         i.endswith("offset_leave") or
+                        i.endswith("auto_threshold") or
                         i.endswith("led_color")):
                     new_key = i.replace('rssi[{}]'.format(idx), 'rssi[0]')
                     cfg[new_key] = self.config.data[i]
@@ -196,9 +204,10 @@ class Ctx:
     @race_only
     def onRaceLap(self, json):
         try:
-            self.race.addLap(json)
+            self.race.onRaceLap(json)
         except RacePlayerNotFound as e:
             self.addNode(e.ipv4, e.name)
+            self.race.onRaceLap(json)
         return {'status': 'ok', 'msg': ''}
 
     @race_only
@@ -18,7 +18,7 @@ class Lap:
     rssi = 0
     abs_time = 0
 
-    def __init(self, id, duration, rssi, abs_time=None):
+    def __init__(self, id, duration, rssi, abs_time=None):
         self.id = id
         self.duration = duration
         self.rssi = rssi
@@ -37,10 +37,15 @@ class Player:
     name = ""
     ipv4 = ""
     laps: LapsList = list()
+    last_epoch = 0
+    last_seq = 0
 
     def __init__(self, ipv4, name):
         self.name = name
         self.ipv4 = ipv4
+        self.laps = list()
+        self.last_epoch = 0
+        self.last_seq = 0
 
     def addLap(self, lap):
         self.laps.append(lap)
@@ -73,7 +78,20 @@ class Race:
         if player is None:
             raise RacePlayerNotFound(json['ipv4'], json['player'])
 
-        player.addLap(Lap(json['id'], json['duration'], json['rssi']))
+        # batched by the nodes: {"player", "ipv4", "epoch", "laps": [{"id", ..}, ..]}
+        # a new epoch is a new outbox on the node, its seq starts over
+        epoch = json.get('epoch', 0)
+        if epoch != player.last_epoch:
+            player.last_epoch = epoch
+            player.last_seq = 0
+        for lap in json.get('laps', [json]):
+            # the node replays laps until acked, drop the ones seen already
+            seq = lap.get('seq', 0)
+            if seq and seq <= player.last_seq:
+                continue
+            player.addLap(Lap(lap['id'], lap['duration'], lap['rssi']))
+            if seq:
+                player.last_seq = seq
         return {'status': "ok"}
 
     def addPlayer(self, ipv4, name):
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <stdalign.h>
+#include "arena.h"
+
+#define ARENA_ALIGN     alignof(max_align_t)
+
+void arena_init(arena_t *a, void *buf, size_t size)
+{
+    a->buf = buf;
+    a->size = size;
+    a->used = 0;
+    a->hwm = 0;
+    a->resets = 0;
+    a->fails = 0;
+}
+
+void *arena_alloc(arena_t *a, size_t size)
+{
+    size_t start = (a->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (start > a->size || size > a->size - start) {
+        a->fails++;
+        return NULL;
+    }
+
+    a->used = start + size;
+    if (a->used > a->hwm)
+        a->hwm = a->used;
+    return a->buf + start;
+}
+
+void arena_reset(arena_t *a)
+{
+    a->used = 0;
+    a->resets++;
+}
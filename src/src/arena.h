@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Bump allocator over a fixed buffer. Allocations are only released all at
+ * once by arena_reset(), e.g. at the end of a request, so the scratch
+ * buffers of a request never fragment the heap. Not thread safe, an arena
+ * belongs to one task.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t used;
+    size_t hwm;             /* max used since arena_init() */
+    uint32_t resets;
+    uint32_t fails;         /* allocations that did not fit */
+} arena_t;
+
+void arena_init(arena_t *a, void *buf, size_t size);
+
+/* size bytes, aligned for any type, NULL if they do not fit */
+void *arena_alloc(arena_t *a, size_t size);
+
+void arena_reset(arena_t *a);
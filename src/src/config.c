@@ -20,101 +20,6 @@ static const char* TAG = "config";
 #define CFG_NVS_RSSI_OFFSET "sft-rssi-off"
 #define CFG_NVS_NODE_NAME   "sft-node-name"
 
-#define config_meta_UINT16(var_name)          \
-{                                             \
-.name = #var_name,                        \
-.type = UINT16,                           \
-.size = sizeof(uint16_t),                 \
-.offset = offsetof(struct config_data, var_name) \
-}
-
-#define config_meta_INT16(var_name)          \
-{                                             \
-.name = #var_name,                        \
-.type = INT16,                           \
-.size = sizeof(int16_t),                 \
-.offset = offsetof(struct config_data, var_name) \
-}
-
-#define config_meta_UINT32(var_name)                \
-{                                                   \
-.name = #var_name,                                  \
-.type = UINT32,                                     \
-.size = sizeof(uint32_t),                           \
-.offset = offsetof(struct config_data, var_name)    \
-}
-
-#define config_meta_IPV4(var_name)         \
-{                                             \
-.name = #var_name,                          \
-.type = IPV4,                            \
-.size = sizeof(ip4_addr_t),                                  \
-.offset = offsetof(struct config_data, var_name)   \
-}
-
-#define config_meta_MACADDR(var_name)         \
-{                                             \
-.name = #var_name,                          \
-.type = MACADDR,                            \
-.size = 6,                                  \
-.offset = offsetof(struct config_data, var_name)   \
-}
-
-#define config_meta_STRING(var_name, length)  \
-{                                             \
-.name = #var_name,                          \
-.type = STRING,                             \
-.size = length,                             \
-.offset = offsetof(struct config_data, var_name)   \
-}
-
-#define config_meta_rssi(idx)                                 \
-        config_meta_STRING(rssi[idx].name, 32),               \
-        config_meta_UINT16(rssi[idx].freq),                   \
-        config_meta_UINT16(rssi[idx].peak),                   \
-        config_meta_UINT16(rssi[idx].filter),                 \
-        config_meta_UINT16(rssi[idx].offset_enter),           \
-        config_meta_UINT16(rssi[idx].offset_leave),           \
-        config_meta_UINT16(rssi[idx].calib_max_lap_count),    \
-        config_meta_UINT16(rssi[idx].calib_min_rssi_peak),    \
-        config_meta_UINT32(rssi[idx].led_color)
-
-
-const struct config_meta config_meta[] =
-    {
-        config_meta_rssi(0),
-        config_meta_rssi(1),
-        config_meta_rssi(2),
-        config_meta_rssi(3),
-        config_meta_rssi(4),
-        config_meta_rssi(5),
-        config_meta_rssi(6),
-        config_meta_rssi(7),
-
-        config_meta_INT16(rssi_offset), /* The RSSI offset is applyied to all readed values. Used to make equal measurements above multiple nodes */
-
-        config_meta_MACADDR(elrs_uid),
-        config_meta_UINT16(osd_x),
-        config_meta_UINT16(osd_y),
-        config_meta_STRING(osd_format, CFG_MAX_OSD_FORMAT_LEN),
-
-        config_meta_UINT16(wifi_mode),
-        config_meta_STRING(ssid, CFG_MAX_SSID_LEN),
-        config_meta_STRING(passphrase, CFG_MAX_PASSPHRASE_LEN),
-
-        config_meta_STRING(node_name, CFG_MAX_NAME_LEN),
-        config_meta_UINT16(node_mode),
-        config_meta_IPV4(ctrl_ipv4),
-        config_meta_UINT16(ctrl_port),
-
-        config_meta_UINT16(game_mode),
-
-        config_meta_UINT16(led_num),
-
-        {.name = NULL}
-    };
-
-
 static void initialize_nvs(void)
 {
     static unsigned int initialized = 0;
@@ -199,6 +104,7 @@ static void cfg_data_init(struct config_data *eeprom, nvs_handle_t nvs)
 
     eeprom->rssi[0].calib_max_lap_count = 3;
     eeprom->rssi[0].calib_min_rssi_peak = 600;
+    eeprom->rssi[0].auto_threshold = 1;
 
     strcpy(eeprom->osd_format, CFG_DEFAULT_OSD_FORMAT);
 
@@ -224,6 +130,7 @@ esp_err_t cfg_load(struct config *cfg)
 
 
     initialize_nvs();
+    cfg_json_init();
     err = nvs_open(CFG_NVS_NAMESPACE, NVS_READWRITE, &my_handle);
     if (err != ESP_OK) {
         return err;
@@ -286,90 +193,14 @@ esp_err_t cfg_save(struct config *cfg)
     return err;
 }
 
-int parse_int(const char *str) {
-
-    long int res = 0;
-
-    if (str == NULL || *str == '\0')
-        return 0;
-
-    errno = 0;
-    if (str[0] == '#' && strlen(str) == 7) {
-        res = strtol(str + 1, NULL, 16);
-
-    } else if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
-        res = strtol(str + 2, NULL, 16);
-
-    } else {
-        res = atoi(str);
-    }
-
-    if (errno == ERANGE || res > INT_MAX || res < INT_MIN) {
-        // Handle overflow/underflow
-        return 0;
-    }
-    return res;
-}
-
-esp_err_t cfg_data_set_param(config_data_t* data, const char *name, const char *value)
-{
-    const struct config_meta* cm = config_meta;
-    ESP_LOGI(TAG, "%s %s: '%s'", __func__, name, value);
-    for(; cm->name != NULL; cm++) {
-        if (strcmp(cm->name, name) == 0) {
-            if (cm->type == UINT32) {
-                *(uint32_t*)((unsigned char*)data + cm->offset) = (uint32_t) parse_int(value);
-            } else if (cm->type == UINT16) {
-                *(uint16_t*)((unsigned char*)data + cm->offset) = (uint16_t) parse_int(value);
-            } else if (cm->type == INT16) {
-                *(int16_t*)((unsigned char*)data + cm->offset) = (int16_t) parse_int(value);
-            } else if (cm->type == MACADDR) {
-                macaddr_from_str((unsigned char*)data + cm->offset, value);
-
-            } else if (cm->type == IPV4) {
-                ip4_addr_t tmp;
-                ip4addr_aton(value, &tmp);
-                *(ip4_addr_t*)((unsigned char*)data + cm->offset) = tmp;
-
-            } else if (cm->type == STRING) {
-                size_t len = strlen(value);
-                if (len < cm->size) {
-                    memcpy((char*)data + cm->offset, value, len);
-                    memset((char*)data + cm->offset + len, 0, cm->size - len);
-                } else {
-                    memset((char*)data + cm->offset, 0, cm->size);
-                }
-            } else {
-                return ESP_ERR_INVALID_ARG;
-            }
-            return ESP_OK;
-        }
-    }
-    return ESP_ERR_INVALID_ARG;
-}
-
 esp_err_t cfg_set_param(struct config* cfg, const char *name, const char *value)
 {
     return cfg_data_set_param(&cfg->eeprom, name, value);
 }
 
-void macaddr_from_str(unsigned char *dst, const char * value)
-{
-    unsigned char mac[6];
-    memset(mac, 0, 6);
-
-    if (sscanf(value, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
-               &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == 6) {
-        memcpy(dst, mac, 6);
-    } else if (sscanf(value, "%hhd,%hhd,%hhd,%hhd,%hhd,%hhd",
-                      &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == 6) {
-        memcpy(dst, mac, 6);
-    }
-}
-
 void cfg_dump(struct config * cfg)
 {
-    const struct config_meta* cm = config_meta;
+    const struct config_meta* cm = cfg_meta();
     const struct config_data *eeprom = &cfg->eeprom;
     const struct config_data *running = &cfg->running;
 
@@ -435,38 +266,6 @@ void cfg_dump(struct config * cfg)
     }
 }
 
-bool cfg_meta_json_encode(struct config_data * cfg, const struct config_meta *cm, json_writer_t *jw)
-{
-    if (cm->type == UINT16 || cm->type == INT16) {
-        jw_kv_int(jw, cm->name, *(uint16_t*)((unsigned char*)cfg + cm->offset));
-    } else if (cm->type == UINT32) {
-        jw_kv_int32(jw, cm->name, *(uint32_t*)((unsigned char*)cfg + cm->offset));
-    } else if (cm->type == MACADDR) {
-        jw_kv_mac_in_dec(jw, cm->name, (char *) cfg + cm->offset);
-    } else if (cm->type == STRING) {
-        jw_kv_str(jw, cm->name, (char *)cfg + cm->offset);
-    } else if (cm->type == IPV4) {
-        static char ipbuf[16];
-        ip4_addr_t val = *(ip4_addr_t*)((unsigned char*)cfg + cm->offset);
-        jw_kv_str(jw, cm->name, ip4addr_ntoa_r(&val, ipbuf, sizeof(ipbuf)));
-    } else {
-        printf("%s: unkown type of attribute %s\n",__func__, cm->name);
-    }
-    return !jw->error;
-}
-
-bool cfg_json_encode(struct config_data * cfg, json_writer_t *jw)
-{
-    const struct config_meta* cm = config_meta;
-
-    jw_object(jw) {
-        for(; cm->name != NULL; cm++) {
-            cfg_meta_json_encode(cfg, cm, jw);
-        }
-    }
-    return !jw->error;
-}
-
 void cfg_eeprom_to_running(struct config * cfg) {
     cfg->running = cfg->eeprom;
 }
@@ -484,10 +283,3 @@ bool cfg_has_elrs_uid(const config_data_t *cfg)
     }
     return false;
 }
-
-const struct config_meta* cfg_meta()
-{
-    return config_meta;
-}
-
-
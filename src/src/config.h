@@ -40,6 +40,9 @@ bool cfg_changed(struct config*);
 const struct config_meta* cfg_meta();
 
 void cfg_dump(struct config*);
+
+/* config_json.c, the key lookup of cfg_data_set_param(), built on the first call if not before */
+void cfg_json_init(void);
 bool cfg_json_encode(struct config_data * cfg, json_writer_t *jw);
 bool cfg_meta_json_encode(struct config_data * cfg, const struct config_meta *meta, json_writer_t *jw);
 
@@ -32,9 +32,15 @@ struct config_rssi {
     uint16_t offset_enter; /* The percentage of Peak-RSSI to count a drone entered the gate range: 50-100 */
     uint16_t offset_leave; /* The percentage of Peak-RSSI to count a drone leave the gate range: 50-100 */
 
+    uint16_t filter_median;   /* Median of this many samples before the filter, 0: off, Range: 3-9 */
+    uint16_t filter_kalman_q; /* Kalman process noise in mV per sample */
+    uint16_t filter_kalman_r; /* Kalman measurement noise in mV, 0: off */
+
     uint16_t calib_max_lap_count;
     uint16_t calib_min_rssi_peak;
 
+    uint16_t auto_threshold; /* 1: estimate peak, enter and leave from the RSSI, peak is the start value */
+
     uint32_t led_color; /* used for capture the flag team LED color */
 
     char name[CFG_MAX_NAME_LEN];
@@ -44,7 +50,7 @@ struct config_data {
     char magic[8];
 
     config_rssi_t rssi[CFG_MAX_FREQ];
-    int16_t rssi_offset;
+    int16_t rssi_offset;               /* added to all RSSI readings, to even out the nodes */
 
     uint8_t elrs_uid[6];
     uint16_t osd_x;
@@ -67,3 +73,40 @@ struct config_data {
 };
 
 
+
+/*
+ * The fields of the config and their type (enum config_type of config.h),
+ * the key of a field is its name, "rssi[0].freq" for those of config_rssi.
+ * Expanded with X(type, field, arg) into config_meta[] and the JSON codec
+ * (config_json.c), a new field only has to be added here.
+ */
+#define CFG_RSSI_FIELDS(X, arg)             \
+    X(STRING, name, arg)                    \
+    X(UINT16, freq, arg)                    \
+    X(UINT16, peak, arg)                    \
+    X(UINT16, filter, arg)                  \
+    X(UINT16, filter_median, arg)           \
+    X(UINT16, filter_kalman_q, arg)         \
+    X(UINT16, filter_kalman_r, arg)         \
+    X(UINT16, offset_enter, arg)            \
+    X(UINT16, offset_leave, arg)            \
+    X(UINT16, calib_max_lap_count, arg)     \
+    X(UINT16, calib_min_rssi_peak, arg)     \
+    X(UINT16, auto_threshold, arg)          \
+    X(UINT32, led_color, arg)
+
+#define CFG_FIELDS(X, arg)                  \
+    X(INT16, rssi_offset, arg)              \
+    X(MACADDR, elrs_uid, arg)               \
+    X(UINT16, osd_x, arg)                   \
+    X(UINT16, osd_y, arg)                   \
+    X(STRING, osd_format, arg)              \
+    X(UINT16, wifi_mode, arg)               \
+    X(STRING, ssid, arg)                    \
+    X(STRING, passphrase, arg)              \
+    X(STRING, node_name, arg)               \
+    X(UINT16, node_mode, arg)               \
+    X(IPV4, ctrl_ipv4, arg)                 \
+    X(UINT16, ctrl_port, arg)               \
+    X(UINT16, game_mode, arg)               \
+    X(UINT16, led_num, arg)
@@ -0,0 +1,426 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * JSON codec of struct config_data, expanded from the field lists of
+ * config_data.h: the encoder writes each field with its key pre-quoted,
+ * without looking at config_meta[]. The decoder takes the index of
+ * "rssi[N]." from the key and finds the field by a perfect hash over the
+ * names of the config_rssi fields or the others, one hash and one compare
+ * per key, then calls the parser of the field's type.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "lwip/ip4_addr.h"
+#include "config.h"
+
+static const char *TAG = "config_json";
+
+_Static_assert(CFG_MAX_FREQ == 8, "config_meta[] lists 8 rssi blocks");
+
+#define CFG_META(type_, field)                          \
+    {                                                   \
+        .name = #field,                                 \
+        .type = type_,                                  \
+        .size = sizeof(((struct config_data*)0)->field),\
+        .offset = offsetof(struct config_data, field)   \
+    },
+#define CFG_META_RSSI(type, field, idx)     CFG_META(type, rssi[idx].field)
+#define CFG_META_DATA(type, field, arg)     CFG_META(type, field)
+
+const struct config_meta config_meta[] =
+    {
+        CFG_RSSI_FIELDS(CFG_META_RSSI, 0)
+        CFG_RSSI_FIELDS(CFG_META_RSSI, 1)
+        CFG_RSSI_FIELDS(CFG_META_RSSI, 2)
+        CFG_RSSI_FIELDS(CFG_META_RSSI, 3)
+        CFG_RSSI_FIELDS(CFG_META_RSSI, 4)
+        CFG_RSSI_FIELDS(CFG_META_RSSI, 5)
+        CFG_RSSI_FIELDS(CFG_META_RSSI, 6)
+        CFG_RSSI_FIELDS(CFG_META_RSSI, 7)
+        CFG_FIELDS(CFG_META_DATA, 0)
+        {.name = NULL}
+    };
+
+const struct config_meta* cfg_meta()
+{
+    return config_meta;
+}
+
+/*
+ * Encoder
+ */
+static void cfg_enc_UINT16(json_writer_t *jw, const char *key, size_t len, const uint16_t *v)
+{
+    jw_key(jw, key, len);
+    jw_int(jw, *v);
+}
+
+static void cfg_enc_INT16(json_writer_t *jw, const char *key, size_t len, const int16_t *v)
+{
+    jw_key(jw, key, len);
+    jw_int(jw, *v);
+}
+
+static void cfg_enc_UINT32(json_writer_t *jw, const char *key, size_t len, const uint32_t *v)
+{
+    jw_key(jw, key, len);
+    jw_uint64(jw, *v);
+}
+
+static void cfg_enc_STRING(json_writer_t *jw, const char *key, size_t len, const char *v)
+{
+    jw_key(jw, key, len);
+    jw_str(jw, v);
+}
+
+static void cfg_enc_MACADDR(json_writer_t *jw, const char *key, size_t len, const uint8_t *v)
+{
+    char buf[24];
+
+    snprintf(buf, sizeof(buf), "%u,%u,%u,%u,%u,%u", v[0], v[1], v[2], v[3], v[4], v[5]);
+    jw_key(jw, key, len);
+    jw_str(jw, buf);
+}
+
+static void cfg_enc_IPV4(json_writer_t *jw, const char *key, size_t len, const uint32_t *v)
+{
+    char buf[16];
+    ip4_addr_t ip4 = { .addr = *v };
+
+    jw_key(jw, key, len);
+    jw_str(jw, ip4addr_ntoa_r(&ip4, buf, sizeof(buf)));
+}
+
+#define CFG_KEY(field)                      "\"" #field "\":"
+#define CFG_ENC(type, field)                \
+    cfg_enc_##type(jw, CFG_KEY(field), sizeof(CFG_KEY(field)) - 1, (const void*) &cfg->field);
+#define CFG_ENC_RSSI(type, field, idx)      CFG_ENC(type, rssi[idx].field)
+#define CFG_ENC_DATA(type, field, arg)      CFG_ENC(type, field)
+
+static void cfg_json_encode_rssi(const struct config_data *cfg, int idx, json_writer_t *jw)
+{
+    switch (idx) {
+        case 0: CFG_RSSI_FIELDS(CFG_ENC_RSSI, 0) break;
+        case 1: CFG_RSSI_FIELDS(CFG_ENC_RSSI, 1) break;
+        case 2: CFG_RSSI_FIELDS(CFG_ENC_RSSI, 2) break;
+        case 3: CFG_RSSI_FIELDS(CFG_ENC_RSSI, 3) break;
+        case 4: CFG_RSSI_FIELDS(CFG_ENC_RSSI, 4) break;
+        case 5: CFG_RSSI_FIELDS(CFG_ENC_RSSI, 5) break;
+        case 6: CFG_RSSI_FIELDS(CFG_ENC_RSSI, 6) break;
+        case 7: CFG_RSSI_FIELDS(CFG_ENC_RSSI, 7) break;
+    }
+}
+
+bool cfg_json_encode(struct config_data * cfg, json_writer_t *jw)
+{
+    jw_object(jw) {
+        for (int i = 0; i < CFG_MAX_FREQ; i++)
+            cfg_json_encode_rssi(cfg, i, jw);
+        CFG_FIELDS(CFG_ENC_DATA, 0)
+    }
+    return !jw->error;
+}
+
+/* A single field, by its meta data */
+bool cfg_meta_json_encode(struct config_data * cfg, const struct config_meta *cm, json_writer_t *jw)
+{
+    void *v = (unsigned char*)cfg + cm->offset;
+    char buf[24];
+
+    switch (cm->type) {
+        case UINT16:
+            jw_kv_int(jw, cm->name, *(uint16_t*) v);
+            break;
+        case INT16:
+            jw_kv_int(jw, cm->name, *(int16_t*) v);
+            break;
+        case UINT32:
+            jw_kv_uint64(jw, cm->name, *(uint32_t*) v);
+            break;
+        case MACADDR: {
+            uint8_t *mac = v;
+            snprintf(buf, sizeof(buf), "%u,%u,%u,%u,%u,%u",
+                     mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+            jw_kv_str(jw, cm->name, buf);
+            break;
+        }
+        case STRING:
+            jw_kv_str(jw, cm->name, v);
+            break;
+        case IPV4: {
+            ip4_addr_t ip4 = *(ip4_addr_t*) v;
+            jw_kv_str(jw, cm->name, ip4addr_ntoa_r(&ip4, buf, sizeof(buf)));
+            break;
+        }
+        default:
+            ESP_LOGE(TAG, "%s: unkown type of attribute %s", __func__, cm->name);
+    }
+    return !jw->error;
+}
+
+/*
+ * Decoder
+ */
+typedef struct {
+    const char *name;
+    uint8_t len;
+    uint8_t type;
+    uint16_t offset;        /* in config_rssi or config_data */
+    uint16_t size;
+} cfg_field_t;
+
+#define CFG_FIELD(type_, s, field)                      \
+    {                                                   \
+        .name = #field,                                 \
+        .len = sizeof(#field) - 1,                      \
+        .type = type_,                                  \
+        .offset = offsetof(s, field),                   \
+        .size = sizeof(((s*)0)->field)                  \
+    },
+#define CFG_FIELD_RSSI(type, field, arg)    CFG_FIELD(type, struct config_rssi, field)
+#define CFG_FIELD_DATA(type, field, arg)    CFG_FIELD(type, struct config_data, field)
+
+static const cfg_field_t cfg_rssi_fields[] = { CFG_RSSI_FIELDS(CFG_FIELD_RSSI, 0) };
+static const cfg_field_t cfg_data_fields[] = { CFG_FIELDS(CFG_FIELD_DATA, 0) };
+
+#define CFG_HASH_SLOTS      64
+
+typedef struct {
+    const cfg_field_t *fields;
+    size_t cnt;
+    uint32_t seed;
+    bool ready;                     /* else the fields are scanned */
+    uint8_t slot[CFG_HASH_SLOTS];   /* 1 + index of the field, 0: none */
+} cfg_hash_t;
+
+static cfg_hash_t cfg_rssi_hash = {
+    cfg_rssi_fields, sizeof(cfg_rssi_fields) / sizeof(cfg_rssi_fields[0])
+};
+static cfg_hash_t cfg_data_hash = {
+    cfg_data_fields, sizeof(cfg_data_fields) / sizeof(cfg_data_fields[0])
+};
+
+_Static_assert(sizeof(cfg_rssi_fields) / sizeof(cfg_rssi_fields[0]) < CFG_HASH_SLOTS / 2 &&
+               sizeof(cfg_data_fields) / sizeof(cfg_data_fields[0]) < CFG_HASH_SLOTS / 2,
+               "CFG_HASH_SLOTS too small to find a perfect hash");
+
+/* FNV-1a, seeded */
+static uint32_t cfg_hash_key(const char *s, size_t len, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+
+    while (len--) {
+        h ^= (uint8_t) *s++;
+        h *= 16777619u;
+    }
+    return (h ^ (h >> 16)) & (CFG_HASH_SLOTS - 1);
+}
+
+/* The first seed without collisions, the names are constant, so is the seed */
+static void cfg_hash_build(cfg_hash_t *t)
+{
+    size_t i;
+
+    for (uint32_t seed = 1; seed < 100000; seed++) {
+        memset(t->slot, 0, sizeof(t->slot));
+        for (i = 0; i < t->cnt; i++) {
+            uint32_t h = cfg_hash_key(t->fields[i].name, t->fields[i].len, seed);
+
+            if (t->slot[h])
+                break;
+            t->slot[h] = i + 1;
+        }
+        if (i == t->cnt) {
+            t->seed = seed;
+            t->ready = true;
+            return;
+        }
+    }
+    ESP_LOGE(TAG, "No perfect hash of %d keys", (int) t->cnt);
+}
+
+static const cfg_field_t *cfg_hash_find(const cfg_hash_t *t, const char *name, size_t len)
+{
+    const cfg_field_t *f;
+    uint8_t i;
+
+    if (!t->ready) {
+        for (f = t->fields; f < t->fields + t->cnt; f++) {
+            if (f->len == len && memcmp(f->name, name, len) == 0)
+                return f;
+        }
+        return NULL;
+    }
+
+    if (!(i = t->slot[cfg_hash_key(name, len, t->seed)]))
+        return NULL;
+    f = &t->fields[i - 1];
+    return f->len == len && memcmp(f->name, name, len) == 0 ? f : NULL;
+}
+
+/* "rssi[N].field" or "field", offset is set to the one of the value in config_data */
+static const cfg_field_t *cfg_field_find(const char *name, size_t *offset)
+{
+    const cfg_field_t *f;
+    unsigned int idx;
+
+    if (strncmp(name, "rssi[", 5) == 0) {
+        idx = name[5] - '0';
+        if (idx >= CFG_MAX_FREQ || name[6] != ']' || name[7] != '.')
+            return NULL;
+        f = cfg_hash_find(&cfg_rssi_hash, name + 8, strlen(name + 8));
+        *offset = offsetof(struct config_data, rssi) + idx * sizeof(struct config_rssi);
+    } else {
+        f = cfg_hash_find(&cfg_data_hash, name, strlen(name));
+        *offset = 0;
+    }
+    if (f)
+        *offset += f->offset;
+    return f;
+}
+
+/* Every name in config_meta[] has to resolve to its own field */
+static void cfg_json_check(void)
+{
+    const cfg_field_t *f;
+    size_t offset;
+
+    for (const struct config_meta *cm = config_meta; cm->name; cm++) {
+        f = cfg_field_find(cm->name, &offset);
+        if (!f || offset != cm->offset || f->type != cm->type || f->size != cm->size)
+            ESP_LOGE(TAG, "%s: lookup of %s failed", __func__, cm->name);
+    }
+}
+
+void cfg_json_init(void)
+{
+    static bool initialized;
+
+    if (!initialized) {
+        cfg_hash_build(&cfg_rssi_hash);
+        cfg_hash_build(&cfg_data_hash);
+        cfg_json_check();
+        initialized = true;
+    }
+}
+
+/*
+ * "#rrggbb", "0x.." or decimal, which stops at the first other char like
+ * atoi(). 0 if it does not fit 32 bits.
+ */
+static int64_t cfg_parse_int(const char *s)
+{
+    int64_t v = 0;
+    int base = 10, d;
+    bool neg = false;
+
+    if (s[0] == '#' && strlen(s) == 7) {
+        s++;
+        base = 16;
+    } else if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        s += 2;
+        base = 16;
+    } else {
+        while (*s == ' ' || (*s >= '\t' && *s <= '\r'))
+            s++;
+        if (*s == '-' || *s == '+')
+            neg = *s++ == '-';
+    }
+
+    for (;; s++) {
+        if (*s >= '0' && *s <= '9')
+            d = *s - '0';
+        else if (base == 16 && (*s | 0x20) >= 'a' && (*s | 0x20) <= 'f')
+            d = (*s | 0x20) - 'a' + 10;
+        else
+            break;
+        v = v * base + d;
+        if (v > UINT32_MAX)
+            return 0;
+    }
+    return neg ? -v : v;
+}
+
+static esp_err_t cfg_dec_UINT16(void *dst, size_t size, const char *value)
+{
+    *(uint16_t*) dst = cfg_parse_int(value);
+    return ESP_OK;
+}
+
+static esp_err_t cfg_dec_INT16(void *dst, size_t size, const char *value)
+{
+    *(int16_t*) dst = cfg_parse_int(value);
+    return ESP_OK;
+}
+
+static esp_err_t cfg_dec_UINT32(void *dst, size_t size, const char *value)
+{
+    *(uint32_t*) dst = cfg_parse_int(value);
+    return ESP_OK;
+}
+
+static esp_err_t cfg_dec_MACADDR(void *dst, size_t size, const char *value)
+{
+    macaddr_from_str(dst, value);
+    return ESP_OK;
+}
+
+static esp_err_t cfg_dec_IPV4(void *dst, size_t size, const char *value)
+{
+    ip4_addr_t tmp;
+
+    ip4addr_aton(value, &tmp);
+    memcpy(dst, &tmp, sizeof(tmp));
+    return ESP_OK;
+}
+
+/* a too long string clears the field */
+static esp_err_t cfg_dec_STRING(void *dst, size_t size, const char *value)
+{
+    size_t len = strnlen(value, size);
+
+    memset(dst, 0, size);
+    if (len < size)
+        memcpy(dst, value, len);
+    return ESP_OK;
+}
+
+static esp_err_t (*const cfg_dec[])(void *dst, size_t size, const char *value) = {
+    [INT16]     = cfg_dec_INT16,
+    [UINT16]    = cfg_dec_UINT16,
+    [UINT32]    = cfg_dec_UINT32,
+    [MACADDR]   = cfg_dec_MACADDR,
+    [STRING]    = cfg_dec_STRING,
+    [IPV4]      = cfg_dec_IPV4,
+};
+
+void macaddr_from_str(unsigned char *dst, const char * value)
+{
+    unsigned char mac[6];
+    memset(mac, 0, 6);
+
+    if (sscanf(value, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == 6) {
+        memcpy(dst, mac, 6);
+    } else if (sscanf(value, "%hhd,%hhd,%hhd,%hhd,%hhd,%hhd",
+                      &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == 6) {
+        memcpy(dst, mac, 6);
+    }
+}
+
+esp_err_t cfg_data_set_param(config_data_t* data, const char *name, const char *value)
+{
+    const cfg_field_t *f;
+    size_t offset;
+
+    ESP_LOGD(TAG, "%s %s: '%s'", __func__, name, value);
+    cfg_json_init();
+
+    if (!(f = cfg_field_find(name, &offset)))
+        return ESP_ERR_INVALID_ARG;
+    return cfg_dec[f->type]((unsigned char*) data + offset, f->size, value);
+}
@@ -5,10 +5,11 @@
 #include <sys/param.h>
 #include <esp_http_server.h>
 #include <esp_log.h>
+#include <esp_heap_caps.h>
 
+#include "arena.h"
 #include "config.h"
 #include "esp_err.h"
-#include "esp_http_client.h"
 #include "esp_netif.h"
 #include "esp_netif_types.h"
 #include "jsmn.h"
@@ -17,22 +18,98 @@
 #include "static_files.h"
 #include "json.h"
 #include "osd.h"
+#include "rssi_recorder.h"
+#include "rssi_update.h"
 #include "simple_fpv_timer.h"
+#include "task_rssi.h"
 #include "timer.h"
 #include "gui.h"
+#include "gui_bcast.h"
+#include "gui_http.h"
 
 static const char * TAG = "http";
 static const char * OUT_OF_MEMORY = "Out of memory";
 
+/*
+ * Scratch memory of the /api/v1 handlers, reset at the end of each request.
+ * They all run on the one httpd task.
+ */
+#define GUI_ARENA_SIZE  (16 * 1024)
+static uint8_t gui_arena_buf[GUI_ARENA_SIZE] __attribute__((aligned(16)));
+static arena_t gui_arena;
+
+/*
+ * Of a /ws/rssi client, only used by the httpd task. The broadcaster gets
+ * a copy of the subscription, the session may be gone when a message is
+ * sent.
+ */
 typedef struct {
-    bool will_rssi_update;
+    int fd;
+    gui_bcast_sub_t sub;
 } session_ctx_t;
 
+static session_ctx_t *session_ctx_new(int fd)
+{
+    session_ctx_t *sess = calloc(1, sizeof(session_ctx_t));
+
+    if (sess) {
+        sess->fd = fd;
+        sess->sub = (gui_bcast_sub_t) GUI_BCAST_SUB_DEFAULT();
+    }
+    return sess;
+}
+
 void session_ctx_free(void *s)
 {
+    /* the socket is closed, its queued messages can go */
+    gui_bcast_close(((session_ctx_t*) s)->fd);
     free(s);
 }
 
+static void session_ctx_subscribe(session_ctx_t *sess, json_t *jr)
+{
+    static const struct {
+        const char *name;
+        gui_topic_t topic;
+    } topics[] = {
+        { "players", GUI_TOPIC_PLAYERS },
+        { "ctf", GUI_TOPIC_CTF },
+        { "rssi", GUI_TOPIC_RSSI },
+    };
+    gui_bcast_sub_t *sub = &sess->sub;
+    json_t arr, e;
+    char name[16];
+    int n, v;
+
+    if (j_find(jr, "topics", &arr) && arr.tokens->type == JSMN_ARRAY) {
+        sub->topics = 0;
+        memset(&e, 0, sizeof(e));
+        for (n = arr.tokens->size; n > 0 && j_next(&arr, &e); n--) {
+            if (!j_get_str(&e, name, sizeof(name)))
+                continue;
+            for (int i = 0; i < sizeof(topics) / sizeof(topics[0]); i++) {
+                if (strcmp(name, topics[i].name) == 0)
+                    sub->topics |= topics[i].topic;
+            }
+        }
+    }
+
+    if (j_find(jr, "freq", &arr) && arr.tokens->type == JSMN_ARRAY) {
+        sub->rssi_freq_cnt = 0;
+        memset(&e, 0, sizeof(e));
+        for (n = arr.tokens->size; n > 0 && j_next(&arr, &e); n--) {
+            if (j_get_int(&e, &v) && sub->rssi_freq_cnt < CFG_MAX_FREQ)
+                sub->rssi_freq[sub->rssi_freq_cnt++] = v;
+        }
+    }
+
+    if (j_find_int(jr, "decimate", &v))
+        sub->rssi_decimate = MAX(v, 1);
+
+    ESP_LOGI(TAG, "Subscribed topics:0x%"PRIx32" freqs:%d decimate:%d",
+             sub->topics, sub->rssi_freq_cnt, sub->rssi_decimate);
+}
+
 static esp_err_t get_root_handler(httpd_req_t *req)
 {
     ctx_t *ctx = (ctx_t*) req->user_ctx;
@@ -70,16 +147,39 @@ static esp_err_t get_root_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/*
+ * The files are sent with their content hash as ETag, a reload only costs a
+ * 304 per file. The html references them as 'name?v=<hash>' (see
+ * prepare_data_folder.py), those never change and are cached for a year.
+ */
 static esp_err_t get_static_handler(httpd_req_t *req)
 {
-    /* Send a simple response */
     const struct static_files *sf = (const struct static_files *) req->user_ctx;
+    char etag[20];
+    char buf[64];
+    char v[20];
+    bool versioned = false;
+
+    snprintf(etag, sizeof(etag), "\"%s\"", sf->hash);
+
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) == ESP_OK &&
+        httpd_query_key_value(buf, "v", v, sizeof(v)) == ESP_OK)
+        versioned = strcmp(v, sf->hash) == 0;
+
+    httpd_resp_set_hdr(req, "ETag", etag);
+    if (versioned)
+        httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=31536000, immutable");
+    else
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", buf, sizeof(buf)) == ESP_OK &&
+        (strstr(buf, etag) || strcmp(buf, "*") == 0)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
 
     httpd_resp_set_type(req, sf->type);
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    httpd_resp_set_hdr(req, "Expires", "-1");
-    httpd_resp_set_hdr(req, "Connection", "close");
     if (sf->is_gzip)
         httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
 
@@ -94,7 +194,7 @@ static esp_err_t ws_rssi_handler(httpd_req_t *req)
     static char ws_buffer[512];
 
     if (! req->sess_ctx) {
-        req->sess_ctx = malloc(sizeof(session_ctx_t));
+        req->sess_ctx = session_ctx_new(httpd_req_to_sockfd(req));
         req->free_ctx = session_ctx_free;
     } else {
         ESP_LOGI(TAG, "session: %p", req->sess_ctx);
@@ -121,15 +221,40 @@ static esp_err_t ws_rssi_handler(httpd_req_t *req)
     }
 
     ESP_LOGI(TAG, "Received ws pkt length:%d %.*s", ws_pkt.len, ws_pkt.len, ws_buffer);
+
+    if (ws_pkt.type == HTTPD_WS_TYPE_TEXT && req->sess_ctx) {
+        session_ctx_t *sess = (session_ctx_t*) req->sess_ctx;
+        static jsmntok_t tokens[48];
+        json_t jr;
+        char str[16];
+
+        j_init(&jr, tokens, sizeof(tokens) / sizeof(tokens[0]));
+        if (j_parse(&jr, ws_buffer, ws_pkt.len)) {
+            /* the client picks the format of the RSSI updates, JSON if it does not */
+            if (j_find_str(&jr, "format", str, sizeof(str)))
+                sess->sub.rssi_binary = strcmp(str, "binary") == 0;
+
+            if (j_find_str(&jr, "type", str, sizeof(str)) && strcmp(str, "subscribe") == 0)
+                session_ctx_subscribe(sess, &jr);
+
+            if (gui_bcast_subscribe(fd, &sess->sub) != ESP_OK)
+                ESP_LOGW(TAG, "No broadcast slot for socket %d", fd);
+        }
+    }
     return ESP_OK;
 }
 
-static void request_send_json(httpd_req_t *req, const char *json, size_t len)
+static void request_set_json_hdr(httpd_req_t *req)
 {
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
     httpd_resp_set_hdr(req, "Pragma", "no-cache");
     httpd_resp_set_hdr(req, "Expires", "-1");
+}
+
+static void request_send_json(httpd_req_t *req, const char *json, size_t len)
+{
+    request_set_json_hdr(req);
     httpd_resp_send(req, json, len);
 }
 
@@ -139,6 +264,9 @@ static void request_send_ok(httpd_req_t *req)
     request_send_json(req, "{\"status\":\"ok\"}", 15);
 }
 
+/* error responses sent, to count them per route */
+static uint32_t request_errors;
+
 static void request_send_error(httpd_req_t *req, const char *msg, ...)
 {
     int len;
@@ -147,6 +275,8 @@ static void request_send_error(httpd_req_t *req, const char *msg, ...)
     static char err_buf[64];
     static char json_buf[128];
 
+    request_errors++;
+
     va_start (args, msg);
     len = vsnprintf (err_buf, sizeof(err_buf), msg, args);
     va_end (args);
@@ -166,41 +296,244 @@ static void request_send_error(httpd_req_t *req, const char *msg, ...)
     }
 }
 
-static esp_err_t api_v1_get_handler(httpd_req_t *req)
+static void request_send_rssi_trace(httpd_req_t *req, char *buf, size_t buf_sz)
 {
-    ctx_t *ctx = (ctx_t*) req->user_ctx;
-    static const int buf_sz = 1024 * 4;
-    json_writer_t jw;
-    char *buf = NULL;
+    uint32_t pos = 0;
+    size_t len;
 
-    if (!(buf = malloc(buf_sz))){
-        request_send_error(req, OUT_OF_MEMORY);
-        return ESP_ERR_NO_MEM;
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"rssi_trace.bin\"");
+
+    while (rssi_recorder_read(&pos, (uint8_t*) buf, buf_sz, &len) == ESP_OK) {
+        if (httpd_resp_send_chunk(req, buf, len) != ESP_OK)
+            return;
     }
+    httpd_resp_send_chunk(req, NULL, 0);
+}
 
-    jw_init(&jw, buf, buf_sz);
+/*
+ * The /api/v1 endpoints. api_routes[] is sorted by method and path (checked
+ * by api_routes_check() at start), a request is dispatched by a binary search.
+ */
+typedef struct {
+    httpd_req_t *req;
+    ctx_t *ctx;
+    json_writer_t jw;       /* GET: response of the route's buf_sz */
+    char *buf;
+    size_t buf_sz;
+    json_t jr;              /* POST: the parsed body */
+    j_index_t jr_idx;       /* POST: its keys */
+    char *key;              /* POST: scratch of API_TMP_STR_SZ */
+    char *value;
+} api_req_t;
 
-    ESP_LOGI(TAG, "%s URI: %s", __func__, req->uri);
-    if (strcmp(req->uri, "/api/v1/settings") == 0) {
-        if (sft_encode_settings(ctx, &jw))
-            request_send_json(req, jw.buf, strlen(jw.buf));
-        else
-            request_send_error(req, "JSON buffer to small - needed:%d", jw.needed_space);
+typedef struct {
+    httpd_method_t method;
+    const char *path;       /* after /api/v1/ */
+    esp_err_t (*handler)(api_req_t *r);
+    uint16_t buf_sz;        /* GET: response (staging) buffer, POST: max. body */
+    bool raw_body;          /* POST: no parsing, buf_sz is the receive buffer */
+} api_route_t;
+
+#define API_PREFIX          "/api/v1/"
+#define API_TMP_STR_SZ      32
+#define API_JSON_TOKENS     512
+#define API_HIST_BUCKETS    6   /* handler time <1, <4, <16, <64, <256, >=256ms */
+
+/*
+ * Streamed JSON response, the route's buf_sz is only the staging buffer,
+ * sent as a chunk whenever it is full.
+ */
+static int api_stream_sink(void *arg, const char *buf, size_t len)
+{
+    return httpd_resp_send_chunk((httpd_req_t*) arg, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static json_writer_t *api_stream_start(api_req_t *r)
+{
+    request_set_json_hdr(r->req);
+    jw_init_stream(&r->jw, r->buf, r->buf_sz, api_stream_sink, r->req);
+    return &r->jw;
+}
+
+static esp_err_t api_stream_end(api_req_t *r)
+{
+    json_writer_t *jw = &r->jw;
+
+    if (jw_flush(jw))
+        return httpd_resp_send_chunk(r->req, NULL, 0);
+
+    if (jw->flushed == 0) {
+        request_send_error(r->req, "JSON buffer to small - needed:%d", jw->needed_space);
+        return ESP_OK;
+    }
+    /* part of the JSON is out, ESP_FAIL closes the connection */
+    ESP_LOGE(TAG, "%s: JSON stream failed after %d bytes", r->req->uri, jw->flushed);
+    request_errors++;
+    return ESP_FAIL;
+}
+
+typedef struct {
+    uint32_t requests;
+    uint32_t errors;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t hist[API_HIST_BUCKETS];
+} api_route_stats_t;
+
+static esp_err_t api_get_settings(api_req_t *r)
+{
+    sft_encode_settings(r->ctx, api_stream_start(r));
+    return api_stream_end(r);
+}
 
-    } else if (strcmp(req->uri, "/api/v1/ctf/stop") == 0) {
-        sft_ctf_stop(ctx);
-        request_send_ok(req);
+static esp_err_t api_get_ctf_stop(api_req_t *r)
+{
+    sft_ctf_stop(r->ctx);
+    request_send_ok(r->req);
+    return ESP_OK;
+}
+
+static esp_err_t api_get_rssi_update(api_req_t *r)
+{
+    jw_object(&r->jw) {
+        jw_kv_bool(&r->jw, "enable", r->ctx->send_rssi_updates);
+    }
+    request_send_ok(r->req);
+    return ESP_OK;
+}
+
+static esp_err_t api_get_rssi_trace(api_req_t *r)
+{
+    request_send_rssi_trace(r->req, r->buf, r->buf_sz);
+    return ESP_OK;
+}
 
-    } else if (strcmp(req->uri, "/api/v1/rssi/update") == 0) {
-        jw_object(&jw) {
-            jw_kv_bool(&jw, "enable", ctx->send_rssi_updates);
+static esp_err_t api_get_rssi_trace_status(api_req_t *r)
+{
+    json_writer_t *jw = &r->jw;
+    rssi_recorder_stats_t st;
+    task_rssi_stats_t tst;
+
+    rssi_recorder_stats(&st);
+    task_rssi_stats(&tst);
+    jw_object(jw) {
+        jw_kv_bool(jw, "enabled", st.enabled);
+        jw_kv_uint64(jw, "session", st.session);
+        jw_kv_int(jw, "blocks", st.blocks);
+        jw_kv_int(jw, "capacity", st.capacity);
+        jw_kv_int(jw, "dropped", st.dropped);
+        /* never recorded, the ADC lost them, e.g. during an erase */
+        jw_kv_int(jw, "adc_lost", tst.src_lost);
+    }
+    request_send_json(r->req, jw->buf, jw->wptr - jw->buf);
+    return ESP_OK;
+}
+
+static esp_err_t api_get_rssi_status(api_req_t *r)
+{
+    json_writer_t *jw = &r->jw;
+    task_rssi_stats_t st;
+    rssi_update_stats_t ust;
+
+    task_rssi_stats(&st);
+    rssi_update_stats(&ust);
+    jw_object(jw) {
+        jw_kv_int(jw, "ring_size", st.ring_size);
+        jw_kv_int(jw, "ring_hwm", st.ring_hwm);
+        jw_kv_int(jw, "ring_dropped", st.ring_dropped);
+        jw_kv_int(jw, "adc_lost", st.src_lost);
+        jw_kv_int(jw, "update_blocks", ust.blocks);
+        jw_kv_int(jw, "update_in_use", ust.in_use);
+        jw_kv_int(jw, "update_hwm", ust.hwm);
+        jw_kv_int(jw, "update_exhausted", ust.exhausted);
+        jw_kv_int(jw, "update_posts", ust.posts);
+        jw_kv_int(jw, "update_post_failed", ust.post_failed);
+        jw_kv_int(jw, "update_post_bytes", ust.post_bytes);
+        jw_kv_int(jw, "update_saved_bytes", ust.saved_bytes);
+    }
+    request_send_json(r->req, jw->buf, jw->wptr - jw->buf);
+    return ESP_OK;
+}
+
+static esp_err_t api_get_ws_status(api_req_t *r)
+{
+    json_writer_t *jw = &r->jw;
+    gui_bcast_client_stats_t st[GUI_BCAST_CLIENTS];
+    uint32_t no_slot;
+    int n = gui_bcast_stats(st, GUI_BCAST_CLIENTS, &no_slot);
+
+    jw_object(jw) {
+        jw_kv_int(jw, "no_slot", no_slot);
+        jw_kv(jw, "clients") {
+            jw_array(jw) {
+                for (int i = 0; i < n; i++) {
+                    jw_object(jw) {
+                        jw_kv_int(jw, "fd", st[i].fd);
+                        jw_kv_int(jw, "queued", st[i].queued);
+                        jw_kv_int(jw, "queued_max", st[i].queued_max);
+                        jw_kv_int(jw, "lag_ms", st[i].lag_ms);
+                        jw_kv_int(jw, "lag_max_ms", st[i].lag_max_ms);
+                        jw_kv_int(jw, "sent", st[i].sent);
+                        jw_kv_int(jw, "coalesced", st[i].coalesced);
+                        jw_kv_int(jw, "dropped", st[i].dropped);
+                        jw_kv_int(jw, "errors", st[i].errors);
+                    }
+                }
+            }
         }
-        request_send_ok(req);
-    } else {
-        request_send_error(req, "Uri %s not found", req->uri);
     }
+    request_send_json(r->req, jw->buf, jw->wptr - jw->buf);
+    return ESP_OK;
+}
 
-    free(buf);
+static esp_err_t api_get_heap_status(api_req_t *r)
+{
+    json_writer_t *jw = &r->jw;
+    size_t free_sz = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    jw_object(jw) {
+        jw_kv_int(jw, "free", free_sz);
+        jw_kv_int(jw, "free_min", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+        jw_kv_int(jw, "largest_free_block", largest);
+        /* share of the free memory not usable for the largest allocation */
+        jw_kv_int(jw, "fragmentation", free_sz ? 100 - (largest * 100) / free_sz : 0);
+        jw_kv(jw, "arena") {
+            jw_object(jw) {
+                jw_kv_int(jw, "size", gui_arena.size);
+                jw_kv_int(jw, "used_max", gui_arena.hwm);
+                jw_kv_int(jw, "requests", gui_arena.resets);
+                jw_kv_int(jw, "fails", gui_arena.fails);
+            }
+        }
+    }
+    request_send_json(r->req, jw->buf, jw->wptr - jw->buf);
+    return ESP_OK;
+}
+
+static esp_err_t api_get_http_status(api_req_t *r)
+{
+    json_writer_t *jw = &r->jw;
+    gui_http_stats_t st;
+
+    gui_http_stats(&st);
+    jw_object(jw) {
+        jw_kv_int(jw, "queued", st.queued);
+        jw_kv_int(jw, "queued_max", st.queued_max);
+        jw_kv_int(jw, "sent", st.sent);
+        jw_kv_int(jw, "failed", st.failed);
+        jw_kv_int(jw, "replaced", st.replaced);
+        jw_kv_int(jw, "dropped", st.dropped);
+        jw_kv_int(jw, "lap_batches", st.lap_batches);
+        jw_kv_int(jw, "laps_sent", st.laps_sent);
+        jw_kv_uint64(jw, "lap_seq", st.lap_seq);
+        jw_kv_int(jw, "connects", st.connects);
+        jw_kv_int(jw, "ack_ms_last", st.ack_ms_last);
+        jw_kv_int(jw, "ack_ms_max", st.ack_ms_max);
+        jw_kv_int(jw, "ack_ms_avg", st.ack_ms_avg);
+    }
+    request_send_json(r->req, jw->buf, jw->wptr - jw->buf);
     return ESP_OK;
 }
 
@@ -220,106 +553,284 @@ static esp_err_t get_remote_ip4(httpd_req_t *req, ip4_addr_t *ip4)
     }
 }
 
-static const char* strstartwith(const char *str, const char *needle)
+typedef struct {
+    api_req_t *r;
+    config_data_t *cfg;
+} api_settings_t;
+
+static int api_settings_kv(void *arg, const char *key, const char *value)
 {
-    if (!str || !needle || !strlen(needle))
-        return NULL;
+    api_settings_t *st = arg;
 
-    if (strncmp(str, needle, strlen(needle)) == 0)
-        return str + strlen(needle);
+    if (cfg_data_set_param(st->cfg, key, value) == ESP_OK)
+        return 0;
+    snprintf(st->r->key, API_TMP_STR_SZ, "%s", key);
+    snprintf(st->r->value, API_TMP_STR_SZ, "%s", value);
+    return 1;
+}
 
-    return NULL;
+/*
+ * The body is parsed as it is received, into a copy of the config, which
+ * is only taken when all of it is valid. No limit of the body's size.
+ */
+static esp_err_t api_post_settings(api_req_t *r)
+{
+    ctx_t *ctx = r->ctx;
+    httpd_req_t *req = r->req;
+    api_settings_t st = { .r = r };
+    j_sax_t *sax = arena_alloc(&gui_arena, sizeof(*sax));
+    int len = 0, n, err = 0;
+
+    st.cfg = arena_alloc(&gui_arena, sizeof(*st.cfg));
+    if (!sax || !st.cfg) {
+        request_send_error(req, OUT_OF_MEMORY);
+        return ESP_ERR_NO_MEM;
+    }
+    *st.cfg = ctx->cfg.eeprom;
+
+    j_sax_init(sax, api_settings_kv, &st);
+    if (req->content_len == 0)
+        err = j_sax_feed(sax, "{}", 2);
+
+    while (len < req->content_len && err == 0) {
+        if ((n = httpd_req_recv(req, r->buf, MIN(r->buf_sz, req->content_len - len))) <= 0) {
+            if (n == HTTPD_SOCK_ERR_TIMEOUT)
+                continue;
+            request_send_error(req, "Failed to read payload");
+            return ESP_FAIL;
+        }
+        err = j_sax_feed(sax, r->buf, n);
+        len += n;
+    }
+
+    if (err > 0) {
+        request_send_error(req, "Invalid key/value %s=%s", r->key, r->value);
+        return ESP_OK;
+    } else if (err < 0 || !j_sax_done(sax)) {
+        ESP_LOGE(TAG, "Failed to parse json (len:%d)", len);
+        request_send_error(req, "Failed to parse json");
+        return ESP_OK;
+    }
+
+    ctx->cfg.eeprom = *st.cfg;
+    cfg_verify(&ctx->cfg);
+    if (cfg_save(&ctx->cfg) == ESP_OK) {
+        if (sft_update_settings(ctx))
+            request_send_ok(r->req);
+        else {
+            request_send_error(r->req, "Failed to apply all settings - reboot");
+        }
+    } else  {
+        request_send_error(r->req, "Failed to write config to eeprom");
+    }
+    return ESP_OK;
 }
 
-static inline bool streq(const char *str1, const char *str2)
+static esp_err_t api_post_start_calibration(api_req_t *r)
 {
-    return strcmp(str1, str2) == 0;
+    sft_start_calibration(r->ctx);
+    request_send_ok(r->req);
+    return ESP_OK;
 }
 
-static esp_err_t api_v1_post_osd(httpd_req_t *req, ctx_t *ctx, const char *uri_tok, json_t *jr)
+static esp_err_t api_post_clear_laps(api_req_t *r)
 {
-    osd_t *osd = &ctx->osd;
-    json_writer_t jw;
-    char *tmp_buf64 = NULL;
-    char *tmp2_buf64 = NULL;
-    static const int jsmn_tokens_num = 512;
+    lap_counter_t *lc = &r->ctx->lc;
+    struct player_s *player;
+    millis_t offset;
 
-    jsmntok_t *tokens;
-    int x, y;
+    if (!j_find_uint64(&r->jr, "offset", &offset))
+        offset = 30000;
 
+    for (int i=0; i < MAX_PLAYER; i++) {
+        player = &lc->players[i];
+        memset(player->laps, 0, sizeof(player->laps));
+        player->next_idx = 0;
+    }
 
-    if (!(tokens = malloc(jsmn_tokens_num))) {
-        request_send_error(req, OUT_OF_MEMORY);
-        return ESP_ERR_NO_MEM;
+    sft_event_start_race_t ev = {.offset = offset };
+    ESP_ERROR_CHECK(
+        esp_event_post(SFT_EVENT, SFT_EVENT_START_RACE,
+                       &ev, sizeof(ev), pdMS_TO_TICKS(500)));
+
+    request_send_ok(r->req);
+    return ESP_OK;
+}
+
+static esp_err_t api_post_player_connect(api_req_t *r)
+{
+    if (j_find_str(&r->jr, "player", r->value, API_TMP_STR_SZ)) {
+        ip4_addr_t ip4 = {0};
+        if (get_remote_ip4(r->req, &ip4) == ESP_OK) {
+            if (sft_on_player_connect(r->ctx, ip4, r->value) == ESP_OK)
+                request_send_ok(r->req);
+            else
+                request_send_error(r->req, "Failed to create player: %s", r->value);
+        } else
+        request_send_error(r->req, "No remote IP");
+    } else
+    request_send_error(r->req, "Missing key 'player'");
+    return ESP_OK;
+}
+
+static esp_err_t api_post_player_lap(api_req_t *r)
+{
+    json_t laps, lap;
+    int id, rssi, n;
+    millis_t duration;
+    uint64_t epoch, seq;
+    ip4_addr_t ip4 = {0};
+    esp_err_t e = ESP_OK;
+
+    /* {"laps":[{..}, ..]} from the batching children, or {"lap":{..}} */
+    if (get_remote_ip4(r->req, &ip4) == ESP_OK &&
+        j_find_str(&r->jr, "player", r->value, API_TMP_STR_SZ) &&
+        (j_find(&r->jr, "laps", &laps) || j_find(&r->jr, "lap", &laps))
+    ) {
+        if (!j_find_uint64(&r->jr, "epoch", &epoch))
+            epoch = 0;
+        memset(&lap, 0, sizeof(lap));
+        if (laps.tokens->type == JSMN_ARRAY)
+            n = laps.tokens->size;
+        else {
+            lap = laps;
+            n = 1;
+        }
+        for (; n > 0 && e == ESP_OK; n--) {
+            if (laps.tokens->type == JSMN_ARRAY && !j_next(&laps, &lap))
+                break;
+            if (!j_find_uint64(&lap, "seq", &seq))
+                seq = 0;
+            if (j_find_int(&lap, "id", &id) &&
+                j_find_int(&lap, "rssi", &rssi) &&
+                j_find_uint64(&lap, "duration", &duration))
+                e = sft_on_player_lap(r->ctx, ip4, id, rssi, duration, epoch, seq);
+            else
+                e = ESP_ERR_INVALID_ARG;
+        }
+        if (e == ESP_OK)
+            request_send_ok(r->req);
+        else
+            request_send_error(r->req, "Failed to add players lap");
+
+    } else
+    request_send_error(r->req, "Failed to parse json");
+    return ESP_OK;
+}
+
+static esp_err_t api_post_rssi_update(api_req_t *r)
+{
+    int enabled = 0;
+
+    if (j_find_int(&r->jr, "enabled", &enabled)) {
+        r->ctx->send_rssi_updates = !! enabled;
+        request_send_ok(r->req);
+    } else {
+        request_send_error(r->req, "Failed to parse json");
     }
+    return ESP_OK;
+}
 
-    if (!(tmp_buf64 = malloc(64))) {
-        free(tokens);
-        request_send_error(req, OUT_OF_MEMORY);
-        return ESP_ERR_NO_MEM;
+static esp_err_t api_post_rssi_trace(api_req_t *r)
+{
+    int enabled = 0;
+
+    if (j_find_int(&r->jr, "enabled", &enabled)) {
+        if (rssi_recorder_enable(!! enabled) == ESP_OK)
+            request_send_ok(r->req);
+        else
+            request_send_error(r->req, "No partition '%s'", RSSI_RECORDER_PARTITION);
+    } else {
+        request_send_error(r->req, "Failed to parse json");
     }
+    return ESP_OK;
+}
 
-    if (!(tmp2_buf64 = malloc(64))) {
-        free(tokens);
-        free(tmp_buf64);
-        request_send_error(req, OUT_OF_MEMORY);
+static esp_err_t api_post_osd_text(api_req_t *r, bool display)
+{
+    static const int tmp_buf_sz = 64;
+    char *tmp_buf64 = arena_alloc(&gui_arena, tmp_buf_sz);
+    int x, y;
+
+    if (!tmp_buf64) {
+        request_send_error(r->req, OUT_OF_MEMORY);
         return ESP_ERR_NO_MEM;
     }
 
-    j_init(jr, tokens, jsmn_tokens_num);
+    if (j_find_str(&r->jr, "text", tmp_buf64, tmp_buf_sz)
+        && j_find_int(&r->jr, "x", &x)
+        && j_find_int(&r->jr, "y", &y)){
 
-    if (streq(uri_tok, "display_text") || streq(uri_tok, "set_text")) {
+        if (display)
+            osd_display_text(&r->ctx->osd, x, y, tmp_buf64);
+        else
+            osd_send_text(&r->ctx->osd, x, y, tmp_buf64);
 
-        if (j_find_str(jr, "text", tmp_buf64, sizeof(tmp_buf64))
-            && j_find_int(jr, "x", &x)
-            && j_find_int(jr, "y", &y)){
+        request_send_ok(r->req);
+    } else {
+        request_send_error(r->req, "Missing mandatory json field");
+    }
+    return ESP_OK;
+}
 
-            if (streq(uri_tok, "display_text"))
-                osd_display_text(osd, x, y, tmp_buf64);
-            else
-                osd_send_text(osd, x, y, tmp_buf64);
+static esp_err_t api_post_osd_display_text(api_req_t *r)
+{
+    return api_post_osd_text(r, true);
+}
 
-            request_send_ok(req);
-        } else {
-            request_send_error(req, "Missing mandatory json field");
-        }
+static esp_err_t api_post_osd_set_text(api_req_t *r)
+{
+    return api_post_osd_text(r, false);
+}
 
-    } else if (streq(uri_tok, "clear")){
-        osd_send_clear(osd);
-        request_send_ok(req);
-
-    } else if (streq(uri_tok, "display")){
-        osd_send_display(osd);
-        request_send_ok(req);
-
-    } else if (streq(uri_tok, "test_format")) {
-        if (j_find_str(jr, "format", tmp_buf64, sizeof(tmp_buf64))) {
-            if (osd_eval_format(osd, tmp_buf64, 23, 1337,666, tmp2_buf64, sizeof(tmp2_buf64))) {
-                jw_init(&jw, tmp_buf64, 64);
-                jw_object(&jw){
-                    jw_kv_str(&jw, "status", "ok");
-                    jw_kv_str(&jw, "msg", tmp2_buf64);
-                }
-                httpd_resp_set_status(req, "200 OK");
-                if (!jw.error)
-                    request_send_json(req, jw.buf, strlen(jw.buf));
-                else
-                    request_send_error(req, "Failed to build JSON");
-            } else {
-                request_send_error(req, "Invalid OSD message format");
+static esp_err_t api_post_osd_clear(api_req_t *r)
+{
+    osd_send_clear(&r->ctx->osd);
+    request_send_ok(r->req);
+    return ESP_OK;
+}
+
+static esp_err_t api_post_osd_display(api_req_t *r)
+{
+    osd_send_display(&r->ctx->osd);
+    request_send_ok(r->req);
+    return ESP_OK;
+}
+
+static esp_err_t api_post_osd_test_format(api_req_t *r)
+{
+    static const int tmp_buf_sz = 64;
+    char *tmp_buf64 = arena_alloc(&gui_arena, tmp_buf_sz);
+    char *tmp2_buf64 = arena_alloc(&gui_arena, tmp_buf_sz);
+    json_writer_t jw;
+
+    if (!tmp_buf64 || !tmp2_buf64) {
+        request_send_error(r->req, OUT_OF_MEMORY);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (j_find_str(&r->jr, "format", tmp_buf64, tmp_buf_sz)) {
+        if (osd_eval_format(&r->ctx->osd, tmp_buf64, 23, 1337,666, tmp2_buf64, tmp_buf_sz)) {
+            jw_init(&jw, tmp_buf64, tmp_buf_sz);
+            jw_object(&jw){
+                jw_kv_str(&jw, "status", "ok");
+                jw_kv_str(&jw, "msg", tmp2_buf64);
             }
+            httpd_resp_set_status(r->req, "200 OK");
+            if (!jw.error)
+                request_send_json(r->req, jw.buf, strlen(jw.buf));
+            else
+                request_send_error(r->req, "Failed to build JSON");
         } else {
-            request_send_error(req, "Missing mandatory json field");
+            request_send_error(r->req, "Invalid OSD message format");
         }
+    } else {
+        request_send_error(r->req, "Missing mandatory json field");
     }
-
-    free(tokens);
-    free(tmp_buf64);
-    free(tmp2_buf64);
-    return  ESP_OK;
+    return ESP_OK;
 }
 
-static esp_err_t api_v1_post_time_sync(httpd_req_t *req, ctx_t *ctx, json_t *jr)
+static esp_err_t api_post_time_sync(api_req_t *r)
 {
     json_t client;
     json_t server;
@@ -328,13 +839,13 @@ static esp_err_t api_v1_post_time_sync(httpd_req_t *req, ctx_t *ctx, json_t *jr)
     static const int buf_w_sz = 512;
     char *buf_w;
 
-    if (!(buf_w = malloc(buf_w_sz))) {
-        request_send_error(req, OUT_OF_MEMORY);
+    if (!(buf_w = arena_alloc(&gui_arena, buf_w_sz))) {
+        request_send_error(r->req, OUT_OF_MEMORY);
         return ESP_ERR_NO_MEM;
     }
 
-    j_find(jr, "server", &server);
-    j_find(jr, "client", &client);
+    j_find(&r->jr, "server", &server);
+    j_find(&r->jr, "client", &client);
 
     jw_init(&jw, buf_w, buf_w_sz);
     jw_object(&jw) {
@@ -359,221 +870,384 @@ static esp_err_t api_v1_post_time_sync(httpd_req_t *req, ctx_t *ctx, json_t *jr)
         }
     }
     if (jw.error) {
-        request_send_error(req, "Failed to write json");
+        request_send_error(r->req, "Failed to write json");
     } else {
-        httpd_resp_set_status(req, "200 OK");
-        request_send_json(req, jw.buf, jw.wptr - jw.buf);
+        httpd_resp_set_status(r->req, "200 OK");
+        request_send_json(r->req, jw.buf, jw.wptr - jw.buf);
     }
 
-    free(buf_w);
     return ESP_OK;
 }
 
-
-static esp_err_t api_v1_post_handler(httpd_req_t *req)
+static esp_err_t api_post_ctf_start(api_req_t *r)
 {
-    ctx_t *ctx = (ctx_t*) req->user_ctx;
-    lap_counter_t *lc = &ctx->lc;
-    static const int tmp_str_sz = 32;
-    char *key;
-    char *value;
-    char *json_buf;
-    static const int jsmn_tokens_sz = 512;
-    jsmntok_t *jsmn_tokens;
-    json_t jr;
-    esp_err_t err = ESP_OK;
-    const char *tok;
+    millis_t duration_ms = 0;
 
-    int json_buffer_sz = (req->content_len > 1024) ? req->content_len : 1024;
-    json_buffer_sz = (((json_buffer_sz + 31) / 32) * 32);
-    int sz = tmp_str_sz * 2 + jsmn_tokens_sz * sizeof(jsmntok_t) + req->content_len;
-    if (!(json_buf = malloc(sz))){
-        request_send_error(req, "413 Payload Too Large (%d)", sz);
-        return ESP_OK;
+    if (j_find_uint64(&r->jr, "duration_ms", &duration_ms)) {
+        sft_ctf_start(r->ctx, duration_ms);
+        request_send_ok(r->req);
+    } else {
+        request_send_error(r->req, "Failed to parse json");
     }
+    return ESP_OK;
+}
 
-    key = &json_buf[json_buffer_sz];
-    value = &json_buf[json_buffer_sz + tmp_str_sz];
-    jsmn_tokens = (jsmntok_t*) &json_buf[json_buffer_sz + tmp_str_sz * 2];
+static esp_err_t api_get_routes_status(api_req_t *r);
+
+static const api_route_t api_routes[] = {
+    { HTTP_GET,  "ctf/stop",            api_get_ctf_stop,           64 },
+    { HTTP_GET,  "heap/status",         api_get_heap_status,        256 },
+    { HTTP_GET,  "http/status",         api_get_http_status,        512 },
+    { HTTP_GET,  "routes/status",       api_get_routes_status,      512 },
+    { HTTP_GET,  "rssi/status",         api_get_rssi_status,        512 },
+    { HTTP_GET,  "rssi/trace",          api_get_rssi_trace,         4096 },
+    { HTTP_GET,  "rssi/trace/status",   api_get_rssi_trace_status,  256 },
+    { HTTP_GET,  "rssi/update",         api_get_rssi_update,        64 },
+    { HTTP_GET,  "settings",            api_get_settings,           512 },
+    { HTTP_GET,  "ws/status",           api_get_ws_status,          2048 },
+    { HTTP_POST, "clear_laps",          api_post_clear_laps,        256 },
+    { HTTP_POST, "ctf/start",           api_post_ctf_start,         256 },
+    { HTTP_POST, "osd/clear",           api_post_osd_clear,         256 },
+    { HTTP_POST, "osd/display",         api_post_osd_display,       256 },
+    { HTTP_POST, "osd/display_text",    api_post_osd_display_text,  256 },
+    { HTTP_POST, "osd/set_text",        api_post_osd_set_text,      256 },
+    { HTTP_POST, "osd/test_format",     api_post_osd_test_format,   256 },
+    { HTTP_POST, "player/connect",      api_post_player_connect,    256 },
+    { HTTP_POST, "player/lap",          api_post_player_lap,        2048 },
+    { HTTP_POST, "rssi/trace",          api_post_rssi_trace,        256 },
+    { HTTP_POST, "rssi/update",         api_post_rssi_update,       256 },
+    { HTTP_POST, "settings",            api_post_settings,          512, true },
+    { HTTP_POST, "start_calibration",   api_post_start_calibration, 256 },
+    { HTTP_POST, "time-sync",           api_post_time_sync,         512 },
+};
+
+#define API_ROUTES  (sizeof(api_routes) / sizeof(api_routes[0]))
+
+static api_route_stats_t api_stats[API_ROUTES];
+
+/* path of len chars, not terminated in front of a query */
+static int api_route_cmp(httpd_method_t method, const char *path, size_t len,
+                         const api_route_t *route)
+{
+    int cmp;
 
+    if (method != route->method)
+        return method < route->method ? -1 : 1;
+    if ((cmp = strncmp(path, route->path, len)) == 0 && route->path[len])
+        cmp = -1;
+    return cmp;
+}
 
-    int len = httpd_req_recv(req, json_buf, json_buffer_sz);
-    if (len > json_buffer_sz) {
-        request_send_error(req, "413 Payload Too Large (%d)", len);
-        return ESP_OK;
-    } else if (len < 0) {
-        request_send_error(req, "Failed to read payload");
-        return ESP_OK;
+static esp_err_t api_routes_check(void)
+{
+    for (int i = 1; i < API_ROUTES; i++) {
+        const api_route_t *a = &api_routes[i - 1], *b = &api_routes[i];
+
+        if (a->method > b->method || (a->method == b->method && strcmp(a->path, b->path) >= 0)) {
+            ESP_LOGE(TAG, "api_routes[] not sorted at %s", api_routes[i].path);
+            return ESP_ERR_INVALID_STATE;
+        }
     }
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "%s:%d URI: %s data(%d): %.*s", __func__, __LINE__, req->uri, len, len, json_buf);
+static const api_route_t *api_route_find(httpd_method_t method, const char *uri)
+{
+    int lo = 0, hi = API_ROUTES - 1, mid, cmp;
+    size_t len;
 
-    j_init(&jr, jsmn_tokens, jsmn_tokens_sz);
-    if (len > 0) {
-        if(!j_parse(&jr, json_buf, len)) {
-            ESP_LOGE(TAG, "Failed to parse json (len:%d)", len);
-            request_send_error(req, "Failed to parse json");
-            err = ESP_ERR_INVALID_ARG;
-            goto out;
-        }
-    } else {
-        j_parse(&jr, "{}", 2);
+    if (strncmp(uri, API_PREFIX, strlen(API_PREFIX)) != 0)
+        return NULL;
+    uri += strlen(API_PREFIX);
+    len = strcspn(uri, "?");
+
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if ((cmp = api_route_cmp(method, uri, len, &api_routes[mid])) == 0)
+            return &api_routes[mid];
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
     }
+    return NULL;
+}
 
-    if (strcmp(req->uri, "/api/v1/settings") == 0) {
-        json_t e = {0};
-        while(j_next(&jr, &e)) {
-            if (j_get_kv(&e, key, tmp_str_sz, value, tmp_str_sz)) {
-                if (cfg_set_param(&ctx->cfg, key, value) != ESP_OK) {
-                    request_send_error(req,"Invalid key/value %s=%s", key, value);
-                    goto out;
-                }
-            }
-        }
-        cfg_verify(&ctx->cfg);
-        if (cfg_save(&ctx->cfg) == ESP_OK) {
-            if (sft_update_settings(ctx))
-                request_send_ok(req);
-            else {
-                request_send_error(req, "Failed to apply all settings - reboot");
-            }
-        } else  {
-            request_send_error(req, "Failed to write config to eeprom");
-        }
+static void api_route_account(const api_route_t *route, int64_t us, bool error)
+{
+    api_route_stats_t *st = &api_stats[route - api_routes];
+    int b;
 
-    } else if (strcmp(req->uri, "/api/v1/start_calibration") == 0) {
-        sft_start_calibration(ctx);
-        request_send_ok(req);
+    st->requests++;
+    st->errors += error;
+    st->total_us += us;
+    if (us > st->max_us)
+        st->max_us = us;
 
-    } else if (strcmp(req->uri, "/api/v1/clear_laps") == 0) {
-        struct player_s *player;
-        millis_t offset;
+    for (b = 0; b < API_HIST_BUCKETS - 1 && us >= (1000 << (2 * b)); b++);
+    st->hist[b]++;
+}
 
-        if (!j_find_uint64(&jr, "offset", &offset))
-            offset = 30000;
+static esp_err_t api_get_routes_status(api_req_t *r)
+{
+    json_writer_t *jw = api_stream_start(r);
 
-        for (int i=0; i < MAX_PLAYER; i++) {
-            player = &lc->players[i];
-            memset(player->laps, 0, sizeof(player->laps));
-            player->next_idx = 0;
+    jw_object(jw) {
+        jw_kv(jw, "hist_ms") {
+            jw_array(jw) {
+                for (int b = 0; b < API_HIST_BUCKETS - 1; b++)
+                    jw_int(jw, 1 << (2 * b));
+            }
         }
+        jw_kv(jw, "routes") {
+            jw_array(jw) {
+                for (int i = 0; i < API_ROUTES; i++) {
+                    api_route_stats_t *st = &api_stats[i];
 
-        sft_event_start_race_t ev = {.offset = offset };
-        ESP_ERROR_CHECK(
-            esp_event_post(SFT_EVENT, SFT_EVENT_START_RACE,
-                           &ev, sizeof(ev), pdMS_TO_TICKS(500)));
-
-        request_send_ok(req);
-
-    } else if (strcmp(req->uri, "/api/v1/player/connect") == 0) {
-        if (j_find_str(&jr, "player", value, tmp_str_sz)) {
-            ip4_addr_t ip4 = {0};
-            if (get_remote_ip4(req, &ip4) == ESP_OK) {
-                if (sft_on_player_connect(ctx, ip4, value) == ESP_OK)
-                    request_send_ok(req);
-                else
-                    request_send_error(req, "Failed to create player: %s", value);
-            } else
-            request_send_error(req, "No remote IP");
-        } else
-        request_send_error(req, "Missing key 'player'");
-
-    } else if (strcmp(req->uri, "/api/v1/player/lap") == 0) {
-        json_t lap;
-        int id, rssi;
-        millis_t duration;
-        ip4_addr_t ip4 = {0};
+                    jw_object(jw) {
+                        jw_kv_str(jw, "method", api_routes[i].method == HTTP_GET ? "GET" : "POST");
+                        jw_kv_str(jw, "path", api_routes[i].path);
+                        jw_kv_int(jw, "requests", st->requests);
+                        jw_kv_int(jw, "errors", st->errors);
+                        jw_kv_int(jw, "avg_us", st->requests ? st->total_us / st->requests : 0);
+                        jw_kv_int(jw, "max_us", st->max_us);
+                        jw_kv(jw, "hist") {
+                            jw_array(jw) {
+                                for (int b = 0; b < API_HIST_BUCKETS; b++)
+                                    jw_int(jw, st->hist[b]);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return api_stream_end(r);
+}
 
-        if (get_remote_ip4(req, &ip4) == ESP_OK &&
-            j_find_str(&jr, "player", value, tmp_str_sz) &&
-            j_find(&jr, "lap", &lap) &&
-            j_find_int(&lap, "id", &id) &&
-            j_find_int(&lap, "rssi", &rssi) &&
-            j_find_uint64(&lap, "duration", &duration)
-        ) {
-            if (sft_on_player_lap(ctx, ip4, id, rssi, duration) == ESP_OK)
-                request_send_ok(req);
-            else
-                request_send_error(req, "Failed to add players lap");
+/* Read and parse the body of a POST */
+static esp_err_t api_post_parse(api_req_t *r, size_t max_len)
+{
+    httpd_req_t *req = r->req;
+    jsmntok_t *tokens;
+    uint16_t *slot;
+    char *body;
+    int len = 0, n;
+    /* each token but the outer one takes a char and a separator */
+    int tokens_num = MIN(API_JSON_TOKENS, req->content_len / 2 + 2);
+
+    if (req->content_len > max_len) {
+        request_send_error(req, "413 Payload Too Large (%d)", req->content_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
 
-        } else
-        request_send_error(req, "Failed to parse json");
+    r->key = arena_alloc(&gui_arena, API_TMP_STR_SZ);
+    r->value = arena_alloc(&gui_arena, API_TMP_STR_SZ);
+    tokens = arena_alloc(&gui_arena, tokens_num * sizeof(jsmntok_t));
+    body = arena_alloc(&gui_arena, req->content_len + 1);
+    if (!r->key || !r->value || !tokens || !body) {
+        request_send_error(req, OUT_OF_MEMORY);
+        return ESP_ERR_NO_MEM;
+    }
 
-    } else if (strcmp(req->uri, "/api/v1/rssi/update") == 0) {
-        int enabled = 0;
-        if (j_find_int(&jr, "enabled", &enabled)) {
-            ctx->send_rssi_updates = !! enabled;
-            request_send_ok(req);
-        } else {
-            request_send_error(req, "Failed to parse json");
+    while (len < req->content_len) {
+        if ((n = httpd_req_recv(req, body + len, req->content_len - len)) <= 0) {
+            if (n == HTTPD_SOCK_ERR_TIMEOUT)
+                continue;
+            request_send_error(req, "Failed to read payload");
+            return ESP_FAIL;
         }
+        len += n;
+    }
 
-    } else if ((tok = strstartwith(req->uri, "/api/v1/osd/"))) {
-        err = api_v1_post_osd(req, ctx, tok, &jr);
-
-    } else if (strcmp(req->uri, "/api/v1/time-sync") == 0) {
-        err = api_v1_post_time_sync(req, ctx, &jr);
+    ESP_LOGI(TAG, "%s:%d URI: %s data(%d): %.*s", __func__, __LINE__, req->uri, len, len, body);
 
-    } else if (strcmp(req->uri, "/api/v1/ctf/start") == 0) {
-        millis_t duration_ms = 0;
-        if (j_find_uint64(&jr, "duration_ms", &duration_ms)) {
-            sft_ctf_start(ctx, duration_ms);
-            request_send_ok(req);
-        } else {
+    j_init(&r->jr, tokens, tokens_num);
+    if (len > 0) {
+        if(!j_parse(&r->jr, body, len)) {
+            ESP_LOGE(TAG, "Failed to parse json (len:%d)", len);
             request_send_error(req, "Failed to parse json");
+            return ESP_ERR_INVALID_ARG;
         }
-
     } else {
+        j_parse(&r->jr, "{}", 2);
+    }
+
+    /* the handlers look up several keys, without an index each one is a scan */
+    n = j_index_slots(&r->jr);
+    if ((slot = arena_alloc(&gui_arena, n * sizeof(*slot))))
+        j_index(&r->jr, &r->jr_idx, slot, n);
+    return ESP_OK;
+}
+
+static esp_err_t api_v1_handler(httpd_req_t *req)
+{
+    const api_route_t *route = api_route_find(req->method, req->uri);
+    api_req_t r = { .req = req, .ctx = (ctx_t*) req->user_ctx };
+    uint32_t errors = request_errors;
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = ESP_OK;
+
+    ESP_LOGI(TAG, "%s URI: %s", __func__, req->uri);
+    if (!route) {
         request_send_error(req, "404 Not found - %s", req->uri);
+        return ESP_OK;
     }
 
+    if (req->method == HTTP_GET) {
+        r.buf_sz = route->buf_sz;
+        if (!(r.buf = arena_alloc(&gui_arena, r.buf_sz))) {
+            request_send_error(req, OUT_OF_MEMORY);
+            err = ESP_ERR_NO_MEM;
+            goto out;
+        }
+        jw_init(&r.jw, r.buf, r.buf_sz);
+    } else if (route->raw_body) {
+        r.buf_sz = route->buf_sz;
+        r.buf = arena_alloc(&gui_arena, r.buf_sz);
+        r.key = arena_alloc(&gui_arena, API_TMP_STR_SZ);
+        r.value = arena_alloc(&gui_arena, API_TMP_STR_SZ);
+        if (!r.buf || !r.key || !r.value) {
+            request_send_error(req, OUT_OF_MEMORY);
+            err = ESP_ERR_NO_MEM;
+            goto out;
+        }
+    } else if ((err = api_post_parse(&r, route->buf_sz)) != ESP_OK) {
+        goto out;
+    }
+
+    err = route->handler(&r);
+
 out:
-    free(json_buf);
-    return err;
+    api_route_account(route, esp_timer_get_time() - start,
+                      err != ESP_OK || request_errors != errors);
+    arena_reset(&gui_arena);
+    return err == ESP_FAIL ? ESP_FAIL : ESP_OK;
+}
+
+/*
+ * Binary RSSI update, sent instead of the JSON one to clients that asked for
+ * it with {"type":"hello","format":"binary"}. Little endian:
+ *
+ *   u8 type (1), u8 version (1), u16 cnt, u16 freq, u16 rate,
+ *   i16 floor, i16 peak, i16 enter, i16 leave, u32 t0 low, u32 t0 high,
+ *   cnt times { u16 ms since the previous sample, i16 smoothed,
+ *               u16 raw (bit 15: drone in gate) }
+ *
+ * Decoded by decodeRssiFrame() in Signal.ts.
+ */
+#define RSSI_BIN_TYPE       1
+#define RSSI_BIN_VERSION    1
+#define RSSI_BIN_HDR_SIZE   24
+#define RSSI_BIN_SIZE       (RSSI_BIN_HDR_SIZE + SFT_RSSI_UPDATE_MAX * 6)
+
+/* Fits all samples, {"t":4294967295,"s":-32768,"r":-32768,"i":1}, is 45 bytes */
+#define RSSI_JSON_SIZE      (160 + SFT_RSSI_UPDATE_MAX * 48)
+
+static uint8_t *put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put_le32(uint8_t *p, uint32_t v)
+{
+    return put_le16(put_le16(p, v), v >> 16);
+}
+
+static size_t rssi_update_encode_bin(const sft_event_rssi_update_t *ev, uint8_t *buf)
+{
+    millis_t prev = ev->cnt > 0 ? ev->data[0].abs_time_ms : 0;
+    uint8_t *p = buf;
+
+    *p++ = RSSI_BIN_TYPE;
+    *p++ = RSSI_BIN_VERSION;
+    p = put_le16(p, ev->cnt);
+    p = put_le16(p, ev->freq);
+    p = put_le16(p, ev->sample_rate_hz);
+    p = put_le16(p, ev->floor);
+    p = put_le16(p, ev->peak);
+    p = put_le16(p, ev->enter);
+    p = put_le16(p, ev->leave);
+    p = put_le32(p, prev);
+    p = put_le32(p, prev >> 32);
+
+    for (int i = 0; i < ev->cnt; i++) {
+        millis_t dt = ev->data[i].abs_time_ms - prev;
+        int raw = MIN(MAX(ev->data[i].rssi_raw, 0), 0x7fff);
+
+        p = put_le16(p, MIN(dt, 0xffff));
+        p = put_le16(p, ev->data[i].rssi);
+        p = put_le16(p, raw | (ev->data[i].drone_in_gate ? 0x8000 : 0));
+        prev = ev->data[i].abs_time_ms;
+    }
+    return p - buf;
 }
 
 void sft_event_rssi_update(void* arg, esp_event_base_t base, int32_t id, void* event_data)
 {
-    sft_event_rssi_update_t *ev = (sft_event_rssi_update_t*) event_data;
+    sft_event_rssi_update_t *ev = ((sft_event_rssi_update_ref_t*) event_data)->ev;
     ctx_t *ctx = (ctx_t*) arg;
+    static const size_t max_clients = CONFIG_LWIP_MAX_LISTENING_TCP;
+    size_t fds = max_clients;
+    int client_fds[max_clients];
+    bool binary[max_clients];
+    int want_json = 0, want_bin = 0;
 
-    /* do not use static send buffer (e.g. json_buffer) here, as it happens that events get triggered
-     * on other syscalls like send(), thus the static buffer might be already dirty!
-     */
-    char *buf;
-    json_writer_t *jw;
+    /* the messages are queued per client, gui_bcast.c sends and frees them */
+    gui_msg_t *json = NULL, *bin = NULL;
+    json_writer_t jw;
 
     if (!ctx->send_rssi_updates) {
-        return;
+        goto out;
     }
 
-    if (!(buf = malloc(512))) {
-        ESP_LOGE(TAG, "RSSI update - out of memory!");
-        return;
-    }
+    if (httpd_get_client_list(ctx->gui, &fds, client_fds) != ESP_OK)
+        goto out;
 
-    jw = (json_writer_t*) buf;
-    jw_init(jw, buf + sizeof(json_writer_t), 512 - sizeof(json_writer_t));
+    for (int i = 0; i < fds; i++) {
+        gui_rssi_format_t format = GUI_RSSI_NONE;
 
-    jw_object(jw){
-        jw_kv_str(jw, "type", "rssi");
-        jw_kv_int(jw, "freq", ev->freq);
-        jw_kv(jw, "data"){
-            jw_array(jw) {
-                for (int i = 0; i < ev->cnt; i++) {
-                    jw_object(jw) {
-                        jw_kv_int(jw, "t", ev->data[i].abs_time_ms);
-                        jw_kv_int(jw, "s", ev->data[i].rssi);
-                        jw_kv_int(jw, "r", ev->data[i].rssi_raw);
-                        jw_kv_int(jw, "i", ev->data[i].drone_in_gate);
-                    }
-                }
-            }
+        /* not the session, httpd may free it meanwhile */
+        if (httpd_ws_get_fd_info(ctx->gui, client_fds[i]) == HTTPD_WS_CLIENT_WEBSOCKET)
+            format = gui_bcast_rssi_format(client_fds[i], ev->freq, ev->seq);
+
+        binary[i] = format == GUI_RSSI_BINARY;
+        if (format == GUI_RSSI_NONE) {
+            client_fds[i] = -1;
+            continue;
         }
+        if (binary[i])
+            want_bin++;
+        else
+            want_json++;
+    }
+
+    if (want_json && (json = gui_msg_alloc(GUI_TOPIC_RSSI, HTTPD_WS_TYPE_TEXT, RSSI_JSON_SIZE))) {
+        jw_init(&jw, (char*) json->data, json->size);
+        if (!rssi_update_encode_json(ev, &jw))
+            ESP_LOGW(TAG, "RSSI update - truncated, %d samples", ev->cnt);
+        json->len = strlen(jw.buf);
+    }
+
+    if (want_bin && (bin = gui_msg_alloc(GUI_TOPIC_RSSI, HTTPD_WS_TYPE_BINARY, RSSI_BIN_SIZE)))
+        bin->len = rssi_update_encode_bin(ev, bin->data);
+
+    if ((want_json && !json) || (want_bin && !bin))
+        ESP_LOGE(TAG, "RSSI update - out of memory!");
+
+    for (int i = 0; i < fds; i++) {
+        gui_msg_t *msg = binary[i] ? bin : json;
+
+        if (client_fds[i] >= 0 && msg)
+            gui_bcast_queue(msg, client_fds[i]);
     }
 
-    gui_send_all(ctx, jw->buf);
-    free(buf);
+    gui_msg_release(json);
+    gui_msg_release(bin);
+out:
+    rssi_update_release(ev);
 }
 
 /* Function for starting the webserver */
@@ -593,7 +1267,7 @@ esp_err_t gui_start(ctx_t *ctx)
     const httpd_uri_t api_get = {
         .uri        = "/api/v1/*",
         .method     = HTTP_GET,
-        .handler    = api_v1_get_handler,
+        .handler    = api_v1_handler,
         .user_ctx   = ctx,
         .is_websocket = true
     };
@@ -601,11 +1275,16 @@ esp_err_t gui_start(ctx_t *ctx)
     const httpd_uri_t api_post = {
         .uri        = "/api/v1/*",
         .method     = HTTP_POST,
-        .handler    = api_v1_post_handler,
+        .handler    = api_v1_handler,
         .user_ctx   = ctx,
         .is_websocket = true
     };
 
+    if ((err = api_routes_check()) != ESP_OK)
+        return err;
+
+    arena_init(&gui_arena, gui_arena_buf, sizeof(gui_arena_buf));
+
     /* Generate default configuration */
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
@@ -617,6 +1296,11 @@ esp_err_t gui_start(ctx_t *ctx)
     config.max_uri_handlers++; // /api/v1 GET
     config.max_uri_handlers++; // /api/v1 POST
     config.max_open_sockets = 7;
+    /*
+     * Browsers keep the connections of the static files open, the least
+     * recently used one makes room for a new one (a websocket reconnects)
+     */
+    config.lru_purge_enable = true;
 
 //    config.enable_so_linger = true;
 
@@ -624,6 +1308,12 @@ esp_err_t gui_start(ctx_t *ctx)
     if ((err = httpd_start(&ctx->gui, &config)) != ESP_OK)
         return err;
 
+    if ((err = gui_bcast_init(ctx->gui)) != ESP_OK)
+        return err;
+
+    if ((err = gui_http_init()) != ESP_OK)
+        return err;
+
     for(sf=STATIC_FILES; sf->name; sf++) {
         httpd_uri_t uri_handler = {
             .uri      = sf->name,
@@ -648,6 +1338,7 @@ esp_err_t gui_start(ctx_t *ctx)
     httpd_register_uri_handler(ctx->gui, &uri_handler);
 
     esp_event_handler_register(SFT_EVENT, SFT_EVENT_RSSI_UPDATE, sft_event_rssi_update, ctx);
+    rssi_update_subscribe();
     return ESP_OK;
 }
 
@@ -662,123 +1353,35 @@ esp_err_t gui_stop(ctx_t *ctx)
 }
 
 
-esp_err_t gui_send_all(ctx_t *ctx, const char *msg)
+esp_err_t gui_send_all(ctx_t *ctx, gui_topic_t topic, const char *msg)
 {
     static const size_t max_clients = CONFIG_LWIP_MAX_LISTENING_TCP;
     size_t fds = max_clients;
     int client_fds[max_clients];
+    size_t len = strlen(msg);
+    gui_msg_t *m;
 
     memset(client_fds, 0, sizeof(int) * max_clients);
 
-    httpd_ws_frame_t ws_pkt;
-    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
-    ws_pkt.payload = (uint8_t*) msg;
-    ws_pkt.len = strlen(msg);
-
     esp_err_t ret = httpd_get_client_list(ctx->gui, &fds, client_fds);
     if (ret != ESP_OK) {
         ESP_LOGI(TAG, "invalid size!");
         return ESP_ERR_INVALID_SIZE;
     }
 
+    /* one copy, shared by the queues of all clients */
+    if (!(m = gui_msg_alloc(topic, HTTPD_WS_TYPE_TEXT, len)))
+        return ESP_ERR_NO_MEM;
+    memcpy(m->data, msg, len);
+    m->len = len;
+
+    /* the broadcaster skips the clients not subscribed to topic */
     for (int i = 0; i < fds; i++) {
-        /*void *ptr = httpd_sess_get_ctx(ctx->gui, client_fds[i]);*/
         httpd_ws_client_info_t client_info = httpd_ws_get_fd_info(ctx->gui, client_fds[i]);
         if (client_info == HTTPD_WS_CLIENT_WEBSOCKET) {
-            httpd_ws_send_frame_async(ctx->gui, client_fds[i], &ws_pkt);
+            gui_bcast_queue(m, client_fds[i]);
         }
     }
+    gui_msg_release(m);
     return ESP_OK;
 }
-
-esp_err_t gui_send_http2(ctx_t *ctx, const char *url, const char *json)
-{
-    esp_err_t err;
-    char buf[8];
-
-    snprintf(buf, sizeof(buf), "%"PRId16, strlen(json));
-    ESP_LOGI(TAG, "send_http(%s, %s)", url, buf);
-
-
-    esp_http_client_config_t cfg = {
-        .url = url,
-        .method = HTTP_METHOD_POST,
-        //.buffer_size_tx = 1024 * 4,
-        //.buffer_size = 1024 * 4,
-
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&cfg);
-
-    /*esp_http_client_set_url(client, url);*/
-    /*esp_http_client_set_method(client, HTTP_METHOD_POST);*/
-    esp_http_client_set_header(client, "Accept", "*/*");
-    esp_http_client_set_header(client, "Content-Type", "application/json; charset=utf-8");
-    /*esp_http_client_set_header(client, "Connection", "Keep-Alive");*/
-    /*esp_http_client_set_header(client, "Keep-Alive", "timeout=5, max=200");*/
-    esp_http_client_set_header(client, "Content-Length", buf);
-    esp_http_client_set_post_field(client, json, strlen(json));
-    err = esp_http_client_perform(client);
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %"PRId64,
-                esp_http_client_get_status_code(client),
-                esp_http_client_get_content_length(client));
-        return ESP_OK;
-    } else {
-        ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
-    }
-    esp_http_client_cleanup(client);
-    return err;
-}
-
-
-esp_err_t gui_send_http(ctx_t *ctx, const char *url, const char *post_data) {
-
-    // Declare local_response_buffer with size (MAX_HTTP_OUTPUT_BUFFER + 1) to prevent out of bound access when
-    // it is used by functions like strlen(). The buffer should only be used upto size MAX_HTTP_OUTPUT_BUFFER
-#define MAX_HTTP_OUTPUT_BUFFER 512
-    static char output_buffer[MAX_HTTP_OUTPUT_BUFFER + 1] = {0};   // Buffer to store response of http request
-    int content_length = 0;
-    esp_err_t err;
-
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_POST,
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-
-    ESP_LOGI(TAG, "URL: %s -(%d) %s", url, strlen(post_data), post_data);
-    // GET Request
-    esp_http_client_set_url(client, url);
-    esp_http_client_set_method(client, HTTP_METHOD_POST);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    err = esp_http_client_open(client, strlen(post_data));
-
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-    } else {
-        int wlen = esp_http_client_write(client, post_data, strlen(post_data));
-        if (wlen < 0) {
-            ESP_LOGE(TAG, "HTTP client failed Write failed %d", wlen);
-        }
-
-        content_length = esp_http_client_fetch_headers(client);
-        if (content_length < 0) {
-            ESP_LOGE(TAG, "HTTP client fetch headers failed");
-        } else {
-            int data_read = esp_http_client_read_response(client, output_buffer, MAX_HTTP_OUTPUT_BUFFER);
-            if (data_read >= 0) {
-                uint64_t len = esp_http_client_get_content_length(client);
-                ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %"PRId64,
-                esp_http_client_get_status_code(client), len);
-                ESP_LOG_BUFFER_HEX(TAG, output_buffer, strlen(output_buffer));
-                int leni = len;
-                ESP_LOGI(TAG, "%.*s", leni, output_buffer);
-            } else {
-                ESP_LOGE(TAG, "Failed to read response");
-            }
-        }
-    }
-    esp_http_client_cleanup(client);
-    return err;
-}
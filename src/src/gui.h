@@ -6,7 +6,22 @@
 #include <esp_err.h>
 #include <esp_http_server.h>
 
+/*
+ * Topics of the /ws/rssi messages. A client gets all of them until it
+ * subscribes with {"type":"subscribe","topics":["players","rssi"]}, for RSSI
+ * optionally limited by "freq":[5658,5695] and "decimate":n (every n-th
+ * update of a frequency).
+ */
+typedef enum {
+    GUI_TOPIC_PLAYERS   = 1 << 0,
+    GUI_TOPIC_CTF       = 1 << 1,
+    GUI_TOPIC_RSSI      = 1 << 2,
+} gui_topic_t;
+
+#define GUI_TOPIC_ALL   (GUI_TOPIC_PLAYERS | GUI_TOPIC_CTF | GUI_TOPIC_RSSI)
+
 esp_err_t gui_start(ctx_t *ctx);
-esp_err_t gui_send_all(ctx_t *ctx, const char *msg);
-esp_err_t gui_send_http(ctx_t *ctx, const char *url, const char *json);
+
+/* Send msg to the websocket clients subscribed to topic */
+esp_err_t gui_send_all(ctx_t *ctx, gui_topic_t topic, const char *msg);
 esp_err_t gui_stop(ctx_t *ctx);
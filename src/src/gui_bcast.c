@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "gui_bcast.h"
+
+static const char * TAG = "gui-bcast";
+
+#define GUI_BCAST_STACK     4096
+#define GUI_BCAST_RETRY_MS  20      /* poll of clients that could not take data */
+
+typedef struct {
+    int fd;                 /* -1: free */
+    gui_msg_t *queue[GUI_BCAST_DEPTH];     /* oldest first */
+    int cnt;
+    gui_bcast_sub_t sub;
+    gui_bcast_client_stats_t st;
+} gui_bcast_client_t;
+
+static struct {
+    httpd_handle_t hd;
+    SemaphoreHandle_t lock;
+    TaskHandle_t task;
+    gui_bcast_client_t clients[GUI_BCAST_CLIENTS];
+    uint32_t no_slot;       /* messages for clients beyond GUI_BCAST_CLIENTS */
+} bc;
+
+gui_msg_t *gui_msg_alloc(gui_topic_t topic, httpd_ws_type_t type, size_t size)
+{
+    gui_msg_t *msg = malloc(sizeof(gui_msg_t) + size);
+
+    if (!msg)
+        return NULL;
+
+    atomic_init(&msg->refs, 1);
+    msg->topic = topic;
+    msg->type = type;
+    msg->created_us = esp_timer_get_time();
+    msg->len = 0;
+    msg->size = size;
+    return msg;
+}
+
+void gui_msg_release(gui_msg_t *msg)
+{
+    if (msg && atomic_fetch_sub(&msg->refs, 1) == 1)
+        free(msg);
+}
+
+/* Remove the i-th queued message, the caller got its reference */
+static gui_msg_t *gui_bcast_remove(gui_bcast_client_t *c, int i)
+{
+    gui_msg_t *msg = c->queue[i];
+
+    for (; i < c->cnt - 1; i++)
+        c->queue[i] = c->queue[i + 1];
+    c->cnt--;
+    return msg;
+}
+
+static void gui_bcast_flush(gui_bcast_client_t *c)
+{
+    while (c->cnt > 0)
+        gui_msg_release(gui_bcast_remove(c, 0));
+}
+
+static gui_bcast_client_t *gui_bcast_client(int fd, bool create)
+{
+    gui_bcast_client_t *free_slot = NULL;
+
+    for (int i = 0; i < GUI_BCAST_CLIENTS; i++) {
+        if (bc.clients[i].fd == fd)
+            return &bc.clients[i];
+        if (bc.clients[i].fd < 0 && !free_slot)
+            free_slot = &bc.clients[i];
+    }
+
+    if (!create || !free_slot)
+        return NULL;
+
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->fd = fd;
+    free_slot->sub = (gui_bcast_sub_t) GUI_BCAST_SUB_DEFAULT();
+    free_slot->st.fd = fd;
+    return free_slot;
+}
+
+esp_err_t gui_bcast_subscribe(int fd, const gui_bcast_sub_t *sub)
+{
+    gui_bcast_client_t *c;
+
+    if (!bc.lock)
+        return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(bc.lock, portMAX_DELAY);
+    if ((c = gui_bcast_client(fd, true)))
+        c->sub = *sub;
+    xSemaphoreGive(bc.lock);
+    return c ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+gui_rssi_format_t gui_bcast_rssi_format(int fd, uint16_t freq, uint32_t seq)
+{
+    gui_bcast_sub_t sub = GUI_BCAST_SUB_DEFAULT();
+    gui_bcast_client_t *c;
+    int i;
+
+    if (bc.lock) {
+        xSemaphoreTake(bc.lock, portMAX_DELAY);
+        if ((c = gui_bcast_client(fd, false)))
+            sub = c->sub;
+        xSemaphoreGive(bc.lock);
+    }
+
+    if (!(sub.topics & GUI_TOPIC_RSSI) || seq % sub.rssi_decimate)
+        return GUI_RSSI_NONE;
+
+    for (i = 0; i < sub.rssi_freq_cnt && sub.rssi_freq[i] != freq; i++);
+    if (sub.rssi_freq_cnt && i == sub.rssi_freq_cnt)
+        return GUI_RSSI_NONE;
+
+    return sub.rssi_binary ? GUI_RSSI_BINARY : GUI_RSSI_JSON;
+}
+
+void gui_bcast_queue(gui_msg_t *msg, int fd)
+{
+    gui_bcast_client_t *c;
+    int i;
+
+    if (!bc.lock)
+        return;
+
+    xSemaphoreTake(bc.lock, portMAX_DELAY);
+
+    if (!(c = gui_bcast_client(fd, true))) {
+        bc.no_slot++;
+        goto out;
+    }
+
+    if (!(c->sub.topics & msg->topic))
+        goto out;
+
+    if (msg->topic != GUI_TOPIC_RSSI) {
+        /* the newer state makes the queued one stale */
+        for (i = 0; i < c->cnt; i++) {
+            if (c->queue[i]->topic == msg->topic) {
+                gui_msg_release(gui_bcast_remove(c, i));
+                c->st.coalesced++;
+                break;
+            }
+        }
+    }
+
+    if (c->cnt == GUI_BCAST_DEPTH) {
+        for (i = 0; i < c->cnt && c->queue[i]->topic != GUI_TOPIC_RSSI; i++);
+
+        c->st.dropped++;
+        if (i == c->cnt) {
+            /* only states queued, which are one per topic, thus msg is RSSI */
+            goto out;
+        }
+        gui_msg_release(gui_bcast_remove(c, i));
+    }
+
+    atomic_fetch_add(&msg->refs, 1);
+    c->queue[c->cnt++] = msg;
+    if (c->cnt > c->st.queued_max)
+        c->st.queued_max = c->cnt;
+
+out:
+    xSemaphoreGive(bc.lock);
+    xTaskNotifyGive(bc.task);
+}
+
+void gui_bcast_close(int fd)
+{
+    gui_bcast_client_t *c;
+
+    if (!bc.lock)
+        return;
+
+    xSemaphoreTake(bc.lock, portMAX_DELAY);
+    if ((c = gui_bcast_client(fd, false))) {
+        gui_bcast_flush(c);
+        c->fd = -1;
+    }
+    xSemaphoreGive(bc.lock);
+}
+
+static bool gui_bcast_writable(int fd)
+{
+    struct timeval tv = { 0 };
+    fd_set wfds;
+
+    FD_ZERO(&wfds);
+    FD_SET(fd, &wfds);
+    return select(fd + 1, NULL, &wfds, NULL, &tv) > 0;
+}
+
+/*
+ * Send one message to every client that can take it. Returns if any got
+ * sent, *pending if messages are left.
+ */
+static bool gui_bcast_round(bool *pending)
+{
+    httpd_ws_frame_t frame;
+    gui_msg_t *msg;
+    bool progress = false, sent;
+    uint32_t lag_ms;
+    int fd;
+
+    *pending = false;
+
+    for (int i = 0; i < GUI_BCAST_CLIENTS; i++) {
+        gui_bcast_client_t *c = &bc.clients[i];
+
+        xSemaphoreTake(bc.lock, portMAX_DELAY);
+        fd = c->fd;
+        msg = NULL;
+        if (fd >= 0 && c->cnt > 0) {
+            /* a slow client does not hold back the others */
+            if (gui_bcast_writable(fd))
+                msg = gui_bcast_remove(c, 0);
+            *pending |= c->cnt > 0;
+        }
+        xSemaphoreGive(bc.lock);
+
+        if (!msg)
+            continue;
+        progress = true;
+
+        memset(&frame, 0, sizeof(frame));
+        frame.type = msg->type;
+        frame.payload = msg->data;
+        frame.len = msg->len;
+        lag_ms = (esp_timer_get_time() - msg->created_us) / 1000;
+
+        sent = httpd_ws_get_fd_info(bc.hd, fd) == HTTPD_WS_CLIENT_WEBSOCKET &&
+               httpd_ws_send_frame_async(bc.hd, fd, &frame) == ESP_OK;
+        if (!sent)
+            ESP_LOGW(TAG, "Failed to send to fd %d, closing", fd);
+
+        /* the slot may have been closed and taken by another fd meanwhile */
+        xSemaphoreTake(bc.lock, portMAX_DELAY);
+        if (c->fd == fd) {
+            if (sent) {
+                c->st.sent++;
+                if (lag_ms > c->st.lag_max_ms)
+                    c->st.lag_max_ms = lag_ms;
+            } else {
+                c->st.errors++;
+                gui_bcast_flush(c);
+            }
+        }
+        xSemaphoreGive(bc.lock);
+
+        if (!sent)
+            httpd_sess_trigger_close(bc.hd, fd);
+        gui_msg_release(msg);
+    }
+    return progress;
+}
+
+static void gui_bcast_task(void *arg)
+{
+    bool progress = false, pending = false;
+
+    for(;;) {
+        if (!progress)
+            ulTaskNotifyTake(pdTRUE, pending ? pdMS_TO_TICKS(GUI_BCAST_RETRY_MS) : portMAX_DELAY);
+        progress = gui_bcast_round(&pending);
+    }
+}
+
+esp_err_t gui_bcast_init(httpd_handle_t hd)
+{
+    bc.hd = hd;
+    if (bc.task)
+        return ESP_OK;
+
+    for (int i = 0; i < GUI_BCAST_CLIENTS; i++)
+        bc.clients[i].fd = -1;
+
+    if (!(bc.lock = xSemaphoreCreateMutex()))
+        return ESP_ERR_NO_MEM;
+
+    if (xTaskCreatePinnedToCore(gui_bcast_task, "gui_bcast", GUI_BCAST_STACK,
+                                NULL, tskIDLE_PRIORITY + 5, &bc.task, 0) != pdPASS)
+        return ESP_ERR_NO_MEM;
+
+    return ESP_OK;
+}
+
+int gui_bcast_stats(gui_bcast_client_stats_t *st, int max, uint32_t *no_slot)
+{
+    int64_t now_us = esp_timer_get_time();
+    int n = 0;
+
+    if (!bc.lock)
+        return 0;
+
+    xSemaphoreTake(bc.lock, portMAX_DELAY);
+    for (int i = 0; i < GUI_BCAST_CLIENTS && n < max; i++) {
+        gui_bcast_client_t *c = &bc.clients[i];
+
+        if (c->fd < 0)
+            continue;
+
+        st[n] = c->st;
+        st[n].queued = c->cnt;
+        st[n].lag_ms = c->cnt ? (now_us - c->queue[0]->created_us) / 1000 : 0;
+        n++;
+    }
+    if (no_slot)
+        *no_slot = bc.no_slot;
+    xSemaphoreGive(bc.lock);
+    return n;
+}
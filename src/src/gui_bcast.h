@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Websocket broadcast worker. Messages are reference counted and queued
+ * per client, a task sends them whenever the client's socket can take
+ * more data. A slow client only fills its own queue:
+ *
+ *  - players and CTF messages are the full state, a newer one replaces
+ *    a queued one of the same topic
+ *  - a full queue drops its oldest RSSI message, the newest RSSI message
+ *    if there is none, but never the others
+ *
+ * The subscription of a client lives in its slot as well, the WS handler
+ * sets it and the senders only ask the broadcaster.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include "gui.h"
+
+#define GUI_BCAST_CLIENTS   8
+#define GUI_BCAST_DEPTH     8   /* messages queued per client */
+
+typedef struct {
+    atomic_int refs;
+    gui_topic_t topic;
+    httpd_ws_type_t type;
+    int64_t created_us;
+    size_t len;
+    size_t size;            /* of data */
+    uint8_t data[];
+} gui_msg_t;
+
+/* Of a client, see gui.h. A client without one gets all topics, RSSI as JSON. */
+typedef struct {
+    uint32_t topics;        /* GUI_TOPIC_* */
+    bool rssi_binary;       /* RSSI updates as binary frames, see rssi_update_encode_bin() */
+    uint16_t rssi_freq[CFG_MAX_FREQ];   /* RSSI updates of these only, all if none */
+    int rssi_freq_cnt;
+    int rssi_decimate;      /* every n-th RSSI update of a frequency */
+} gui_bcast_sub_t;
+
+#define GUI_BCAST_SUB_DEFAULT() { .topics = GUI_TOPIC_ALL, .rssi_decimate = 1 }
+
+typedef enum {
+    GUI_RSSI_NONE,
+    GUI_RSSI_JSON,
+    GUI_RSSI_BINARY,
+} gui_rssi_format_t;
+
+typedef struct {
+    int fd;
+    uint32_t queued;
+    uint32_t queued_max;
+    uint32_t lag_ms;        /* age of the oldest queued message */
+    uint32_t lag_max_ms;    /* max age of a message when it got sent */
+    uint32_t sent;
+    uint32_t coalesced;     /* replaced by a newer state */
+    uint32_t dropped;
+    uint32_t errors;        /* failed sends, the queue got flushed */
+} gui_bcast_client_stats_t;
+
+esp_err_t gui_bcast_init(httpd_handle_t hd);
+
+/* A message with room for size bytes, the caller fills data and len */
+gui_msg_t *gui_msg_alloc(gui_topic_t topic, httpd_ws_type_t type, size_t size);
+
+void gui_msg_release(gui_msg_t *msg);
+
+/* Queue msg for the client on fd if it subscribed to its topic, takes its own reference */
+void gui_bcast_queue(gui_msg_t *msg, int fd);
+
+/* Replaces the subscription of the client on fd */
+esp_err_t gui_bcast_subscribe(int fd, const gui_bcast_sub_t *sub);
+
+/* How the client on fd wants the RSSI update seq of freq */
+gui_rssi_format_t gui_bcast_rssi_format(int fd, uint16_t freq, uint32_t seq);
+
+/* The client on fd is gone, drop its queue */
+void gui_bcast_close(int fd);
+
+/* Returns the number of clients written to st */
+int gui_bcast_stats(gui_bcast_client_stats_t *st, int max, uint32_t *no_slot);
@@ -0,0 +1,454 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "gui_http.h"
+#include "json.h"
+
+static const char * TAG = "gui-http";
+
+#define GUI_HTTP_STACK      6144
+#define GUI_HTTP_CONNS      2       /* kept-alive connections */
+#define GUI_HTTP_HOST_LEN   40
+#define GUI_HTTP_TIMEOUT_MS 3000
+#define GUI_HTTP_RETRY_MS   1000    /* of a failed lap batch */
+#define GUI_HTTP_LAPS_JSON  (128 + GUI_HTTP_LAPS * 80)
+#define GUI_HTTP_NVS_NAMESPACE  "gui_http"
+#define GUI_HTTP_NVS_OUTBOX     "outbox"
+
+typedef struct {
+    char url[GUI_HTTP_URL_LEN];
+    char *body;
+    bool replace;
+    int64_t queued_us;
+} gui_http_req_t;
+
+typedef struct {
+    lap_t lap;
+    uint32_t seq;
+    int64_t queued_us;
+} gui_http_lap_t;
+
+/* The laps not acked yet, kept in NVS across reboots */
+typedef struct {
+    uint32_t epoch;         /* new one with every new outbox, seq restarts at 1 */
+    uint32_t seq;           /* of the last lap queued, never reused */
+    char url[GUI_HTTP_URL_LEN];
+    char player[MAX_NAME_LEN];
+    char ipv4[16];
+    int cnt;
+    gui_http_lap_t laps[GUI_HTTP_LAPS];     /* oldest first */
+} gui_http_outbox_t;
+
+typedef struct {
+    char host[GUI_HTTP_HOST_LEN];
+    esp_http_client_handle_t client;
+    int64_t used_us;
+} gui_http_conn_t;
+
+static struct {
+    SemaphoreHandle_t lock;
+    TaskHandle_t task;
+
+    gui_http_req_t queue[GUI_HTTP_DEPTH];   /* oldest first */
+    int cnt;
+
+    gui_http_outbox_t outbox;
+    bool outbox_dirty;
+
+    /* worker only */
+    gui_http_outbox_t outbox_saved;
+    gui_http_conn_t conns[GUI_HTTP_CONNS];
+    char laps_json[GUI_HTTP_LAPS_JSON];
+    uint64_t ack_ms_sum;
+
+    gui_http_stats_t st;
+} gh;
+
+esp_err_t gui_http_post(const char *url, const char *json, bool replace)
+{
+    gui_http_req_t *r = NULL;
+    char *body;
+
+    if (!gh.lock)
+        return ESP_ERR_INVALID_STATE;
+
+    if (strlen(url) >= GUI_HTTP_URL_LEN)
+        return ESP_ERR_INVALID_ARG;
+
+    if (!(body = strdup(json)))
+        return ESP_ERR_NO_MEM;
+
+    xSemaphoreTake(gh.lock, portMAX_DELAY);
+
+    if (replace) {
+        for (int i = 0; i < gh.cnt; i++) {
+            if (gh.queue[i].replace && strcmp(gh.queue[i].url, url) == 0) {
+                r = &gh.queue[i];
+                free(r->body);
+                gh.st.replaced++;
+                break;
+            }
+        }
+    }
+
+    if (!r && gh.cnt < GUI_HTTP_DEPTH) {
+        r = &gh.queue[gh.cnt++];
+        strcpy(r->url, url);
+        r->replace = replace;
+        if (gh.cnt > gh.st.queued_max)
+            gh.st.queued_max = gh.cnt;
+    }
+
+    if (r) {
+        r->body = body;
+        r->queued_us = esp_timer_get_time();
+    } else {
+        gh.st.dropped++;
+    }
+
+    xSemaphoreGive(gh.lock);
+
+    if (!r) {
+        ESP_LOGW(TAG, "Queue full, dropped POST to %s", url);
+        free(body);
+        return ESP_ERR_NO_MEM;
+    }
+
+    xTaskNotifyGive(gh.task);
+    return ESP_OK;
+}
+
+esp_err_t gui_http_post_lap(const char *url, const char *player, const char *ipv4,
+                            const lap_t *lap)
+{
+    gui_http_lap_t *l;
+
+    if (!gh.lock)
+        return ESP_ERR_INVALID_STATE;
+
+    if (strlen(url) >= GUI_HTTP_URL_LEN)
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(gh.lock, portMAX_DELAY);
+
+    strcpy(gh.outbox.url, url);
+    snprintf(gh.outbox.player, sizeof(gh.outbox.player), "%s", player);
+    snprintf(gh.outbox.ipv4, sizeof(gh.outbox.ipv4), "%s", ipv4);
+
+    if (gh.outbox.cnt == GUI_HTTP_LAPS) {
+        memmove(&gh.outbox.laps[0], &gh.outbox.laps[1], sizeof(gh.outbox.laps[0]) * (GUI_HTTP_LAPS - 1));
+        gh.outbox.cnt--;
+        gh.st.dropped++;
+        ESP_LOGW(TAG, "Lap outbox full, dropped the oldest lap");
+    }
+
+    l = &gh.outbox.laps[gh.outbox.cnt++];
+    l->lap = *lap;
+    l->seq = ++gh.outbox.seq;
+    l->queued_us = esp_timer_get_time();
+    gh.outbox_dirty = true;
+
+    xSemaphoreGive(gh.lock);
+    xTaskNotifyGive(gh.task);
+    return ESP_OK;
+}
+
+/* The host[:port] of url */
+static void gui_http_host(const char *url, char *host, size_t len)
+{
+    const char *s = strstr(url, "://");
+    size_t n;
+
+    s = s ? s + 3 : url;
+    n = strcspn(s, "/");
+    if (n >= len)
+        n = len - 1;
+    memcpy(host, s, n);
+    host[n] = 0;
+}
+
+static gui_http_conn_t *gui_http_conn(const char *url)
+{
+    gui_http_conn_t *c = NULL;
+    char host[GUI_HTTP_HOST_LEN];
+
+    gui_http_host(url, host, sizeof(host));
+
+    for (int i = 0; i < GUI_HTTP_CONNS; i++) {
+        if (gh.conns[i].client && strcmp(gh.conns[i].host, host) == 0) {
+            c = &gh.conns[i];
+            esp_http_client_set_url(c->client, url);
+            goto out;
+        }
+        /* a free one or the least recently used */
+        if (!c || (c->client && (!gh.conns[i].client || gh.conns[i].used_us < c->used_us)))
+            c = &gh.conns[i];
+    }
+
+    if (c->client)
+        esp_http_client_cleanup(c->client);
+
+    esp_http_client_config_t cfg = {
+        .url = url,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = GUI_HTTP_TIMEOUT_MS,
+        .keep_alive_enable = true,
+    };
+    if (!(c->client = esp_http_client_init(&cfg)))
+        return NULL;
+
+    esp_http_client_set_header(c->client, "Content-Type", "application/json");
+    strcpy(c->host, host);
+    gh.st.connects++;
+
+out:
+    c->used_us = esp_timer_get_time();
+    return c;
+}
+
+static void gui_http_conn_close(gui_http_conn_t *c)
+{
+    esp_http_client_cleanup(c->client);
+    c->client = NULL;
+}
+
+/* POST json to url, ESP_OK on a 2xx response */
+static esp_err_t gui_http_send(const char *url, const char *json, int64_t queued_us)
+{
+    gui_http_conn_t *c;
+    esp_err_t err = ESP_FAIL;
+    int status = 0;
+    uint32_t ack_ms;
+
+    /* a kept-alive connection may have been closed by the peer, retry once */
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!(c = gui_http_conn(url)))
+            return ESP_ERR_NO_MEM;
+
+        esp_http_client_set_post_field(c->client, json, strlen(json));
+        if ((err = esp_http_client_perform(c->client)) == ESP_OK)
+            break;
+        gui_http_conn_close(c);
+    }
+
+    if (err == ESP_OK) {
+        status = esp_http_client_get_status_code(c->client);
+        if (status < 200 || status >= 300)
+            err = ESP_FAIL;
+    }
+
+    xSemaphoreTake(gh.lock, portMAX_DELAY);
+    if (err == ESP_OK) {
+        ack_ms = (esp_timer_get_time() - queued_us) / 1000;
+        gh.st.sent++;
+        gh.st.ack_ms_last = ack_ms;
+        if (ack_ms > gh.st.ack_ms_max)
+            gh.st.ack_ms_max = ack_ms;
+        gh.ack_ms_sum += ack_ms;
+        gh.st.ack_ms_avg = gh.ack_ms_sum / gh.st.sent;
+    } else {
+        gh.st.failed++;
+    }
+    xSemaphoreGive(gh.lock);
+
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "POST %s failed: %s, status %d", url, esp_err_to_name(err), status);
+    return err;
+}
+
+/* Written by the worker, the caller of gui_http_post_lap() does not wait for the flash */
+static void gui_http_outbox_save(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    xSemaphoreTake(gh.lock, portMAX_DELAY);
+    if (!gh.outbox_dirty) {
+        xSemaphoreGive(gh.lock);
+        return;
+    }
+    gh.outbox_saved = gh.outbox;
+    gh.outbox_dirty = false;
+    xSemaphoreGive(gh.lock);
+
+    if ((err = nvs_open(GUI_HTTP_NVS_NAMESPACE, NVS_READWRITE, &nvs)) == ESP_OK) {
+        if ((err = nvs_set_blob(nvs, GUI_HTTP_NVS_OUTBOX, &gh.outbox_saved, sizeof(gh.outbox_saved))) == ESP_OK)
+            err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Failed to save the lap outbox: %s", esp_err_to_name(err));
+}
+
+static void gui_http_outbox_load(void)
+{
+    size_t len = sizeof(gh.outbox);
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    if ((err = nvs_open(GUI_HTTP_NVS_NAMESPACE, NVS_READONLY, &nvs)) == ESP_OK) {
+        err = nvs_get_blob(nvs, GUI_HTTP_NVS_OUTBOX, &gh.outbox, &len);
+        nvs_close(nvs);
+    }
+
+    if (err != ESP_OK || len != sizeof(gh.outbox) || !gh.outbox.epoch ||
+        gh.outbox.cnt < 0 || gh.outbox.cnt > GUI_HTTP_LAPS) {
+        /* the controller resets its dedupe on the new epoch */
+        memset(&gh.outbox, 0, sizeof(gh.outbox));
+        while (!gh.outbox.epoch)
+            gh.outbox.epoch = esp_random();
+        gh.outbox_dirty = true;
+        ESP_LOGW(TAG, "No lap outbox: %s, epoch %08"PRIx32, esp_err_to_name(err), gh.outbox.epoch);
+        return;
+    }
+
+    for (int i = 0; i < gh.outbox.cnt; i++)
+        gh.outbox.laps[i].queued_us = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "Lap outbox: %d laps to replay, epoch %08"PRIx32" seq %"PRIu32,
+             gh.outbox.cnt, gh.outbox.epoch, gh.outbox.seq);
+}
+
+/* Send the queued laps in one POST, false if that failed */
+static bool gui_http_send_laps(void)
+{
+    char url[GUI_HTTP_URL_LEN];
+    json_writer_t jw;
+    uint32_t last_seq = 0;
+    int64_t queued_us = 0;
+    int i, n;
+
+    jw_init(&jw, gh.laps_json, sizeof(gh.laps_json));
+
+    gui_http_outbox_save();
+
+    xSemaphoreTake(gh.lock, portMAX_DELAY);
+    if ((n = gh.outbox.cnt) > 0) {
+        strcpy(url, gh.outbox.url);
+        queued_us = gh.outbox.laps[0].queued_us;
+        last_seq = gh.outbox.laps[n - 1].seq;
+        jw_object(&jw) {
+            jw_kv_str(&jw, "player", gh.outbox.player);
+            jw_kv_str(&jw, "ipv4", gh.outbox.ipv4);
+            jw_kv_uint64(&jw, "epoch", gh.outbox.epoch);
+            jw_kv(&jw, "laps") {
+                jw_array(&jw) {
+                    for (i = 0; i < n; i++) {
+                        gui_http_lap_t *l = &gh.outbox.laps[i];
+
+                        jw_object(&jw) {
+                            jw_kv_int(&jw, "id", l->lap.id);
+                            jw_kv_int(&jw, "rssi", l->lap.rssi);
+                            jw_kv_uint64(&jw, "duration", l->lap.duration_ms);
+                            jw_kv_uint64(&jw, "seq", l->seq);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    xSemaphoreGive(gh.lock);
+
+    if (n == 0)
+        return true;
+
+    if (jw.error) {
+        ESP_LOGE(TAG, "Buffer to small for %d laps, need %u more", n, (unsigned) jw.needed_space);
+        return true;
+    }
+
+    if (gui_http_send(url, jw.buf, queued_us) != ESP_OK)
+        return false;
+
+    /* laps got queued or dropped meanwhile, remove the ones sent */
+    xSemaphoreTake(gh.lock, portMAX_DELAY);
+    for (i = 0; i < gh.outbox.cnt && gh.outbox.laps[i].seq <= last_seq; i++);
+    memmove(&gh.outbox.laps[0], &gh.outbox.laps[i], sizeof(gh.outbox.laps[0]) * (gh.outbox.cnt - i));
+    gh.outbox.cnt -= i;
+    gh.outbox_dirty = true;
+    gh.st.lap_batches++;
+    gh.st.laps_sent += n;
+    xSemaphoreGive(gh.lock);
+
+    gui_http_outbox_save();
+
+    ESP_LOGI(TAG, "Sent %d laps, acked after %"PRIu32"ms", n, gh.st.ack_ms_last);
+    return true;
+}
+
+/* Send the oldest queued POST, false if there is none */
+static bool gui_http_send_next(void)
+{
+    gui_http_req_t r = { 0 };
+
+    xSemaphoreTake(gh.lock, portMAX_DELAY);
+    if (gh.cnt > 0) {
+        r = gh.queue[0];
+        memmove(&gh.queue[0], &gh.queue[1], sizeof(gh.queue[0]) * --gh.cnt);
+    }
+    xSemaphoreGive(gh.lock);
+
+    if (!r.body)
+        return false;
+
+    gui_http_send(r.url, r.body, r.queued_us);
+    free(r.body);
+    return true;
+}
+
+static void gui_http_task(void *arg)
+{
+    bool retry = true;      /* replay the laps of the outbox */
+
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, retry ? pdMS_TO_TICKS(GUI_HTTP_RETRY_MS) : portMAX_DELAY);
+        /* laps queued meanwhile go before the next POST */
+        retry = !gui_http_send_laps();
+        while (gui_http_send_next()) {
+            if (!retry)
+                retry = !gui_http_send_laps();
+        }
+    }
+}
+
+esp_err_t gui_http_init(void)
+{
+    if (gh.task)
+        return ESP_OK;
+
+    if (!(gh.lock = xSemaphoreCreateMutex()))
+        return ESP_ERR_NO_MEM;
+
+    gui_http_outbox_load();
+
+    if (xTaskCreatePinnedToCore(gui_http_task, "gui_http", GUI_HTTP_STACK,
+                                NULL, tskIDLE_PRIORITY + 3, &gh.task, 0) != pdPASS)
+        return ESP_ERR_NO_MEM;
+
+    return ESP_OK;
+}
+
+void gui_http_stats(gui_http_stats_t *st)
+{
+    if (!gh.lock) {
+        memset(st, 0, sizeof(*st));
+        return;
+    }
+
+    xSemaphoreTake(gh.lock, portMAX_DELAY);
+    *st = gh.st;
+    st->queued = gh.cnt + gh.outbox.cnt;
+    st->lap_seq = gh.outbox.seq;
+    xSemaphoreGive(gh.lock);
+}
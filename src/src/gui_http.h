@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Outbound HTTP worker, for the traffic of a child node to its controller
+ * (and of the controller to its children). Callers only queue the POSTs,
+ * a task sends them over a kept-alive connection per host:
+ *
+ *  - a POST queued with replace set supersedes a queued one to the same URL
+ *  - laps are collected and sent together as {"player","ipv4","laps":[..]},
+ *    each with a sequence number of the node ("seq"), the receiver drops
+ *    the ones it has seen. The laps stay in an outbox, saved in NVS, until
+ *    acked, a failed batch is retried, also after a reboot
+ *  - a full queue drops the new POST, the oldest lap
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "simple_fpv_timer.h"
+
+#define GUI_HTTP_DEPTH      16      /* queued POSTs */
+#define GUI_HTTP_LAPS       16      /* queued laps */
+#define GUI_HTTP_URL_LEN    64
+
+typedef struct {
+    uint32_t queued;
+    uint32_t queued_max;
+    uint32_t sent;
+    uint32_t failed;
+    uint32_t replaced;      /* superseded by a newer POST to the same URL */
+    uint32_t dropped;       /* queue full */
+    uint32_t lap_batches;
+    uint32_t laps_sent;
+    uint32_t lap_seq;       /* of the last lap queued */
+    uint32_t connects;      /* new connections */
+    uint32_t ack_ms_last;   /* queued until the response */
+    uint32_t ack_ms_max;
+    uint32_t ack_ms_avg;
+} gui_http_stats_t;
+
+esp_err_t gui_http_init(void);
+
+/* Queue a POST of json (copied), never blocks */
+esp_err_t gui_http_post(const char *url, const char *json, bool replace);
+
+/* Queue a lap of player, sent to url with the other queued laps */
+esp_err_t gui_http_post_lap(const char *url, const char *player, const char *ipv4,
+                            const lap_t *lap);
+
+void gui_http_stats(gui_http_stats_t *st);
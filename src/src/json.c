@@ -23,6 +23,7 @@ void j_init(json_t *j, jsmntok_t *tokens, size_t num)
     j->tokens = tokens;
     j->end = tokens + num;
     j->buf = NULL;
+    j->idx = NULL;
 }
 
 json_t * j_parse(json_t *j, const char *in, size_t len)
@@ -35,17 +36,106 @@ json_t * j_parse(json_t *j, const char *in, size_t len)
     if (num > 0) {
         j->buf = in;
         j->end = j->tokens + num;
+        if (j->idx)
+            j->idx->obj = NULL;
         return j;
     }
     return NULL;
 }
 
-json_t * j_find(json_t *j, const char *name, json_t *result)
+/* FNV-1a */
+static uint32_t j_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    while (len--) {
+        h ^= (uint8_t) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool j_key_eq(const json_t *j, const jsmntok_t *t, const char *name, size_t len)
+{
+    return t->end - t->start == len && memcmp(j->buf + t->start, name, len) == 0;
+}
+
+void j_index(json_t *j, j_index_t *idx, uint16_t *slot, size_t size)
 {
+    if (size > 0x8000)
+        size = 0x8000;
+    /* round down to a power of 2 */
+    while (size & (size - 1))
+        size &= size - 1;
+
+    idx->obj = NULL;
+    idx->slot = slot;
+    idx->size = size;
+    idx->full = false;
+    j->idx = idx;
+}
+
+size_t j_index_slots(const json_t *j)
+{
+    size_t size = 8;
+
+    while (j->tokens && size < 2 * j->tokens->size)
+        size <<= 1;
+    return size;
+}
+
+static void j_index_build(json_t *j)
+{
+    j_index_t *idx = j->idx;
     jsmntok_t *t = j->tokens;
-    jsmntok_t *end = j->end;
+    uint32_t mask = idx->size - 1, h;
+    int keys = t->size, parent;
+    uint16_t s;
+
+    idx->obj = j->tokens;
+    idx->full = t->type != JSMN_OBJECT || keys >= idx->size ||
+                j->end - j->tokens >= UINT16_MAX;
+    if (idx->full || keys == 0)
+        return;
 
-    memset(result, 0, sizeof(*result));
+    memset(idx->slot, 0, idx->size * sizeof(*idx->slot));
+    parent = t[1].parent;
+    for (t++; t < j->end && keys > 0; t++) {
+        if (t->parent != parent)
+            continue;
+        keys--;
+
+        h = j_hash(j->buf + t->start, t->end - t->start) & mask;
+        for (; (s = idx->slot[h]); h = (h + 1) & mask) {
+            /* a duplicate key, the first one wins like in the scan */
+            if (j_key_eq(j, &j->tokens[s - 1], j->buf + t->start, t->end - t->start))
+                break;
+        }
+        if (!s)
+            idx->slot[h] = t - j->tokens + 1;
+    }
+}
+
+static jsmntok_t * j_index_find(json_t *j, const char *name, size_t len)
+{
+    j_index_t *idx = j->idx;
+    uint32_t mask = idx->size - 1, h;
+    uint16_t s;
+
+    if (j->tokens->size == 0)
+        return NULL;
+
+    for (h = j_hash(name, len) & mask; (s = idx->slot[h]); h = (h + 1) & mask) {
+        if (j_key_eq(j, &j->tokens[s - 1], name, len))
+            return &j->tokens[s - 1];
+    }
+    return NULL;
+}
+
+static jsmntok_t * j_scan_find(json_t *j, const char *name, size_t len)
+{
+    jsmntok_t *t = j->tokens;
+    jsmntok_t *end = j->end;
 
     if ((end - t) < 2)
         return NULL;
@@ -62,19 +152,37 @@ json_t * j_find(json_t *j, const char *name, json_t *result)
         if (t->type == 0)
             continue;
 
-        if (strncmp(j->buf + t->start, name, t->end - t->start) != 0)
-            continue;
-
-        /* token found, take the next as it is the value */
-        t++;
-        result->tokens = t;
-        result->end = end;
-        result->buf = j->buf;
-        return result;
+        if (j_key_eq(j, t, name, len))
+            return t;
     }
     return NULL;
 }
 
+json_t * j_find(json_t *j, const char *name, json_t *result)
+{
+    size_t len = strlen(name);
+    jsmntok_t *t;
+
+    memset(result, 0, sizeof(*result));
+
+    if (j->idx && j->idx->obj != j->tokens)
+        j_index_build(j);
+
+    if (j->idx && !j->idx->full)
+        t = j_index_find(j, name, len);
+    else
+        t = j_scan_find(j, name, len);
+
+    if (!t || t + 1 >= j->end)
+        return NULL;
+
+    /* token found, take the next as it is the value */
+    result->tokens = t + 1;
+    result->end = j->end;
+    result->buf = j->buf;
+    return result;
+}
+
 jsmntok_t * j_get_kv(json_t *j, char *key, size_t klen, char *value, size_t vlen)
 {
     jsmntok_t *t;
@@ -97,6 +205,75 @@ jsmntok_t * j_get_kv(json_t *j, char *key, size_t klen, char *value, size_t vlen
     return NULL;
 }
 
+/* The char of a one char escape, `\n` is '\n', '"', '\\' and '/' stand for themselves */
+static char j_esc_char(char c)
+{
+    switch (c) {
+    case 'b': return '\b';
+    case 'f': return '\f';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    default:  return c;
+    }
+}
+
+static int j_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* UTF-8 of u (BMP, surrogates are not paired) to out, returns its length */
+static size_t j_utf8(uint32_t u, char *out)
+{
+    if (u < 0x80) {
+        out[0] = u;
+        return 1;
+    }
+    if (u < 0x800) {
+        out[0] = 0xc0 | u >> 6;
+        out[1] = 0x80 | (u & 0x3f);
+        return 2;
+    }
+    out[0] = 0xe0 | u >> 12;
+    out[1] = 0x80 | ((u >> 6) & 0x3f);
+    out[2] = 0x80 | (u & 0x3f);
+    return 3;
+}
+
+/*
+ * Decodes the escape of which s[0..len) are the chars after the backslash.
+ * Writes up to 3 bytes to out, returns their number, *used the chars of s.
+ * Never longer than the escape itself.
+ */
+static size_t j_unescape(const char *s, size_t len, char *out, size_t *used)
+{
+    uint32_t u = 0;
+    int h;
+
+    *used = 1;
+    if (s[0] != 'u' || len < 5) {
+        out[0] = j_esc_char(s[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < 5; i++) {
+        if ((h = j_hex(s[i])) < 0) {
+            out[0] = s[0];
+            return 1;
+        }
+        u = u << 4 | h;
+    }
+    *used = 5;
+    return j_utf8(u, out);
+}
+
 jsmntok_t * j_get_str(json_t *j, char *buf, size_t len)
 {
     jsmntok_t *t;
@@ -118,8 +295,10 @@ jsmntok_t * j_get_str(json_t *j, char *buf, size_t len)
                 } else {
                     i++;
                     if (i < t_len) {
-                        *buf = j->buf[i + t->start];
-                        buf++;
+                        size_t used;
+
+                        buf += j_unescape(&j->buf[i + t->start], t_len - i, buf, &used);
+                        i += used - 1;
                     }
                 }
             }
@@ -144,17 +323,19 @@ int j_eq_str(json_t *j, char *str)
     int t_len = t->end - t->start;
 
     for(int i = 0; i < t_len; i++) {
+        char c[3] = { j->buf[i + t->start] };
+        size_t n = 1, used;
 
-        char c = j->buf[i + t->start];
-        if (c == '\\') {
+        if (c[0] == '\\') {
             i++;
             if (i < t_len) {
-                c = j->buf[i + t->start];
+                n = j_unescape(&j->buf[i + t->start], t_len - i, c, &used);
+                i += used - 1;
             }
         }
-        if (c != *str)
+        if (strncmp(c, str, n) != 0)
             return 0; /* is not equal */
-        str++;
+        str += n;
     }
     return *str == '\0';
 }
@@ -264,12 +445,219 @@ json_t * j_value(json_t * node, json_t *ret)
         ret->tokens = &node->tokens[1];
         ret->end = node->end;
         ret->buf = node->buf;
+        ret->idx = NULL;
         return ret;
     }
 
     return NULL;
 }
 
+enum {
+    J_SAX_START,
+    J_SAX_OBJECT,       /* after '{' */
+    J_SAX_KEY_START,    /* after ',' */
+    J_SAX_KEY,
+    J_SAX_COLON,
+    J_SAX_VALUE,
+    J_SAX_STR,
+    J_SAX_PRIM,
+    J_SAX_SKIP,
+    J_SAX_NEXT,
+    J_SAX_DONE,
+    J_SAX_ERROR,
+};
+
+void j_sax_init(j_sax_t *s, j_sax_kv_t kv, void *arg)
+{
+    memset(s, 0, sizeof(*s));
+    s->kv = kv;
+    s->arg = arg;
+    s->state = J_SAX_START;
+}
+
+bool j_sax_done(const j_sax_t *s)
+{
+    return s->state == J_SAX_DONE;
+}
+
+static bool j_sax_ws(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void j_sax_put(j_sax_t *s, char *str, size_t *len, char c)
+{
+    if (*len + 1 < J_SAX_STR_SZ)
+        str[(*len)++] = c;
+    else
+        s->overflow = true;
+}
+
+/* a char of a quoted string, true on the closing quote */
+static bool j_sax_str(j_sax_t *s, char *str, size_t *len, char c)
+{
+    char utf8[3];
+    int h;
+
+    /* the 4 hex digits of a \uXXXX, a broken one skips the key */
+    if (s->hex_left) {
+        if ((h = j_hex(c)) >= 0) {
+            s->hex = s->hex << 4 | h;
+            if (--s->hex_left == 0) {
+                for (size_t i = 0, n = j_utf8(s->hex, utf8); i < n; i++)
+                    j_sax_put(s, str, len, utf8[i]);
+            }
+            return false;
+        }
+        s->hex_left = 0;
+        s->overflow = true;
+    }
+
+    if (s->esc) {
+        s->esc = false;
+        if (c == 'u') {
+            s->hex_left = 4;
+            s->hex = 0;
+        } else {
+            j_sax_put(s, str, len, j_esc_char(c));
+        }
+    } else if (c == '\\') {
+        s->esc = true;
+    } else if (c == '"') {
+        return true;
+    } else {
+        j_sax_put(s, str, len, c);
+    }
+    return false;
+}
+
+static int j_sax_emit(j_sax_t *s)
+{
+    s->state = J_SAX_NEXT;
+    if (s->overflow)
+        return 0;
+    s->key[s->klen] = '\0';
+    s->value[s->vlen] = '\0';
+    return s->kv(s->arg, s->key, s->value);
+}
+
+int j_sax_feed(j_sax_t *s, const char *buf, size_t len)
+{
+    int r = 0;
+
+    for (size_t i = 0; i < len && r == 0; i++) {
+        char c = buf[i];
+
+        switch (s->state) {
+        case J_SAX_START:
+            if (c == '{')
+                s->state = J_SAX_OBJECT;
+            else if (!j_sax_ws(c))
+                r = -1;
+            break;
+
+        case J_SAX_OBJECT:
+        case J_SAX_KEY_START:
+            if (c == '"') {
+                s->state = J_SAX_KEY;
+                s->klen = 0;
+                s->overflow = false;
+                s->esc = false;
+                s->hex_left = 0;
+            } else if (c == '}' && s->state == J_SAX_OBJECT) {
+                s->state = J_SAX_DONE;
+            } else if (!j_sax_ws(c)) {
+                r = -1;
+            }
+            break;
+
+        case J_SAX_KEY:
+            if (j_sax_str(s, s->key, &s->klen, c))
+                s->state = J_SAX_COLON;
+            break;
+
+        case J_SAX_COLON:
+            if (c == ':')
+                s->state = J_SAX_VALUE;
+            else if (!j_sax_ws(c))
+                r = -1;
+            break;
+
+        case J_SAX_VALUE:
+            s->vlen = 0;
+            if (j_sax_ws(c))
+                break;
+            if (c == '"') {
+                s->state = J_SAX_STR;
+                s->esc = false;
+                s->hex_left = 0;
+            } else if (c == '{' || c == '[') {
+                s->state = J_SAX_SKIP;
+                s->depth = 1;
+                s->in_str = false;
+            } else if (c == ',' || c == ':' || c == '}' || c == ']') {
+                r = -1;
+            } else {
+                s->state = J_SAX_PRIM;
+                j_sax_put(s, s->value, &s->vlen, c);
+            }
+            break;
+
+        case J_SAX_STR:
+            if (j_sax_str(s, s->value, &s->vlen, c))
+                r = j_sax_emit(s);
+            break;
+
+        case J_SAX_PRIM:
+            if (j_sax_ws(c) || c == ',' || c == '}') {
+                r = j_sax_emit(s);
+                i--;    /* the delimiter, again in J_SAX_NEXT */
+            } else {
+                j_sax_put(s, s->value, &s->vlen, c);
+            }
+            break;
+
+        case J_SAX_SKIP:
+            if (s->in_str) {
+                if (s->esc)
+                    s->esc = false;
+                else if (c == '\\')
+                    s->esc = true;
+                else if (c == '"')
+                    s->in_str = false;
+            } else if (c == '"') {
+                s->in_str = true;
+            } else if (c == '{' || c == '[') {
+                s->depth++;
+            } else if ((c == '}' || c == ']') && --s->depth == 0) {
+                s->state = J_SAX_NEXT;
+            }
+            break;
+
+        case J_SAX_NEXT:
+            if (c == ',')
+                s->state = J_SAX_KEY_START;
+            else if (c == '}')
+                s->state = J_SAX_DONE;
+            else if (!j_sax_ws(c))
+                r = -1;
+            break;
+
+        case J_SAX_DONE:
+            if (!j_sax_ws(c))
+                r = -1;
+            break;
+
+        default:
+            r = -1;
+        }
+    }
+
+    if (r != 0)
+        s->state = J_SAX_ERROR;
+    return r;
+}
+
 void jw_init(json_writer_t *jw, char *buf, size_t len)
 {
     if (len > 0)
@@ -279,6 +667,43 @@ void jw_init(json_writer_t *jw, char *buf, size_t len)
     jw->wptr = buf;
     jw->error = 0;
     jw->needed_space = 0;
+    jw->sink = NULL;
+    jw->sink_arg = NULL;
+    jw->flushed = 0;
+}
+
+void jw_init_stream(json_writer_t *jw, char *buf, size_t len, jw_sink_t sink, void *arg)
+{
+    jw_init(jw, buf, len);
+    jw->sink = sink;
+    jw->sink_arg = arg;
+}
+
+/* Pass all but the last keep bytes to the sink */
+static bool jw_flush_keep(json_writer_t *jw, size_t keep)
+{
+    size_t n = jw->wptr - jw->buf;
+
+    if (n <= keep)
+        return true;
+
+    if (jw->sink(jw->sink_arg, jw->buf, n - keep) != 0) {
+        jw->error = true;
+        return false;
+    }
+
+    memmove(jw->buf, jw->wptr - keep, keep);
+    jw->wptr = jw->buf + keep;
+    *jw->wptr = '\0';
+    jw->flushed += n - keep;
+    return true;
+}
+
+bool jw_flush(json_writer_t *jw)
+{
+    if (jw->error)
+        return false;
+    return !jw->sink || jw_flush_keep(jw, 0);
 }
 
 bool jw_can_write(json_writer_t *jw, size_t needed)
@@ -288,14 +713,18 @@ bool jw_can_write(json_writer_t *jw, size_t needed)
         return false;
     }
 
-    if (((jw->wptr - jw->buf) + needed) < jw->len) {
+    if (((jw->wptr - jw->buf) + needed) < jw->len)
         return true;
-    } else  {
-        jw->needed_space = jw->wptr - jw->buf;
-        jw->needed_space += needed;
+
+    if (jw->sink && jw_flush_keep(jw, 1) && ((jw->wptr - jw->buf) + needed) < jw->len)
+        return true;
+
+    jw->needed_space = jw->wptr - jw->buf;
+    jw->needed_space += needed;
+    /* streaming: a single value larger than the staging buffer, or the sink failed */
+    if (!jw->sink)
         snprintf(jw->buf, jw->len, "{ \"error\": \"JSON buffer to small\"}");
-        jw->error = ENOBUFS;
-    }
+    jw->error = ENOBUFS;
     return false;
 }
 
@@ -316,14 +745,118 @@ static void jw_put(json_writer_t *jw, char c)
     jw->wptr++;
 }
 
+static void jw_write(json_writer_t *jw, const char *str, size_t len)
+{
+    size_t room, n;
+
+    while (len > 0) {
+        /* a stream takes what fits, the rest after a flush */
+        n = len;
+        room = jw->len - (jw->wptr - jw->buf);
+        if (jw->sink && room < len + 2)
+            n = room > 2 ? room - 2 : 0;
+
+        if (!jw_can_write(jw, n ? n + 1 : 2))
+            return;
+        if (n == 0)
+            continue;
+
+        memcpy(jw->wptr, str, n);
+        jw->wptr += n;
+        *jw->wptr = '\0';
+        str += n;
+        len -= n;
+    }
+}
+
+#define JW_ONES     0x01010101u
+#define JW_HIGHS    0x80808080u
+
+/*
+ * The high bit set in the bytes of x which are '"', '\\' or a control char,
+ * and maybe in bytes after such one. Neither changes the high bit of a
+ * byte, so ~x stands for the xor'ed values too.
+ */
+static inline uint32_t jw_escape_mask(uint32_t x)
+{
+    uint32_t q = x ^ (JW_ONES * '"');
+    uint32_t b = x ^ (JW_ONES * '\\');
+
+    return ((x - JW_ONES * 0x20) | (q - JW_ONES) | (b - JW_ONES)) & ~x & JW_HIGHS;
+}
+
+/* chars in front of the first one to escape, 4 at a time */
+static size_t jw_clean_len(const char *s, size_t len)
+{
+    size_t i = 0;
+    uint32_t x;
+
+    for (; i + 4 <= len; i += 4) {
+        memcpy(&x, s + i, 4);
+        if (jw_escape_mask(x))
+            break;
+    }
+    for (; i < len; i++) {
+        unsigned char c = s[i];
+
+        if (c < 0x20 || c == '"' || c == '\\')
+            break;
+    }
+    return i;
+}
+
 static void jw_write_quoted_buf(json_writer_t *jw, const char *buf, size_t len)
 {
+    static const char hex[] = "0123456789abcdef";
+    char esc[6] = { '\\', 'u', '0', '0' };
+    unsigned char c;
+    size_t n = jw_clean_len(buf, len);
+
+    /* nothing to escape, in one go with the quotes, unless a stream has to split it */
+    if (n == len && (!jw->sink || len + 4 < jw->len) && jw_can_write(jw, len + 3)) {
+        *jw->wptr++ = '"';
+        memcpy(jw->wptr, buf, len);
+        jw->wptr += len;
+        *jw->wptr++ = '"';
+        *jw->wptr = '\0';
+        return;
+    }
+
     jw_put(jw, '"');
-    for (int i=0; i < len; i++) {
-        if (buf[i] == '"' || buf[i] == '\\') {
-            jw_put(jw, '\\');
+    while (len > 0) {
+        jw_write(jw, buf, n);
+        buf += n;
+        len -= n;
+        if (len == 0)
+            break;
+
+        c = *buf++;
+        len--;
+        n = jw_clean_len(buf, len);
+        switch (c) {
+            case '"':
+            case '\\':
+                esc[1] = c;
+                jw_write(jw, esc, 2);
+                break;
+            case '\n':
+                esc[1] = 'n';
+                jw_write(jw, esc, 2);
+                break;
+            case '\r':
+                esc[1] = 'r';
+                jw_write(jw, esc, 2);
+                break;
+            case '\t':
+                esc[1] = 't';
+                jw_write(jw, esc, 2);
+                break;
+            default:
+                esc[1] = 'u';
+                esc[4] = hex[c >> 4];
+                esc[5] = hex[c & 0xf];
+                jw_write(jw, esc, 6);
         }
-        jw_put(jw, buf[i]);
     }
     jw_put(jw, '"');
 }
@@ -380,6 +913,11 @@ void jw_kv_start(json_writer_t *jw, const char *key)
     jw_put(jw, ':');
 }
 
+void jw_key(json_writer_t *jw, const char *quoted, size_t len)
+{
+    jw_write(jw, quoted, len);
+}
+
 void jw_kv_end(json_writer_t *jw)
 {
     if ( jw_prev(jw) == ',' ) return;
@@ -399,54 +937,75 @@ void jw_kv_str(json_writer_t *jw, const char *key, const char *value)
     }
 }
 
-void jw_int(json_writer_t *jw, int value)
+static const char jw_digits[200] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Decimal of v, right aligned in front of end, two digits at a time */
+static char *jw_utoa(char *end, uint32_t v)
 {
-    int len = 0;
-    int v = value;
-    while(v > 0) {
-        len++;
-        v /= 10;
-    }
-    if (value < 0)
-        len++;
+    const char *d;
 
-    jw_can_write(jw, len);
-    jw->wptr += sprintf(jw->wptr,"%d", value);
-    jw_put(jw, ',');
+    while (v >= 100) {
+        d = &jw_digits[(v % 100) * 2];
+        v /= 100;
+        *--end = d[1];
+        *--end = d[0];
+    }
+    if (v >= 10) {
+        *--end = jw_digits[v * 2 + 1];
+        *--end = jw_digits[v * 2];
+    } else {
+        *--end = '0' + v;
+    }
+    return end;
 }
 
-void jw_int32(json_writer_t *jw, int32_t value)
+/* 64 bit divisions are slow on the ESP32, in blocks of 9 digits */
+static char *jw_u64toa(char *end, uint64_t v)
 {
-    int len = 0;
-    int v = value;
-    while(v > 0) {
-        len++;
-        v /= 10;
+    char *p;
+
+    while (v > UINT32_MAX) {
+        p = jw_utoa(end, v % 1000000000);
+        v /= 1000000000;
+        end -= 9;
+        while (p > end)
+            *--p = '0';
     }
-    if (value < 0)
-        len++;
-
-    jw_can_write(jw, len);
-    jw->wptr += sprintf(jw->wptr,"%"PRId32, value);
-    jw_put(jw, ',');
+    return jw_utoa(end, v);
 }
 
-void jw_uint64(json_writer_t *jw, uint64_t value)
+void jw_int(json_writer_t *jw, int value)
 {
-    int len = 0;
-    uint64_t v = value;
+    jw_int32(jw, value);
+}
 
-    while(v > 0) {
-        len++;
-        v /= 10;
-    }
+void jw_int32(json_writer_t *jw, int32_t value)
+{
+    char buf[13];
+    char *p;
 
-    jw_can_write(jw, len);
-    jw->wptr += sprintf(jw->wptr,"%"PRIu64, value);
-    jw_put(jw, ',');
+    /* the digits and the ',' in one go */
+    buf[11] = ',';
+    p = jw_utoa(&buf[11], value < 0 ? 0u - (uint32_t) value : (uint32_t) value);
+    if (value < 0)
+        *--p = '-';
+    jw_write(jw, p, &buf[12] - p);
 }
 
+void jw_uint64(json_writer_t *jw, uint64_t value)
+{
+    char buf[22];
+    char *p;
 
+    buf[20] = ',';
+    p = jw_u64toa(&buf[20], value);
+    jw_write(jw, p, &buf[21] - p);
+}
 
 void jw_kv_int(json_writer_t *jw, const char *key, int value)
 {
@@ -470,8 +1029,10 @@ void jw_kv_uint64(json_writer_t *jw, const char *key, uint64_t value)
 void jw_kv_bool(json_writer_t *jw, const char *key, bool value)
 {
     jw_kv(jw, key) {
-        jw_format(jw, "%s", value ? "true" : "false");
-        jw_put(jw, ',');
+        if (value)
+            jw_write(jw, "true,", 5);
+        else
+            jw_write(jw, "false,", 6);
     }
 }
 
@@ -494,17 +1055,26 @@ void jw_format(json_writer_t *jw, const char *format, ...)
 {
     va_list args;
     int r;
-    size_t size = (jw->buf + jw->len) - jw->wptr;
+    size_t size;
 
-    va_start (args, format);
-    r = vsnprintf (jw->wptr, size, format, args);
-    va_end (args);
+    if (jw->error)
+        return;
 
-    if (r > 0 && r < size) {
-        jw->wptr += r;
-    } else {
-        /** force error */
-        jw_can_write(jw, jw->len +1);
+    for (int retry = 0; ; retry++) {
+        size = (jw->buf + jw->len) - jw->wptr;
+        va_start (args, format);
+        r = vsnprintf (jw->wptr, size, format, args);
+        va_end (args);
+
+        if (r > 0 && r < size) {
+            jw->wptr += r;
+            return;
+        }
+        /* make room in the staging buffer and try again */
+        if (retry || !jw->sink || r <= 0 || !jw_flush_keep(jw, 1))
+            break;
     }
+    /** force error */
+    jw_can_write(jw, jw->len +1);
 }
 
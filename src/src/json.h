@@ -9,16 +9,31 @@
 #define JSMN_HEADER
 #include "jsmn.h"
 
+/*
+ * Optional index of the keys of an object, built by j_find() on the first
+ * lookup: open addressing over size slots (a power of 2, at least twice the
+ * keys), each the 1-based offset of a key token, 0 is empty.
+ */
+typedef struct {
+    const jsmntok_t *obj;   /* the indexed object, NULL: to be built */
+    uint16_t *slot;
+    uint16_t size;
+    bool full;              /* not an object or too many keys, j_find() scans */
+} j_index_t;
+
 typedef struct  {
     jsmntok_t *tokens;  /* Pointer to the first token of a JSON object */
     jsmntok_t *end;            /* Number of tokens in *tokens */
     const char *buf;
+    j_index_t *idx;     /* optional, see j_index() */
 } json_t;
 
 void j_init(json_t *j, jsmntok_t *tokens, size_t num);
 json_t * j_parse(json_t *j, const char *in, size_t len);
 void j_print(json_t * j);
 json_t * j_find(json_t *j, const char *name, json_t *result);
+void j_index(json_t *j, j_index_t *idx, uint16_t *slot, size_t size);
+size_t j_index_slots(const json_t *j);
 jsmntok_t * j_get_kv(json_t *j, char *key, size_t klen, char *value, size_t vlen);
 jsmntok_t * j_get_str(json_t *j, char *buf, size_t len);
 int j_eq_str(json_t *j, char *str);
@@ -31,6 +46,42 @@ jsmntok_t * j_find_uint64(json_t *j, const char *name, uint64_t *ret);
 json_t * j_next(json_t * array, json_t *prev);
 json_t * j_value(json_t * node, json_t *ret);
 
+/*
+ * Incremental parser of a flat object, fed in chunks of any size, e.g. as
+ * received. Calls kv for each key with a string or primitive value, as
+ * text (unescaped like j_get_str()). Nested values and keys or values of
+ * J_SAX_STR_SZ and more are skipped. No tokens, constant memory.
+ */
+#define J_SAX_STR_SZ    32
+
+/* returns 0 to continue */
+typedef int (*j_sax_kv_t)(void *arg, const char *key, const char *value);
+
+typedef struct {
+    j_sax_kv_t kv;
+    void *arg;
+    uint8_t state;
+    bool esc;
+    uint8_t hex_left;   /* digits of a \uXXXX still to come */
+    uint16_t hex;
+    bool in_str;        /* skipping a nested string */
+    bool overflow;
+    int depth;          /* of the skipped value */
+    size_t klen;
+    size_t vlen;
+    char key[J_SAX_STR_SZ];
+    char value[J_SAX_STR_SZ];
+} j_sax_t;
+
+void j_sax_init(j_sax_t *s, j_sax_kv_t kv, void *arg);
+/* 0, -1 on a syntax error or the non-zero return of kv */
+int j_sax_feed(j_sax_t *s, const char *buf, size_t len);
+/* the closing '}' was seen */
+bool j_sax_done(const j_sax_t *s);
+
+
+/* Takes len bytes of a streamed JSON, returns 0 on success */
+typedef int (*jw_sink_t)(void *arg, const char *buf, size_t len);
 
 typedef struct {
     char *buf;
@@ -38,11 +89,22 @@ typedef struct {
     char *wptr;
     bool error;
     size_t needed_space;
+    jw_sink_t sink;         /* streaming: buf is only the staging buffer */
+    void *sink_arg;
+    size_t flushed;         /* bytes passed to sink */
 } json_writer_t;
 
 
 void jw_init(json_writer_t *jw, char *buf, size_t len);
 
+/*
+ * Streaming: whenever buf is full, its content is passed to sink, but the
+ * last char, the writer may still take back a trailing ','. Thus the JSON
+ * is only limited by the size of a single value. jw_flush() passes the rest.
+ */
+void jw_init_stream(json_writer_t *jw, char *buf, size_t len, jw_sink_t sink, void *arg);
+bool jw_flush(json_writer_t *jw);
+
 #define jw_object(jw)   for(jw_object_start(jw);                        \
                             jw_prev(jw) != '}' && jw_can_write(jw, 1);  \
                             jw_object_end(jw) )
@@ -59,6 +121,8 @@ void jw_array_end(json_writer_t * jw);
                             jw_prev(jw) != ','&& jw_can_write(jw, 1);   \
                             jw_kv_end(jw) )
 void jw_kv_start(json_writer_t *jw, const char *key);
+/* A key quoted at compile time with its ':', e.g. "\"freq\":", followed by a value */
+void jw_key(json_writer_t *jw, const char *quoted, size_t len);
 void jw_kv_end(json_writer_t *jw);
 
 void jw_str(json_writer_t *jw, const char *value);
@@ -21,6 +21,7 @@
 #include "simple_fpv_timer.h"
 #include "osd.h"
 #include "task_rssi.h"
+#include "rssi_recorder.h"
 #include "task_led.h"
 #include "driver/gpio.h"
 
@@ -187,7 +188,8 @@ void app_main() {
     cfg_eeprom_to_running(&ctx.cfg);
 
     task_led_init(&ctx);
-    task_rssi_init(&ctx);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(rssi_recorder_init());
+    task_rssi_init(&ctx.cfg.eeprom, rssi_recorder_put);
 
     int i = 0;
     int reset_cnt = 0;
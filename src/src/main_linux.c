@@ -0,0 +1,759 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Entry point of the linux target build. Runs the RSSI detection of
+ * task_rssi.c as fast as the host can and prints the detected laps. The
+ * input is an hour of synthetic drone passes or a recorded trace.
+ *
+ * Environment:
+ *   SFT_TRACE=<file>   replay a trace (binary from /api/v1/rssi/trace or text)
+ *   SFT_RX5808=<secs>  run the RX5808 source of the firmware on rx5808_sim.c
+ *                      for secs in real time, with its async channel switch,
+ *                      settle times and their characterization
+ *   SFT_RECORD=<file>  write the samples as binary trace
+ *   SFT_PILOTS, SFT_PASS_MS
+ *                      synthetic pilots (raceband, 1-8) and sigma of a pass
+ *   SFT_STEP_PEAK, SFT_STEP_MIN
+ *                      synthetic passes peak at SFT_STEP_PEAK mV from minute
+ *                      SFT_STEP_MIN (default 30) on, like a VTX power change
+ *   SFT_PEAK, SFT_FILTER, SFT_MEDIAN, SFT_KALMAN_Q, SFT_KALMAN_R,
+ *   SFT_ENTER, SFT_LEAVE, SFT_OFFSET, SFT_AUTO, SFT_MIN_PEAK
+ *                      detection settings, like the config of the node
+ *   SFT_BENCH_FILTER=1 instead of the detection, run the samples of the
+ *                      first frequency through the filter chains of
+ *                      rssi_filter.h, print ns/sample and the noise
+ *   SFT_BENCH_JSON=1   compare the key lookup of json.c, scan vs. index, on
+ *                      objects like the POSTed settings, and time the JSON
+ *                      encoding of an RSSI update and of the settings
+ *   SFT_BENCH_CONFIG=1 round trip of random configs through the JSON codec
+ *                      of config_json.c, time of encoding and applying
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "config.h"
+#include "json.h"
+#include "sft_events.h"
+#include "rssi_filter.h"
+#include "rssi_src.h"
+#include "rssi_update.h"
+#include "task_rssi.h"
+
+ESP_EVENT_DEFINE_BASE(SFT_EVENT);
+
+static int laps = 0;
+static int rssi_updates = 0;
+
+/* synthetic only, distance of the reported pass to the real one */
+static const rssi_src_synthetic_cfg_t *truth;
+static double err_sum;
+static int64_t err_max;
+static int err_in_2sigma;
+
+static FILE *record_fp;
+static rssi_trace_enc_t record_enc;
+static uint8_t record_block[RSSI_TRACE_BLOCK_SIZE];
+static uint32_t record_seq;
+
+static void on_drone_passed(void* arg, esp_event_base_t base, int32_t id, void* event_data)
+{
+    sft_event_drone_passed_t *ev = (sft_event_drone_passed_t*) event_data;
+
+    laps++;
+    printf("LAP freq:%d time:%"PRIi64"us +-%"PRIu32"us rssi:%d\n", ev->freq,
+           ev->abs_time_us, ev->time_err_us, ev->rssi);
+
+    if (truth) {
+        int64_t lap_us = truth->lap_ms * 1000LL;
+        int64_t phase = (int64_t)(ev->freq % 10) * (lap_us / 10);
+        int64_t err = (ev->abs_time_us + phase) % lap_us - lap_us / 2;
+
+        err = err < 0 ? -err : err;
+        err_sum += err;
+        if (err <= 2 * (int64_t)ev->time_err_us)
+            err_in_2sigma++;
+        if (err > err_max)
+            err_max = err;
+    }
+}
+
+/* Stands in for the web UI, to exercise the update blocks */
+static void on_rssi_update(void* arg, esp_event_base_t base, int32_t id, void* event_data)
+{
+    sft_event_rssi_update_t *ev = ((sft_event_rssi_update_ref_t*) event_data)->ev;
+
+    rssi_updates++;
+    rssi_update_release(ev);
+}
+
+/* Like rssi_recorder_put() of the firmware, but into a file */
+static void record_put(int64_t t_us, int freq, int rssi)
+{
+    if (rssi_trace_enc_put(&record_enc, t_us, freq, rssi))
+        return;
+
+    fwrite(record_block, rssi_trace_enc_finish(&record_enc), 1, record_fp);
+    rssi_trace_enc_init(&record_enc, record_block, 0, ++record_seq);
+    rssi_trace_enc_put(&record_enc, t_us, freq, rssi);
+}
+
+/* The RX5808 source never runs dry, it ends at rx5808_end_us */
+static int64_t rx5808_end_us;
+static esp_err_t (*rx5808_read)(rssi_src_t *src, rssi_sample_t *samples, size_t max,
+                                size_t *num, int *freq);
+
+static esp_err_t rx5808_read_until(rssi_src_t *src, rssi_sample_t *samples, size_t max,
+                                   size_t *num, int *freq)
+{
+    if (esp_timer_get_time() >= rx5808_end_us)
+        return ESP_ERR_NOT_FOUND;
+    return rx5808_read(src, samples, max, num, freq);
+}
+
+static int env_int(const char *name, int def)
+{
+    const char *v = getenv(name);
+    return v ? atoi(v) : def;
+}
+
+/* The frequencies of a trace are not known up front, collect them in a first pass */
+static int trace_freqs(const char *path, int *freqs, int max)
+{
+    static rssi_src_trace_t trace;
+    static rssi_sample_t batch[RSSI_BATCH_MAX];
+    rssi_src_t src;
+    size_t num;
+    int freq, cnt = 0, i;
+
+    if (rssi_src_trace_init(&src, &trace, path) != ESP_OK)
+        return 0;
+
+    src.start(&src);
+    while (src.read(&src, batch, sizeof(batch) / sizeof(batch[0]), &num, &freq) == ESP_OK) {
+        for (i = 0; i < cnt && freqs[i] != freq; i++);
+        if (i == cnt && cnt < max)
+            freqs[cnt++] = freq;
+    }
+
+    rssi_src_trace_close(&src);
+    return cnt;
+}
+
+#define BENCH_SAMPLES_MAX   (4 * 1024 * 1024)
+#define BENCH_ROUNDS        5
+
+static int64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * The noise is the standard deviation of the samples, of which the raw
+ * value is below the 90th percentile. That leaves out the drone passes,
+ * which make up a few percent of a race.
+ */
+static double bench_noise(const int *raw, const int *v, size_t n, int limit)
+{
+    double sum = 0, sum2 = 0;
+    size_t cnt = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (raw[i] >= limit)
+            continue;
+        sum += v[i];
+        sum2 += (double)v[i] * v[i];
+        cnt++;
+    }
+
+    return cnt ? sqrt(sum2 / cnt - (sum / cnt) * (sum / cnt)) : 0;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+    return *(const int*)a - *(const int*)b;
+}
+
+static void bench_filter(rssi_src_t *src, int freq)
+{
+    static const struct {
+        const char *name;
+        int stages, median, ema, kalman_q, kalman_r;
+    } chains[] = {
+        { "raw",            0, 0, 100, 0, 0 },
+        { "ema60",          RSSI_FILTER_EMA, 0, 60, 0, 0 },
+        { "ema20",          RSSI_FILTER_EMA, 0, 20, 0, 0 },
+        { "median5",        RSSI_FILTER_MEDIAN, 5, 100, 0, 0 },
+        { "kalman",         RSSI_FILTER_KALMAN, 0, 100, 4, 20 },
+        { "median5+ema60",  RSSI_FILTER_MEDIAN | RSSI_FILTER_EMA, 5, 60, 0, 0 },
+        { "median5+kalman", RSSI_FILTER_MEDIAN | RSSI_FILTER_KALMAN, 5, 100, 4, 20 },
+        { "all",            RSSI_FILTER_MEDIAN | RSSI_FILTER_EMA | RSSI_FILTER_KALMAN, 5, 60, 4, 20 },
+    };
+    static rssi_sample_t batch[RSSI_BATCH_MAX];
+    int *raw = malloc(BENCH_SAMPLES_MAX * sizeof(int));
+    int *out = malloc(BENCH_SAMPLES_MAX * sizeof(int));
+    int *sorted = malloc(BENCH_SAMPLES_MAX * sizeof(int));
+    size_t n = 0, num;
+    int64_t valid_us;
+    int f, limit, peak;
+    double noise_raw;
+
+    if (!raw || !out || !sorted) {
+        printf("Out of memory\n");
+        goto out;
+    }
+
+    /* the samples of one channel, as task_rssi would see them */
+    src->set_channel(src, freq, &valid_us);
+    while (n < BENCH_SAMPLES_MAX &&
+           src->read(src, batch, sizeof(batch) / sizeof(batch[0]), &num, &f) == ESP_OK) {
+        for (size_t i = 0; i < num && n < BENCH_SAMPLES_MAX; i++) {
+            if (f == freq)
+                raw[n++] = batch[i].rssi;
+        }
+    }
+
+    if (n < 100) {
+        printf("Not enough samples on %d\n", freq);
+        goto out;
+    }
+
+    memcpy(sorted, raw, n * sizeof(int));
+    qsort(sorted, n, sizeof(int), bench_cmp);
+    limit = sorted[n * 9 / 10];
+    noise_raw = bench_noise(raw, raw, n, limit);
+
+    printf("freq:%d %zu samples, noise limit %dmV\n", freq, n, limit);
+    printf("%-16s %10s %10s %10s %8s\n", "chain", "ns/sample", "noise mV", "reduction", "peak mV");
+
+    for (size_t c = 0; c < sizeof(chains) / sizeof(chains[0]); c++) {
+        rssi_filter_t filter;
+        int64_t best = INT64_MAX;
+
+        rssi_filter_setup(&filter, chains[c].stages, chains[c].median, chains[c].ema,
+                          chains[c].kalman_q, chains[c].kalman_r);
+
+        /* in batches like task_rssi_run(), best of some rounds */
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            int64_t t = bench_now_ns();
+
+            rssi_filter_reset(&filter);
+            for (size_t i = 0; i < n; i += 64)
+                rssi_filter_run(&filter, raw + i, out + i, n - i < 64 ? n - i : 64);
+
+            t = bench_now_ns() - t;
+            if (t < best)
+                best = t;
+        }
+
+        peak = out[0];
+        for (size_t i = 1; i < n; i++) {
+            if (out[i] > peak)
+                peak = out[i];
+        }
+
+        double noise = bench_noise(raw, out, n, limit);
+        printf("%-16s %10.2f %10.2f %9.2fx %8d\n", chains[c].name, (double)best / n,
+               noise, noise > 0 ? noise_raw / noise : 0, peak);
+    }
+
+out:
+    free(raw);
+    free(out);
+    free(sorted);
+}
+
+#define BENCH_JSON_KEYS_MAX  128
+#define BENCH_JSON_LOOKUPS   (1024 * 1024)
+
+/* {"key_0":0,"key_1":1,..}, every key looked up, in rounds */
+static void bench_json(void)
+{
+    static char in[BENCH_JSON_KEYS_MAX * 24];
+    static char names[BENCH_JSON_KEYS_MAX][16];
+    static jsmntok_t tokens[2 * BENCH_JSON_KEYS_MAX + 1];
+    static uint16_t slot[4 * BENCH_JSON_KEYS_MAX];
+    static const int sizes[] = { 8, 32, 128 };
+    json_t j, v;
+    j_index_t idx;
+    int val;
+
+    printf("%-6s %12s %12s %8s\n", "keys", "scan ns", "index ns", "speedup");
+    for (size_t c = 0; c < sizeof(sizes) / sizeof(sizes[0]); c++) {
+        int keys = sizes[c], len = 0;
+        int64_t best[2] = { INT64_MAX, INT64_MAX };
+
+        len += sprintf(in + len, "{");
+        for (int k = 0; k < keys; k++) {
+            sprintf(names[k], "key_%d", k);
+            len += sprintf(in + len, "%s\"%s\":%d", k ? "," : "", names[k], k);
+        }
+        len += sprintf(in + len, "}");
+
+        for (int m = 0; m < 2; m++) {
+            for (int r = 0; r < BENCH_ROUNDS; r++) {
+                int64_t t;
+
+                j_init(&j, tokens, sizeof(tokens) / sizeof(tokens[0]));
+                if (!j_parse(&j, in, len)) {
+                    printf("Failed to parse %d keys\n", keys);
+                    return;
+                }
+                if (m)
+                    j_index(&j, &idx, slot, j_index_slots(&j));
+
+                /* including the build of the index, on the first lookup */
+                t = bench_now_ns();
+                for (int i = 0; i < BENCH_JSON_LOOKUPS; i++) {
+                    int k = i % keys;
+
+                    if (!j_find(&j, names[k], &v) || !j_get_int(&v, &val) || val != k) {
+                        printf("Lookup of %s failed\n", names[k]);
+                        return;
+                    }
+                }
+                t = bench_now_ns() - t;
+                if (t < best[m])
+                    best[m] = t;
+            }
+        }
+        printf("%-6d %12.1f %12.1f %7.1fx\n", keys,
+               (double)best[0] / BENCH_JSON_LOOKUPS, (double)best[1] / BENCH_JSON_LOOKUPS,
+               (double)best[0] / best[1]);
+    }
+}
+
+#define BENCH_ENCODE_ROUNDS  20000
+
+/*
+ * Like sft_encode_settings(): the config of cfg_json_encode() and the lap
+ * counter, 8 players with 10 laps. That one needs the NVS and game state,
+ * which are not part of this build.
+ */
+static void bench_encode_settings(json_writer_t *jw)
+{
+    static const char *rssi_keys[] = { "freq", "peak", "filter", "filter_median",
+        "filter_kalman_q", "filter_kalman_r", "offset_enter", "offset_leave",
+        "calib_min_rssi_peak", "auto_threshold" };
+    char key[32];
+
+    jw_object(jw) {
+        jw_kv(jw, "config") {
+            jw_object(jw) {
+                for (int i = 0; i < 8; i++) {
+                    for (int k = 0; k < sizeof(rssi_keys) / sizeof(rssi_keys[0]); k++) {
+                        snprintf(key, sizeof(key), "rssi[%d].%s", i, rssi_keys[k]);
+                        jw_kv_int(jw, key, 5658 + 37 * i + k);
+                    }
+                    snprintf(key, sizeof(key), "rssi[%d].name", i);
+                    jw_kv_str(jw, key, "Pilot");
+                }
+                jw_kv_str(jw, "ssid", "simple-fpv-timer-4F");
+                jw_kv_str(jw, "passphrase", "fpv-race-2024");
+                jw_kv_str(jw, "node_name", "gate \"start\"");
+                jw_kv_str(jw, "osd_format", "%2L: %6.2Ts");
+                jw_kv_int(jw, "rssi_offset", -12);
+            }
+        }
+        jw_kv(jw, "status") {
+            jw_object(jw) {
+                jw_kv(jw, "players") {
+                    jw_array(jw) {
+                        for (int p = 0; p < 8; p++) {
+                            jw_object(jw) {
+                                jw_kv_str(jw, "name", "Pilot");
+                                jw_kv_str(jw, "ipaddr", "192.168.4.2");
+                                jw_kv(jw, "laps") {
+                                    jw_array(jw) {
+                                        for (int l = 0; l < 10; l++) {
+                                            jw_object(jw) {
+                                                jw_kv_int(jw, "id", l + 1);
+                                                jw_kv_int(jw, "duration", 23456 + 97 * l);
+                                                jw_kv_int(jw, "rssi", 1834 - l);
+                                                jw_kv_int(jw, "abs_time", 1234567 + 23456 * l);
+                                            }
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void bench_encode_rssi(json_writer_t *jw)
+{
+    static sft_event_rssi_update_t ev;
+
+    if (ev.cnt == 0) {
+        ev.cnt = SFT_RSSI_UPDATE_MAX;
+        ev.freq = 5658;
+        ev.sample_rate_hz = 312;
+        ev.floor = 412;
+        ev.peak = 1890;
+        ev.enter = 1592;
+        ev.leave = 1444;
+        for (int i = 0; i < ev.cnt; i++) {
+            ev.data[i].abs_time_ms = 3600000 + 3 * i;
+            ev.data[i].rssi = 420 + 37 * i;
+            ev.data[i].rssi_raw = 400 + 41 * i;
+            ev.data[i].drone_in_gate = i > 24;
+        }
+    }
+    rssi_update_encode_json(&ev, jw);
+}
+
+static void bench_encode(void)
+{
+    static char buf[8192];
+    static const struct {
+        const char *name;
+        void (*encode)(json_writer_t *jw);
+    } docs[] = {
+        { "rssi update", bench_encode_rssi },
+        { "settings", bench_encode_settings },
+    };
+    json_writer_t jw;
+
+    printf("\n%-12s %8s %12s %10s\n", "encode", "bytes", "ns/doc", "MB/s");
+    for (size_t d = 0; d < sizeof(docs) / sizeof(docs[0]); d++) {
+        int64_t best = INT64_MAX;
+
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            int64_t t = bench_now_ns();
+
+            for (int i = 0; i < BENCH_ENCODE_ROUNDS; i++) {
+                jw_init(&jw, buf, sizeof(buf));
+                docs[d].encode(&jw);
+            }
+            t = bench_now_ns() - t;
+            if (t < best)
+                best = t;
+        }
+        if (jw.error) {
+            printf("%s: JSON buffer to small\n", docs[d].name);
+            continue;
+        }
+        printf("%-12s %8zu %12.1f %10.1f\n", docs[d].name, (size_t)(jw.wptr - jw.buf),
+               (double)best / BENCH_ENCODE_ROUNDS,
+               (double)(jw.wptr - jw.buf) * BENCH_ENCODE_ROUNDS * 1000 / best);
+    }
+}
+
+#define BENCH_CONFIG_ROUNDS  2000
+
+/* strings of any char but '\0', control chars and quotes are escaped */
+static void bench_config_fill(config_data_t *cfg)
+{
+    for (const struct config_meta *cm = cfg_meta(); cm->name; cm++) {
+        uint8_t *v = (uint8_t*) cfg + cm->offset;
+        size_t len;
+
+        if (cm->type == STRING) {
+            len = rand() % cm->size;
+            for (size_t i = 0; i < len; i++)
+                v[i] = 1 + rand() % 255;
+            memset(v + len, 0, cm->size - len);
+        } else {
+            for (size_t i = 0; i < cm->size; i++)
+                v[i] = rand();
+        }
+    }
+}
+
+static int bench_config_kv(void *arg, const char *key, const char *value)
+{
+    return cfg_data_set_param(arg, key, value) == ESP_OK ? 0 : 1;
+}
+
+static bool bench_config_decode(config_data_t *cfg, const char *json, size_t len)
+{
+    j_sax_t sax;
+
+    j_sax_init(&sax, bench_config_kv, cfg);
+    return j_sax_feed(&sax, json, len) == 0 && j_sax_done(&sax);
+}
+
+#define BENCH_APPLY_KEYS    90
+
+typedef struct {
+    int cnt;
+    char key[BENCH_APPLY_KEYS][J_SAX_STR_SZ];
+    char value[BENCH_APPLY_KEYS][J_SAX_STR_SZ];
+} bench_apply_t;
+
+static int bench_apply_collect(void *arg, const char *key, const char *value)
+{
+    bench_apply_t *ba = arg;
+
+    if (ba->cnt < BENCH_APPLY_KEYS) {
+        snprintf(ba->key[ba->cnt], J_SAX_STR_SZ, "%s", key);
+        snprintf(ba->value[ba->cnt], J_SAX_STR_SZ, "%s", value);
+        ba->cnt++;
+    }
+    return 0;
+}
+
+/* The lookup cfg_data_set_param() did before, a walk over config_meta[] */
+static const struct config_meta *bench_apply_walk(const char *name)
+{
+    for (const struct config_meta *cm = cfg_meta(); cm->name; cm++) {
+        if (strcmp(cm->name, name) == 0)
+            return cm;
+    }
+    return NULL;
+}
+
+/* Applies the first BENCH_APPLY_KEYS parameters of an encoded config one by one */
+static void bench_apply(const char *json, size_t len)
+{
+    static bench_apply_t ba;
+    static config_data_t cfg;
+    j_sax_t sax;
+    int64_t t, best_set = INT64_MAX, best_walk = INT64_MAX;
+    int failed = 0, found = 0;
+
+    j_sax_init(&sax, bench_apply_collect, &ba);
+    if (j_sax_feed(&sax, json, len) != 0 || !j_sax_done(&sax) || ba.cnt != BENCH_APPLY_KEYS) {
+        printf("apply: only %d keys\n", ba.cnt);
+        return;
+    }
+
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        t = bench_now_ns();
+        for (int i = 0; i < BENCH_CONFIG_ROUNDS; i++) {
+            for (int k = 0; k < ba.cnt; k++)
+                failed += cfg_data_set_param(&cfg, ba.key[k], ba.value[k]) != ESP_OK;
+        }
+        t = bench_now_ns() - t;
+        if (t < best_set)
+            best_set = t;
+
+        t = bench_now_ns();
+        for (int i = 0; i < BENCH_CONFIG_ROUNDS; i++) {
+            for (int k = 0; k < ba.cnt; k++)
+                found += bench_apply_walk(ba.key[k]) != NULL;
+        }
+        t = bench_now_ns() - t;
+        if (t < best_walk)
+            best_walk = t;
+    }
+    printf("apply %d keys: %.1f us (%.1f ns/key, %d failed), "
+           "config_meta walk (lookup only) %.1f us (%.1f ns/key, %d found)\n",
+           ba.cnt, best_set / 1000.0 / BENCH_CONFIG_ROUNDS,
+           (double)best_set / BENCH_CONFIG_ROUNDS / ba.cnt, failed,
+           best_walk / 1000.0 / BENCH_CONFIG_ROUNDS,
+           (double)best_walk / BENCH_CONFIG_ROUNDS / ba.cnt,
+           found / (BENCH_ROUNDS * BENCH_CONFIG_ROUNDS));
+}
+
+static void bench_config(void)
+{
+    static char buf[8192];
+    static config_data_t a, b;
+    json_writer_t jw;
+    int64_t t, best_enc = INT64_MAX, best_dec = INT64_MAX;
+    int failed = 0, keys = 0;
+
+    cfg_json_init();
+    for (const struct config_meta *cm = cfg_meta(); cm->name; cm++)
+        keys++;
+
+    for (int r = 0; r < 1000; r++) {
+        bench_config_fill(&a);
+        memset(&b, 0, sizeof(b));
+        jw_init(&jw, buf, sizeof(buf));
+        if (!cfg_json_encode(&a, &jw) || !bench_config_decode(&b, buf, jw.wptr - buf)) {
+            failed++;
+            continue;
+        }
+        for (const struct config_meta *cm = cfg_meta(); cm->name; cm++) {
+            if (memcmp((uint8_t*) &a + cm->offset, (uint8_t*) &b + cm->offset, cm->size) != 0) {
+                printf("round trip of %s failed\n", cm->name);
+                failed++;
+                break;
+            }
+        }
+    }
+    printf("config round trip: %d keys, %zu bytes, %d of 1000 failed\n",
+           keys, (size_t)(jw.wptr - buf), failed);
+
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        t = bench_now_ns();
+        for (int i = 0; i < BENCH_CONFIG_ROUNDS; i++) {
+            jw_init(&jw, buf, sizeof(buf));
+            cfg_json_encode(&a, &jw);
+        }
+        t = bench_now_ns() - t;
+        if (t < best_enc)
+            best_enc = t;
+
+        t = bench_now_ns();
+        for (int i = 0; i < BENCH_CONFIG_ROUNDS; i++)
+            bench_config_decode(&b, buf, jw.wptr - buf);
+        t = bench_now_ns() - t;
+        if (t < best_dec)
+            best_dec = t;
+    }
+    printf("encode %.1f us, apply %.1f us (%.1f ns/key)\n",
+           best_enc / 1000.0 / BENCH_CONFIG_ROUNDS, best_dec / 1000.0 / BENCH_CONFIG_ROUNDS,
+           (double)best_dec / BENCH_CONFIG_ROUNDS / keys);
+
+    bench_apply(buf, jw.wptr - buf);
+}
+
+void app_main(void)
+{
+    static task_rssi_t tsk;
+    static rssi_src_t src;
+    static rssi_src_synthetic_t synthetic;
+    static rssi_src_trace_t trace;
+    static rssi_src_rx5808_t rx5808;
+    static const rssi_src_synthetic_cfg_t rx5808_cfg = RSSI_SRC_SYNTHETIC_DEFAULT();
+    int freqs[CFG_MAX_FREQ] = { 5658, 5695, 5732, 5769, 5806, 5843, 5880, 5917 };
+    int freq_cnt = env_int("SFT_PILOTS", 4);
+    rssi_src_synthetic_cfg_t synthetic_cfg = RSSI_SRC_SYNTHETIC_DEFAULT();
+    const char *trace_path = getenv("SFT_TRACE");
+    const char *record_path = getenv("SFT_RECORD");
+    int rx5808_secs = env_int("SFT_RX5808", 0);
+    config_data_t cfg = {0};
+    int64_t start, src_start, src_us;
+    rssi_update_stats_t ust;
+
+    if (env_int("SFT_BENCH_CONFIG", 0)) {
+        bench_config();
+        return;
+    }
+
+    if (env_int("SFT_BENCH_JSON", 0)) {
+        bench_json();
+        bench_encode();
+        return;
+    }
+
+    synthetic_cfg.pass_width_ms = env_int("SFT_PASS_MS", synthetic_cfg.pass_width_ms);
+    synthetic_cfg.peak_step = env_int("SFT_STEP_PEAK", 0);
+    synthetic_cfg.peak_step_ms = env_int("SFT_STEP_MIN", 30) * 60 * 1000ULL;
+    if (freq_cnt < 1 || freq_cnt > CFG_MAX_FREQ)
+        freq_cnt = 4;
+
+    if (trace_path && !(freq_cnt = trace_freqs(trace_path, freqs, CFG_MAX_FREQ))) {
+        printf("No samples in %s\n", trace_path);
+        return;
+    }
+
+    for (int i = 0; i < freq_cnt; i++) {
+        cfg.rssi[i].freq = freqs[i];
+        cfg.rssi[i].peak = env_int("SFT_PEAK", synthetic_cfg.peak);
+        cfg.rssi[i].filter = env_int("SFT_FILTER", 60);
+        cfg.rssi[i].filter_median = env_int("SFT_MEDIAN", 0);
+        cfg.rssi[i].filter_kalman_q = env_int("SFT_KALMAN_Q", 0);
+        cfg.rssi[i].filter_kalman_r = env_int("SFT_KALMAN_R", 0);
+        cfg.rssi[i].offset_enter = env_int("SFT_ENTER", 80);
+        cfg.rssi[i].offset_leave = env_int("SFT_LEAVE", 70);
+        cfg.rssi[i].auto_threshold = env_int("SFT_AUTO", 1);
+        cfg.rssi[i].calib_min_rssi_peak = env_int("SFT_MIN_PEAK", 600);
+    }
+    cfg.rssi_offset = env_int("SFT_OFFSET", 0);
+
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(esp_event_handler_register(SFT_EVENT, SFT_EVENT_DRONE_PASSED,
+                                               on_drone_passed, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(SFT_EVENT, SFT_EVENT_RSSI_UPDATE,
+                                               on_rssi_update, NULL));
+    rssi_update_subscribe();
+
+    if (trace_path)
+        ESP_ERROR_CHECK(rssi_src_trace_init(&src, &trace, trace_path));
+    else if (rx5808_secs > 0) {
+        /* rx5808_sim.c runs the default passes on the real time clock */
+        rssi_src_rx5808_init(&src, &rx5808, 0, 0, 0, 0, true);
+        rx5808_read = src.read;
+        src.read = rx5808_read_until;
+        truth = &rx5808_cfg;
+    } else {
+        rssi_src_synthetic_init(&src, &synthetic, &synthetic_cfg);
+        truth = &synthetic_cfg;
+    }
+
+    ESP_ERROR_CHECK(src.start(&src));
+
+    if (env_int("SFT_BENCH_FILTER", 0)) {
+        bench_filter(&src, freqs[0]);
+        if (trace_path)
+            rssi_src_trace_close(&src);
+        return;
+    }
+
+    task_rssi_setup(&tsk, &src, &cfg);
+
+    if (record_path) {
+        if (!(record_fp = fopen(record_path, "wb"))) {
+            printf("Failed to create %s\n", record_path);
+            return;
+        }
+        rssi_trace_enc_init(&record_enc, record_block, 0, 0);
+        tsk.record = record_put;
+    }
+
+    start = esp_timer_get_time();
+    src_start = src.now_us(&src);
+    rx5808_end_us = start + rx5808_secs * 1000000LL;
+    task_rssi_run(&tsk);
+
+    /* let the event loop deliver the last events */
+    vTaskDelay(pdMS_TO_TICKS(500));
+
+    if (record_fp) {
+        fwrite(record_block, rssi_trace_enc_finish(&record_enc), 1, record_fp);
+        printf("Recorded %ld bytes to %s\n", ftell(record_fp), record_path);
+        fclose(record_fp);
+    }
+
+    src_us = src.now_us(&src) - src_start;
+    printf("Processed %"PRIi64"s of RSSI in %"PRIi64"ms, %d laps\n",
+           src_us / 1000000, (esp_timer_get_time() - start) / 1000, laps);
+
+    if (truth && laps)
+        printf("Pass time error: mean %.0fus, max %"PRIi64"us, %d%% within 2 sigma\n",
+               err_sum / laps, err_max, err_in_2sigma * 100 / laps);
+
+    for (int i = 0; i < tsk.rssi_cnt && src_us > 0; i++)
+        printf("freq:%d %"PRIu64" samples, %"PRIi64"Hz\n", tsk.rssi_array[i].freq,
+               tsk.rssi_array[i].samples,
+               (int64_t)(tsk.rssi_array[i].samples * 1000000 / src_us));
+
+    if (src.lost)
+        printf("Source lost %"PRIu32" samples\n", src.lost(&src));
+
+    /* detection runs inline here, thus never more than one batch waits */
+    printf("Sample ring: max %"PRIu32" of %d samples waiting, %"PRIu32" dropped\n",
+           tsk.ring.hwm, RSSI_RING_SIZE, tsk.ring.dropped);
+
+    rssi_update_stats(&ust);
+    printf("RSSI updates: %d received, max %"PRIu32" of %"PRIu32" blocks in use, %"PRIu32" exhausted, "
+           "%"PRIu32" bytes posted, %"PRIu32" bytes not copied\n",
+           rssi_updates, ust.hwm, ust.blocks, ust.exhausted, ust.post_bytes, ust.saved_bytes);
+
+    if (trace_path)
+        rssi_src_trace_close(&src);
+}
+
+#endif /* CONFIG_IDF_TARGET_LINUX */
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <string.h>
+#include "rssi_filter.h"
+
+static inline int rssi_filter_median(rssi_filter_t *f, int v)
+{
+    int *s = f->median_sorted;
+    int n = f->median_n;
+    int old = f->median_hist[f->median_pos];
+    int i;
+
+    f->median_hist[f->median_pos] = v;
+    if (++f->median_pos == n)
+        f->median_pos = 0;
+
+    /* the oldest sample leaves the sorted window, v takes its slot */
+    for (i = 0; s[i] != old; i++);
+    while (i > 0 && s[i - 1] > v) {
+        s[i] = s[i - 1];
+        i--;
+    }
+    while (i < n - 1 && s[i + 1] < v) {
+        s[i] = s[i + 1];
+        i++;
+    }
+    s[i] = v;
+
+    return s[n / 2];
+}
+
+static inline int32_t rssi_filter_ema(rssi_filter_t *f, int32_t v)
+{
+    f->ema += (int32_t)(((int64_t)f->ema_alpha * (v - f->ema)) >> RSSI_FILTER_Q);
+    return f->ema;
+}
+
+static inline int32_t rssi_filter_kalman(rssi_filter_t *f, int32_t v)
+{
+    int64_t p = f->kalman_p + f->kalman_q;
+    int64_t k = (p << RSSI_FILTER_Q) / (p + f->kalman_r);
+
+    f->kalman_x += (int32_t)((k * (v - f->kalman_x)) >> RSSI_FILTER_Q);
+    f->kalman_p = ((RSSI_FILTER_ONE - k) * p) >> RSSI_FILTER_Q;
+    return f->kalman_x;
+}
+
+/* Start all stages on the level of the first sample instead of 0 mV */
+static void rssi_filter_prime(rssi_filter_t *f, int v)
+{
+    for (int i = 0; i < RSSI_FILTER_MEDIAN_MAX; i++)
+        f->median_hist[i] = f->median_sorted[i] = v;
+    f->median_pos = 0;
+
+    f->ema = v * RSSI_FILTER_ONE;
+    f->kalman_x = v * RSSI_FILTER_ONE;
+    f->kalman_p = f->kalman_r;
+    f->primed = 1;
+}
+
+/*
+ * One function per combination of stages. The stage flags are constants,
+ * the compiler drops the disabled stages and inlines the others.
+ */
+#define RSSI_FILTER_CHAIN(median, ema, kalman)                              \
+static void rssi_filter_run_##median##ema##kalman(rssi_filter_t *f,         \
+        const int *restrict in, int *restrict out, size_t n)                \
+{                                                                           \
+    if (n && !f->primed)                                                    \
+        rssi_filter_prime(f, in[0]);                                        \
+                                                                            \
+    for (size_t i = 0; i < n; i++) {                                        \
+        int32_t v = in[i];                                                  \
+                                                                            \
+        if (median)                                                         \
+            v = rssi_filter_median(f, v);                                   \
+        v *= RSSI_FILTER_ONE;                                               \
+        if (ema)                                                            \
+            v = rssi_filter_ema(f, v);                                      \
+        if (kalman)                                                         \
+            v = rssi_filter_kalman(f, v);                                   \
+        out[i] = (v + RSSI_FILTER_ONE / 2) >> RSSI_FILTER_Q;                \
+    }                                                                       \
+}
+
+RSSI_FILTER_CHAIN(0, 0, 0)
+RSSI_FILTER_CHAIN(1, 0, 0)
+RSSI_FILTER_CHAIN(0, 1, 0)
+RSSI_FILTER_CHAIN(1, 1, 0)
+RSSI_FILTER_CHAIN(0, 0, 1)
+RSSI_FILTER_CHAIN(1, 0, 1)
+RSSI_FILTER_CHAIN(0, 1, 1)
+RSSI_FILTER_CHAIN(1, 1, 1)
+
+/* indexed by RSSI_FILTER_* */
+static const rssi_filter_fn rssi_filter_chains[8] = {
+    rssi_filter_run_000,
+    rssi_filter_run_100,
+    rssi_filter_run_010,
+    rssi_filter_run_110,
+    rssi_filter_run_001,
+    rssi_filter_run_101,
+    rssi_filter_run_011,
+    rssi_filter_run_111,
+};
+
+static int clamp(int v, int min, int max)
+{
+    return v < min ? min : v > max ? max : v;
+}
+
+void rssi_filter_setup(rssi_filter_t *f, int stages, int median_n,
+                       int ema_percent, int kalman_q, int kalman_r)
+{
+    memset(f, 0, sizeof(*f));
+
+    /* a window of one, or an EMA of 100%, is no filter at all */
+    if (median_n < 3)
+        stages &= ~RSSI_FILTER_MEDIAN;
+    if (ema_percent >= 100)
+        stages &= ~RSSI_FILTER_EMA;
+
+    f->stages = stages & (RSSI_FILTER_MEDIAN | RSSI_FILTER_EMA | RSSI_FILTER_KALMAN);
+    f->run = rssi_filter_chains[f->stages];
+
+    f->median_n = clamp(median_n | 1, 3, RSSI_FILTER_MEDIAN_MAX);
+    f->ema_alpha = clamp(ema_percent, 1, 100) * RSSI_FILTER_ONE / 100;
+
+    kalman_q = clamp(kalman_q, 0, RSSI_FILTER_KALMAN_MAX);
+    kalman_r = clamp(kalman_r, 1, RSSI_FILTER_KALMAN_MAX);
+    f->kalman_q = ((int64_t)kalman_q * kalman_q) << 8;
+    f->kalman_r = ((int64_t)kalman_r * kalman_r) << 8;
+}
+
+void rssi_filter_init(rssi_filter_t *f, const config_rssi_t *cfg)
+{
+    int stages = RSSI_FILTER_MEDIAN | RSSI_FILTER_EMA;
+
+    if (cfg->filter_kalman_r)
+        stages |= RSSI_FILTER_KALMAN;
+
+    rssi_filter_setup(f, stages, cfg->filter_median, cfg->filter,
+                      cfg->filter_kalman_q, cfg->filter_kalman_r);
+}
+
+void rssi_filter_reset(rssi_filter_t *f)
+{
+    f->primed = 0;
+}
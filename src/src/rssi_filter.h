@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Fixed-point RSSI filter chain. A chain has up to three stages, applied
+ * in this order:
+ *
+ *   median   median of the last N samples, removes single ADC spikes
+ *   EMA      exponential moving average, config_rssi_t.filter
+ *   Kalman   1-D random walk Kalman filter, measurement and process noise
+ *
+ * Values between the stages are Q16 mV. Every combination of stages is a
+ * separate function, chosen once by rssi_filter_init(), thus the per
+ * sample loop does not branch on the configuration.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config_data.h"
+
+#define RSSI_FILTER_Q           16
+#define RSSI_FILTER_ONE         (1 << RSSI_FILTER_Q)
+
+#define RSSI_FILTER_MEDIAN      (1 << 0)
+#define RSSI_FILTER_EMA         (1 << 1)
+#define RSSI_FILTER_KALMAN      (1 << 2)
+
+#define RSSI_FILTER_MEDIAN_MAX  9       /* max window, odd */
+#define RSSI_FILTER_KALMAN_MAX  1000    /* mV, limit of the noise settings */
+
+typedef struct rssi_filter_s rssi_filter_t;
+
+/* Filter n samples of in (mV) to out (mV), in and out may not overlap */
+typedef void (*rssi_filter_fn)(rssi_filter_t *f, const int *in, int *out, size_t n);
+
+struct rssi_filter_s {
+    rssi_filter_fn run;
+    int stages;             /* RSSI_FILTER_* */
+    int primed;             /* state holds a sample */
+
+    /* median */
+    int median_n;
+    int median_pos;         /* oldest sample in median_hist */
+    int median_hist[RSSI_FILTER_MEDIAN_MAX];    /* ring, arrival order */
+    int median_sorted[RSSI_FILTER_MEDIAN_MAX];
+
+    /* EMA, Q16 */
+    int32_t ema_alpha;
+    int32_t ema;
+
+    /* Kalman, x in Q16 mV, the variances in Q8 mV^2 */
+    int32_t kalman_x;
+    int64_t kalman_p;
+    int64_t kalman_q;
+    int64_t kalman_r;
+};
+
+/**
+ * Select the stages by the settings of cfg:
+ *   filter           1-99 enables the EMA, 100 keeps the raw value
+ *   filter_median    window size of the median, < 3 disables it
+ *   filter_kalman_r  measurement noise (sigma, mV), 0 disables Kalman
+ *   filter_kalman_q  process noise (sigma per sample, mV)
+ */
+void rssi_filter_init(rssi_filter_t *f, const config_rssi_t *cfg);
+
+/* Like rssi_filter_init() with explicit settings, used by the benchmark */
+void rssi_filter_setup(rssi_filter_t *f, int stages, int median_n,
+                       int ema_percent, int kalman_q, int kalman_r);
+
+/* Forget the history, the next sample primes the stages */
+void rssi_filter_reset(rssi_filter_t *f);
+
+static inline void rssi_filter_run(rssi_filter_t *f, const int *in, int *out, size_t n)
+{
+    f->run(f, in, out, n);
+}
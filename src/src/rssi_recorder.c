@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <inttypes.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "rssi_recorder.h"
+#include "rssi_trace.h"
+
+#if !CONFIG_IDF_TARGET_LINUX
+
+#include "esp_partition.h"
+#include "esp_random.h"
+
+static const char * TAG = "rssi-rec";
+
+#define RSSI_RECORDER_BLOCKS    2       /* RAM blocks, one is filled while the other is written */
+#define RSSI_RECORDER_STACK     3072
+
+typedef struct {
+    int idx;                /* RAM block */
+    uint32_t seq;
+    size_t len;
+} rssi_recorder_job_t;
+
+static struct {
+    const esp_partition_t *part;
+    uint32_t capacity;      /* blocks */
+    QueueHandle_t queue;
+
+    uint8_t block[RSSI_RECORDER_BLOCKS][RSSI_TRACE_BLOCK_SIZE];
+    volatile bool busy[RSSI_RECORDER_BLOCKS];
+
+    /* owned by task_rssi (rssi_recorder_put) */
+    rssi_trace_enc_t enc;
+    int active;
+    bool started;           /* enc holds records */
+    uint32_t seq;           /* of the next block */
+
+    volatile bool enabled;
+    volatile bool restart;
+    volatile uint32_t session;
+    volatile uint32_t head; /* seq + 1 of the last block in flash */
+    volatile uint32_t dropped;
+} rec;
+
+static void rssi_recorder_task(void *arg)
+{
+    rssi_recorder_job_t job;
+    rssi_trace_block_hdr_t *hdr;
+    size_t offset;
+    esp_err_t e;
+
+    for(;;) {
+        if (xQueueReceive(rec.queue, &job, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        /* the flash is a ring of blocks, the seq decides the position */
+        hdr = (rssi_trace_block_hdr_t*) rec.block[job.idx];
+        offset = (job.seq % rec.capacity) * RSSI_TRACE_BLOCK_SIZE;
+
+        e = esp_partition_erase_range(rec.part, offset, RSSI_TRACE_BLOCK_SIZE);
+        if (e == ESP_OK)
+            e = esp_partition_write(rec.part, offset, hdr, job.len);
+
+        if (e != ESP_OK)
+            ESP_LOGE(TAG, "Failed to write block %"PRIu32": %s", job.seq, esp_err_to_name(e));
+        else if (hdr->session == rec.session)
+            rec.head = job.seq + 1;
+
+        rec.busy[job.idx] = false;
+    }
+}
+
+/* Hand the active block over to the writer task */
+static void rssi_recorder_submit(void)
+{
+    rssi_recorder_job_t job = {
+        .idx = rec.active,
+        .seq = rec.seq++,
+        .len = rssi_trace_enc_finish(&rec.enc),
+    };
+
+    rec.busy[job.idx] = true;
+    if (xQueueSend(rec.queue, &job, 0) != pdTRUE) {
+        rec.busy[job.idx] = false;
+        rec.dropped++;
+    }
+
+    rec.active = (rec.active + 1) % RSSI_RECORDER_BLOCKS;
+    rec.started = false;
+}
+
+void rssi_recorder_put(int64_t t_us, int freq, int rssi)
+{
+    if (rec.started && (rec.restart || !rec.enabled))
+        rssi_recorder_submit();
+
+    if (!rec.enabled)
+        return;
+
+    if (rec.restart) {
+        rec.restart = false;
+        rec.head = 0;
+        rec.seq = 0;
+        rec.dropped = 0;
+        rec.session = esp_random();
+        ESP_LOGI(TAG, "Start session %08"PRIx32, rec.session);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (!rec.started) {
+            if (rec.busy[rec.active]) {
+                rec.dropped++;
+                return;
+            }
+            rssi_trace_enc_init(&rec.enc, rec.block[rec.active], rec.session, rec.seq);
+            rec.started = true;
+        }
+
+        if (rssi_trace_enc_put(&rec.enc, t_us, freq, rssi))
+            return;
+
+        rssi_recorder_submit();
+    }
+}
+
+esp_err_t rssi_recorder_enable(bool enable)
+{
+    if (!rec.part)
+        return ESP_ERR_NOT_FOUND;
+
+    if (enable && !rec.enabled)
+        rec.restart = true;
+    rec.enabled = enable;
+    return ESP_OK;
+}
+
+void rssi_recorder_stats(rssi_recorder_stats_t *st)
+{
+    uint32_t head = rec.head;
+
+    st->enabled = rec.enabled;
+    st->session = rec.session;
+    st->capacity = rec.capacity;
+    st->blocks = head < rec.capacity ? head : rec.capacity;
+    st->dropped = rec.dropped;
+}
+
+esp_err_t rssi_recorder_read(uint32_t *pos, uint8_t *buf, size_t buf_sz, size_t *len)
+{
+    rssi_trace_block_hdr_t *hdr = (rssi_trace_block_hdr_t*) buf;
+    uint32_t head = rec.head;
+    size_t rec_len;
+    esp_err_t e;
+
+    if (!rec.part)
+        return ESP_ERR_NOT_FOUND;
+
+    if (buf_sz < RSSI_TRACE_BLOCK_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+
+    /* older blocks got overwritten already */
+    if (head > rec.capacity && *pos < head - rec.capacity)
+        *pos = head - rec.capacity;
+
+    for (; *pos < head; (*pos)++) {
+        size_t offset = (*pos % rec.capacity) * RSSI_TRACE_BLOCK_SIZE;
+
+        if ((e = esp_partition_read(rec.part, offset, buf, RSSI_TRACE_BLOCK_SIZE)) != ESP_OK)
+            return e;
+
+        /* skip blocks of other sessions and ones the writer just replaced */
+        if (rssi_trace_hdr_check(hdr, &rec_len) != ESP_OK ||
+            hdr->session != rec.session || hdr->seq != *pos)
+            continue;
+
+        *len = sizeof(*hdr) + rec_len;
+        (*pos)++;
+        return ESP_OK;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t rssi_recorder_init(void)
+{
+    rec.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                        ESP_PARTITION_SUBTYPE_ANY,
+                                        RSSI_RECORDER_PARTITION);
+    if (!rec.part) {
+        ESP_LOGW(TAG, "No partition '%s', recording disabled", RSSI_RECORDER_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    rec.capacity = rec.part->size / RSSI_TRACE_BLOCK_SIZE;
+    rec.queue = xQueueCreate(RSSI_RECORDER_BLOCKS, sizeof(rssi_recorder_job_t));
+    if (!rec.queue)
+        return ESP_ERR_NO_MEM;
+
+    /*
+     * An erase stalls the flash cache of both cores for typically 45ms, up
+     * to 400ms. The ADC ISR keeps filling the DMA pool meanwhile, which
+     * holds RX5808_ADC_POOL_MS of samples, lost ones are counted (adc_lost
+     * of /api/v1/rssi/trace/status).
+     */
+    if (xTaskCreatePinnedToCore(rssi_recorder_task, "rssi_rec", RSSI_RECORDER_STACK,
+                                NULL, tskIDLE_PRIORITY, NULL, 0) != pdPASS)
+        return ESP_ERR_NO_MEM;
+
+    ESP_LOGI(TAG, "%"PRIu32" blocks of %d bytes", rec.capacity, RSSI_TRACE_BLOCK_SIZE);
+    return ESP_OK;
+}
+
+#endif /* !CONFIG_IDF_TARGET_LINUX */
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Records every RSSI sample of task_rssi into the `rssi_trace` flash
+ * partition (rssi_trace.h format). The partition is used as a ring, it holds
+ * the last minutes of a recording. Download it via GET /api/v1/rssi/trace
+ * and replay it with the linux build (see main_linux.c).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define RSSI_RECORDER_PARTITION     "rssi_trace"
+
+typedef struct {
+    bool enabled;
+    uint32_t session;
+    uint32_t blocks;        /* blocks of the session in flash */
+    uint32_t capacity;      /* blocks the partition can hold */
+    uint32_t dropped;       /* samples lost as the flash writer was busy */
+} rssi_recorder_stats_t;
+
+esp_err_t rssi_recorder_init(void);
+
+/* Enabling starts a new session, the previous one gets overwritten */
+esp_err_t rssi_recorder_enable(bool enable);
+
+/* Called by task_rssi for every sample, never blocks */
+void rssi_recorder_put(int64_t t_us, int freq, int rssi);
+
+void rssi_recorder_stats(rssi_recorder_stats_t *st);
+
+/**
+ * Read the blocks of the last session, oldest first. Start with *pos = 0,
+ * a block (header and records) of *len bytes is returned per call.
+ * Returns ESP_ERR_NOT_FOUND after the last block.
+ */
+esp_err_t rssi_recorder_read(uint32_t *pos, uint8_t *buf, size_t buf_sz, size_t *len);
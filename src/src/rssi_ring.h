@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Lock-free single producer, single consumer ring of RSSI samples. The
+ * sampling loop of task_rssi pushes, the detection task pops. Neither side
+ * ever waits for the other, a full ring drops the new samples.
+ *
+ * head and tail count records since the start and wrap at 2^32, the
+ * position in the ring is the count modulo RSSI_RING_SIZE.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "rssi_src.h"
+
+#define RSSI_RING_SIZE      1024    /* power of two, 400ms at 2.5kHz */
+
+typedef struct {
+    int64_t t_us;
+    uint16_t freq;
+    int16_t rssi;           /* mV, as delivered by the source */
+} rssi_ring_rec_t;
+
+typedef struct {
+    rssi_ring_rec_t rec[RSSI_RING_SIZE];
+    atomic_uint_least32_t head;     /* written by the producer only */
+    atomic_uint_least32_t tail;     /* written by the consumer only */
+
+    /* producer side statistics */
+    uint32_t hwm;           /* max records in the ring */
+    uint32_t dropped;       /* samples that did not fit */
+} rssi_ring_t;
+
+static inline void rssi_ring_init(rssi_ring_t *ring)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->hwm = 0;
+    ring->dropped = 0;
+}
+
+/* Producer: push n samples of freq, returns how many fit */
+static inline size_t rssi_ring_push(rssi_ring_t *ring, const rssi_sample_t *samples,
+                                    size_t n, int freq)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t used = head - tail;
+    size_t i;
+
+    if (n > RSSI_RING_SIZE - used) {
+        ring->dropped += n - (RSSI_RING_SIZE - used);
+        n = RSSI_RING_SIZE - used;
+    }
+
+    for (i = 0; i < n; i++) {
+        rssi_ring_rec_t *r = &ring->rec[(head + i) & (RSSI_RING_SIZE - 1)];
+
+        r->t_us = samples[i].t_us;
+        r->freq = freq;
+        r->rssi = samples[i].rssi;
+    }
+
+    /* the records must be visible before the new head */
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+
+    if (used + n > ring->hwm)
+        ring->hwm = used + n;
+    return n;
+}
+
+/* Consumer: pop up to max records, returns how many */
+static inline size_t rssi_ring_pop(rssi_ring_t *ring, rssi_ring_rec_t *recs, size_t max)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t n = head - tail, i;
+
+    if (n > max)
+        n = max;
+
+    for (i = 0; i < n; i++)
+        recs[i] = ring->rec[(tail + i) & (RSSI_RING_SIZE - 1)];
+
+    /* the slots may be overwritten once the tail moved */
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
@@ -0,0 +1,544 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rssi_src.h"
+
+static const char * TAG = "rssi-src";
+
+#define RSSI_SRC_ONESHOT_PERIOD_MS  5   /* pace of oneshot reads */
+#define RSSI_SRC_BATCH_TIMEOUT_MS   10  /* max wait for the first sample of a DMA batch */
+#define RSSI_SRC_SETTLE_MS          20  /* RX5808 needs some time after a channel switch */
+
+/* Settle time characterization, see rssi_src_rx5808_characterize() */
+#define RSSI_SRC_SETTLE_WINDOW_MS   40  /* samples recorded after a switch */
+#define RSSI_SRC_SETTLE_REF_MS      10  /* the end of the window is the settled level */
+#define RSSI_SRC_SETTLE_TOL_MV      20  /* min. deviation from the settled level */
+#define RSSI_SRC_SETTLE_MARGIN_US   1000
+#define RSSI_SRC_SETTLE_ROUNDS      2   /* the max of all rounds is used */
+
+
+/* ---- RX5808 ---------------------------------------------------------- */
+
+static esp_err_t rssi_src_rx5808_start(rssi_src_t *src)
+{
+    rssi_src_rx5808_t *priv = src->priv;
+    esp_err_t e;
+
+    e = rx5808_init(&priv->rx5808, priv->pin_mosi, priv->pin_clk,
+                    priv->pin_cs, priv->pin_rssi);
+    if (e != ESP_OK || !priv->continuous)
+        return e;
+
+    return rx5808_start_continuous(&priv->rx5808, RX5808_ADC_SAMPLE_FREQ_HZ,
+                                   RX5808_ADC_OVERSAMPLE);
+}
+
+static int rssi_src_rx5808_settle_idx(const rssi_src_rx5808_t *priv, int freq)
+{
+    for (size_t i = 0; i < priv->settle_cnt; i++) {
+        if (priv->settle_freq[i] == freq)
+            return i;
+    }
+    return -1;
+}
+
+static int64_t rssi_src_rx5808_settle_us(const rssi_src_rx5808_t *priv, int from, int to)
+{
+    int f = rssi_src_rx5808_settle_idx(priv, from);
+    int t = rssi_src_rx5808_settle_idx(priv, to);
+
+    if (f < 0 || t < 0 || priv->settle_rounds[f][t] < RSSI_SRC_SETTLE_ROUNDS)
+        return RSSI_SRC_SETTLE_MS * 1000LL;
+
+    return priv->settle_us[f][t];
+}
+
+/*
+ * The switch is only queued on the SPI bus. While the PLL settles, the
+ * caller processes what it has read so far and read() drops the samples
+ * taken before valid_us.
+ */
+static esp_err_t rssi_src_rx5808_set_channel(rssi_src_t *src, int freq, int64_t *valid_us)
+{
+    rssi_src_rx5808_t *priv = src->priv;
+    esp_err_t e;
+
+    if (!priv->rx5808.spi)
+        return ESP_ERR_NOT_ALLOWED;
+
+    if ((e = rx5808_set_channel_async(&priv->rx5808, freq)) != ESP_OK)
+        return e;
+
+    priv->valid_us = esp_timer_get_time() +
+                     rssi_src_rx5808_settle_us(priv, priv->freq, freq);
+    priv->freq = freq;
+    *valid_us = priv->valid_us;
+    return ESP_OK;
+}
+
+static esp_err_t rssi_src_rx5808_read(rssi_src_t *src, rssi_sample_t *samples,
+                                      size_t max, size_t *num, int *freq)
+{
+    rssi_src_rx5808_t *priv = src->priv;
+    rx5808_t *rx = &priv->rx5808;
+    static int batch[RSSI_BATCH_MAX];
+    int64_t end_us, period_us, wait_us;
+    esp_err_t e;
+    size_t n, skip;
+
+    *freq = priv->freq;
+    *num = 0;
+
+    if (!priv->continuous) {
+        wait_us = priv->valid_us - esp_timer_get_time();
+        if (wait_us < RSSI_SRC_ONESHOT_PERIOD_MS * 1000)
+            wait_us = RSSI_SRC_ONESHOT_PERIOD_MS * 1000;
+        vTaskDelay(pdMS_TO_TICKS((wait_us + 999) / 1000));
+
+        if ((e = rx5808_read_rssi(rx, NULL, &samples[0].rssi)) != ESP_OK)
+            return e;
+        samples[0].t_us = esp_timer_get_time();
+        *num = 1;
+        return ESP_OK;
+    }
+
+    if (max > RSSI_BATCH_MAX)
+        max = RSSI_BATCH_MAX;
+
+    e = rx5808_read_rssi_batch(rx, batch, max, &n, RSSI_SRC_BATCH_TIMEOUT_MS);
+    if (e != ESP_OK)
+        return e;
+
+    /* the samples are equally spaced, the last one was just taken */
+    end_us = esp_timer_get_time();
+    period_us = 1000000LL * rx->oversample / rx->sample_freq_hz;
+
+    for (skip = 0; skip < n; skip++) {
+        if (end_us - (int64_t)(n - 1 - skip) * period_us >= priv->valid_us)
+            break;
+    }
+
+    for (size_t i = skip; i < n; i++) {
+        samples[i - skip].t_us = end_us - (int64_t)(n - 1 - i) * period_us;
+        samples[i - skip].rssi = batch[i];
+    }
+
+    *num = n - skip;
+    return *num > 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+/*
+ * Switch to `to` and record RSSI_SRC_SETTLE_WINDOW_MS of samples. The mean
+ * of the last RSSI_SRC_SETTLE_REF_MS is the settled level, the switch is
+ * settled after the last sample off that level by more than the tolerance.
+ */
+static int64_t rssi_src_rx5808_measure_settle(rssi_src_t *src, int to)
+{
+    static rssi_sample_t s[RSSI_SRC_SETTLE_WINDOW_MS * 4 * 2];   /* up to 4 samples/ms, plus slack */
+    rssi_src_rx5808_t *priv = src->priv;
+    size_t n = 0, num, ref_cnt = 0;
+    int64_t t0, end, ref_us, settle = 0;
+    int64_t sum = 0, dev = 0, tol;
+    int freq;
+
+    rx5808_flush(&priv->rx5808);
+    t0 = esp_timer_get_time();
+    if (rx5808_set_channel(&priv->rx5808, to) != ESP_OK)
+        return -1;
+
+    priv->freq = to;
+    priv->valid_us = t0;
+    end = t0 + RSSI_SRC_SETTLE_WINDOW_MS * 1000;
+    ref_us = end - RSSI_SRC_SETTLE_REF_MS * 1000;
+
+    while (n < sizeof(s) / sizeof(s[0]) && esp_timer_get_time() < end) {
+        if (rssi_src_rx5808_read(src, &s[n], sizeof(s) / sizeof(s[0]) - n,
+                                 &num, &freq) == ESP_OK)
+            n += num;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (s[i].t_us >= ref_us) {
+            sum += s[i].rssi;
+            ref_cnt++;
+        }
+    }
+    if (!ref_cnt)
+        return -1;
+
+    sum /= ref_cnt;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i].t_us >= ref_us)
+            dev += llabs(s[i].rssi - sum);
+    }
+
+    /* 3x the mean deviation is about the noise peak of the settled level */
+    tol = 3 * dev / ref_cnt;
+    if (tol < RSSI_SRC_SETTLE_TOL_MV)
+        tol = RSSI_SRC_SETTLE_TOL_MV;
+
+    for (size_t i = 0; i < n && s[i].t_us < ref_us; i++) {
+        if (llabs(s[i].rssi - sum) > tol)
+            settle = s[i].t_us - t0;
+    }
+
+    return settle + RSSI_SRC_SETTLE_MARGIN_US;
+}
+
+/* Switch to a new set of frequencies, the switches between the old ones stay measured */
+static void rssi_src_rx5808_settle_set(rssi_src_rx5808_t *priv, const int *freqs, size_t cnt)
+{
+    uint16_t us[RSSI_SRC_MAX_FREQ][RSSI_SRC_MAX_FREQ] = { 0 };
+    uint8_t rounds[RSSI_SRC_MAX_FREQ][RSSI_SRC_MAX_FREQ] = { 0 };
+    int f, t;
+
+    for (size_t i = 0; i < cnt; i++) {
+        for (size_t j = 0; j < cnt; j++) {
+            f = rssi_src_rx5808_settle_idx(priv, freqs[i]);
+            t = rssi_src_rx5808_settle_idx(priv, freqs[j]);
+            if (f >= 0 && t >= 0) {
+                us[i][j] = priv->settle_us[f][t];
+                rounds[i][j] = priv->settle_rounds[f][t];
+            }
+        }
+    }
+
+    memcpy(priv->settle_freq, freqs, cnt * sizeof(freqs[0]));
+    memcpy(priv->settle_us, us, sizeof(us));
+    memcpy(priv->settle_rounds, rounds, sizeof(rounds));
+    priv->settle_cnt = cnt;
+}
+
+/*
+ * Measures the switch measured the fewest times so far, each one
+ * RSSI_SRC_SETTLE_ROUNDS times. Until then a switch waits
+ * RSSI_SRC_SETTLE_MS, see rssi_src_rx5808_settle_us().
+ */
+static esp_err_t rssi_src_rx5808_characterize(rssi_src_t *src, const int *freqs, size_t cnt)
+{
+    rssi_src_rx5808_t *priv = src->priv;
+    int f = -1, t = -1, left = 0;
+    int64_t settle;
+
+    if (!priv->rx5808.spi)
+        return ESP_ERR_NOT_ALLOWED;
+
+    if (!priv->continuous)
+        return ESP_ERR_NOT_SUPPORTED;
+
+    if (cnt > RSSI_SRC_MAX_FREQ)
+        cnt = RSSI_SRC_MAX_FREQ;
+
+    if (cnt != priv->settle_cnt || memcmp(freqs, priv->settle_freq, cnt * sizeof(freqs[0])))
+        rssi_src_rx5808_settle_set(priv, freqs, cnt);
+
+    for (size_t i = 0; i < cnt; i++) {
+        for (size_t j = 0; j < cnt; j++) {
+            if (i == j || priv->settle_rounds[i][j] >= RSSI_SRC_SETTLE_ROUNDS)
+                continue;
+            left++;
+            if (f < 0 || priv->settle_rounds[i][j] < priv->settle_rounds[f][t]) {
+                f = i;
+                t = j;
+            }
+        }
+    }
+    if (!left)
+        return ESP_OK;
+
+    /* start from a settled `from` channel */
+    if (priv->freq != freqs[f]) {
+        rx5808_set_channel(&priv->rx5808, freqs[f]);
+        priv->freq = freqs[f];
+        vTaskDelay(pdMS_TO_TICKS(RSSI_SRC_SETTLE_MS));
+    }
+
+    settle = rssi_src_rx5808_measure_settle(src, freqs[t]);
+    priv->valid_us = 0;
+
+    /* a drone passing while measuring looks like a slow switch */
+    if (settle < 0 || settle > RSSI_SRC_SETTLE_MS * 1000)
+        settle = RSSI_SRC_SETTLE_MS * 1000;
+
+    if (settle > priv->settle_us[f][t])
+        priv->settle_us[f][t] = settle;
+
+    if (++priv->settle_rounds[f][t] == RSSI_SRC_SETTLE_ROUNDS)
+        ESP_LOGI(TAG, "settle %d -> %d: %uus", freqs[f], freqs[t], priv->settle_us[f][t]);
+
+    return left > 1 || priv->settle_rounds[f][t] < RSSI_SRC_SETTLE_ROUNDS ?
+           ESP_ERR_NOT_FINISHED : ESP_OK;
+}
+
+static int64_t rssi_src_rx5808_now_us(rssi_src_t *src)
+{
+    return esp_timer_get_time();
+}
+
+static uint32_t rssi_src_rx5808_lost(rssi_src_t *src)
+{
+    rssi_src_rx5808_t *priv = src->priv;
+
+    return priv->continuous ? rx5808_lost(&priv->rx5808) : 0;
+}
+
+void rssi_src_rx5808_init(rssi_src_t *src, rssi_src_rx5808_t *priv,
+                          int mosi, int clk, int cs, int rssi, bool continuous)
+{
+    memset(priv, 0, sizeof(*priv));
+    priv->pin_mosi = mosi;
+    priv->pin_clk = clk;
+    priv->pin_cs = cs;
+    priv->pin_rssi = rssi;
+    priv->continuous = continuous;
+
+    src->name = "rx5808";
+    src->start = rssi_src_rx5808_start;
+    src->set_channel = rssi_src_rx5808_set_channel;
+    src->characterize = rssi_src_rx5808_characterize;
+    src->read = rssi_src_rx5808_read;
+    src->now_us = rssi_src_rx5808_now_us;
+    src->lost = rssi_src_rx5808_lost;
+    src->priv = priv;
+}
+
+
+/* ---- Synthetic drone passes ------------------------------------------ */
+
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state ? *state : 1;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+int rssi_src_synthetic_rssi(const rssi_src_synthetic_cfg_t *cfg, int freq,
+                            int64_t t_us, uint32_t *seed)
+{
+    int64_t lap_us = (int64_t)cfg->lap_ms * 1000;
+    int noise = cfg->noise ? (int)(xorshift32(seed) % cfg->noise) - cfg->noise / 2 : 0;
+
+    if (!freq || !lap_us)
+        return cfg->noise_floor + noise;
+
+    /* every frequency has its own drone, they pass the gate with an offset */
+    int64_t phase = (int64_t)(freq % 10) * (lap_us / 10);
+    double dt = (double)((t_us + phase) % lap_us - lap_us / 2);
+    double sigma = cfg->pass_width_ms * 1000.0;
+    double pass = exp(-(dt * dt) / (2.0 * sigma * sigma));
+    int peak = cfg->peak;
+
+    if (cfg->peak_step && t_us >= (int64_t)cfg->peak_step_ms * 1000)
+        peak = cfg->peak_step;
+
+    return cfg->noise_floor + noise + (int)((peak - cfg->noise_floor) * pass);
+}
+
+static esp_err_t rssi_src_synthetic_start(rssi_src_t *src)
+{
+    rssi_src_synthetic_t *priv = src->priv;
+
+    priv->t_us = 0;
+    priv->seed = priv->cfg.seed;
+    return ESP_OK;
+}
+
+static esp_err_t rssi_src_synthetic_set_channel(rssi_src_t *src, int freq, int64_t *valid_us)
+{
+    rssi_src_synthetic_t *priv = src->priv;
+
+    if (priv->freq != freq)
+        priv->t_us += (int64_t)priv->cfg.settle_ms * 1000;
+    priv->freq = freq;
+    *valid_us = priv->t_us;
+    return ESP_OK;
+}
+
+static esp_err_t rssi_src_synthetic_read(rssi_src_t *src, rssi_sample_t *samples,
+                                         size_t max, size_t *num, int *freq)
+{
+    rssi_src_synthetic_t *priv = src->priv;
+    int64_t period_us = 1000000LL / priv->cfg.sample_rate_hz;
+    int64_t end_us = (int64_t)priv->cfg.duration_ms * 1000;
+    size_t n;
+
+    *freq = priv->freq;
+    *num = 0;
+
+    for (n = 0; n < max; n++) {
+        if (end_us && priv->t_us >= end_us)
+            break;
+        samples[n].t_us = priv->t_us;
+        samples[n].rssi = rssi_src_synthetic_rssi(&priv->cfg, priv->freq,
+                                                  priv->t_us, &priv->seed);
+        priv->t_us += period_us;
+    }
+
+    *num = n;
+    return n > 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static int64_t rssi_src_synthetic_now_us(rssi_src_t *src)
+{
+    rssi_src_synthetic_t *priv = src->priv;
+    return priv->t_us;
+}
+
+void rssi_src_synthetic_init(rssi_src_t *src, rssi_src_synthetic_t *priv,
+                             const rssi_src_synthetic_cfg_t *cfg)
+{
+    memset(priv, 0, sizeof(*priv));
+    priv->cfg = *cfg;
+    if (!priv->cfg.sample_rate_hz)
+        priv->cfg.sample_rate_hz = 1;
+
+    src->name = "synthetic";
+    src->start = rssi_src_synthetic_start;
+    src->set_channel = rssi_src_synthetic_set_channel;
+    src->characterize = NULL;
+    src->read = rssi_src_synthetic_read;
+    src->now_us = rssi_src_synthetic_now_us;
+    src->priv = priv;
+}
+
+
+/* ---- Recorded trace -------------------------------------------------- */
+
+static bool rssi_src_trace_next_binary(rssi_src_trace_t *priv)
+{
+    rssi_trace_block_hdr_t hdr;
+    int64_t t_us;
+    int freq, rssi;
+    size_t len;
+
+    while (!rssi_trace_dec_next(&priv->dec, &t_us, &freq, &rssi)) {
+        if (fread(&hdr, sizeof(hdr), 1, priv->fp) != 1)
+            return priv->has_next = false;
+
+        if (rssi_trace_hdr_check(&hdr, &len) != ESP_OK ||
+            fread(priv->block, 1, len, priv->fp) != len) {
+            ESP_LOGE(TAG, "Corrupt trace block at %ld", ftell(priv->fp));
+            return priv->has_next = false;
+        }
+        rssi_trace_dec_init(&priv->dec, priv->block, len);
+    }
+
+    priv->next.t_us = t_us;
+    priv->next.rssi = rssi;
+    priv->next_freq = freq;
+    return priv->has_next = true;
+}
+
+static bool rssi_src_trace_next(rssi_src_trace_t *priv)
+{
+    char line[64];
+    int64_t t_us;
+    int freq, rssi;
+
+    if (priv->binary)
+        return rssi_src_trace_next_binary(priv);
+
+    while (fgets(line, sizeof(line), priv->fp)) {
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%"SCNd64" %d %d", &t_us, &freq, &rssi) != 3)
+            continue;
+
+        priv->next.t_us = t_us;
+        priv->next.rssi = rssi;
+        priv->next_freq = freq;
+        return priv->has_next = true;
+    }
+    return priv->has_next = false;
+}
+
+static esp_err_t rssi_src_trace_start(rssi_src_t *src)
+{
+    rssi_src_trace_t *priv = src->priv;
+
+    rssi_src_trace_next(priv);
+    return ESP_OK;
+}
+
+/* The trace decides on the frequency, like it was hopped while recording */
+static esp_err_t rssi_src_trace_set_channel(rssi_src_t *src, int freq, int64_t *valid_us)
+{
+    rssi_src_trace_t *priv = src->priv;
+
+    *valid_us = priv->t_us;
+    return ESP_OK;
+}
+
+static esp_err_t rssi_src_trace_read(rssi_src_t *src, rssi_sample_t *samples,
+                                     size_t max, size_t *num, int *freq)
+{
+    rssi_src_trace_t *priv = src->priv;
+    size_t n = 0;
+
+    *num = 0;
+    if (!priv->has_next)
+        return ESP_ERR_NOT_FOUND;
+
+    *freq = priv->next_freq;
+    while (n < max && priv->has_next && priv->next_freq == *freq) {
+        samples[n++] = priv->next;
+        priv->t_us = priv->next.t_us;
+        rssi_src_trace_next(priv);
+    }
+
+    *num = n;
+    return ESP_OK;
+}
+
+static int64_t rssi_src_trace_now_us(rssi_src_t *src)
+{
+    rssi_src_trace_t *priv = src->priv;
+    return priv->t_us;
+}
+
+esp_err_t rssi_src_trace_init(rssi_src_t *src, rssi_src_trace_t *priv, const char *path)
+{
+    char magic[4];
+
+    memset(priv, 0, sizeof(*priv));
+
+    if (!(priv->fp = fopen(path, "rb"))) {
+        ESP_LOGE(TAG, "Failed to open trace %s: %s", path, strerror(errno));
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    priv->binary = fread(magic, sizeof(magic), 1, priv->fp) == 1 &&
+                   memcmp(magic, RSSI_TRACE_MAGIC, sizeof(magic)) == 0;
+    rewind(priv->fp);
+
+    src->name = "trace";
+    src->start = rssi_src_trace_start;
+    src->set_channel = rssi_src_trace_set_channel;
+    src->characterize = NULL;
+    src->read = rssi_src_trace_read;
+    src->now_us = rssi_src_trace_now_us;
+    src->priv = priv;
+    return ESP_OK;
+}
+
+void rssi_src_trace_close(rssi_src_t *src)
+{
+    rssi_src_trace_t *priv = src->priv;
+
+    if (priv->fp)
+        fclose(priv->fp);
+    priv->fp = NULL;
+    priv->has_next = false;
+}
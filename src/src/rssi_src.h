@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * RSSI sample sources for task_rssi. A source delivers timestamped RSSI
+ * samples and provides the clock task_rssi runs on, so the detection code
+ * can be fed by the RX5808, a recorded trace or synthetic drone passes.
+ * Replay sources run on a virtual clock and never block, thus an hour of
+ * race data is processed as fast as the host can.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_err.h"
+#include "rx5808.h"
+#include "rssi_trace.h"
+
+typedef struct {
+    int64_t t_us;   /* sample time on the clock of the source */
+    int rssi;       /* mV */
+} rssi_sample_t;
+
+typedef struct rssi_src_s rssi_src_t;
+struct rssi_src_s {
+    const char *name;
+
+    /* Called once from the task, which reads the samples */
+    esp_err_t (*start)(rssi_src_t *src);
+
+    /**
+     * Tune to freq. The source may return before the receiver settled,
+     * read() then drops the samples taken before *valid_us (source clock).
+     */
+    esp_err_t (*set_channel)(rssi_src_t *src, int freq, int64_t *valid_us);
+
+    /**
+     * Optional, measure how long the receiver needs to settle for the
+     * switches between the given frequencies. Each call measures one switch
+     * not known yet and blocks meanwhile, ESP_ERR_NOT_FINISHED if more are
+     * left. Switches between frequencies of the previous call stay known.
+     */
+    esp_err_t (*characterize)(rssi_src_t *src, const int *freqs, size_t cnt);
+
+    /**
+     * Read up to max samples of one frequency (*freq), oldest first.
+     * Returns ESP_ERR_TIMEOUT if no sample is available yet and
+     * ESP_ERR_NOT_FOUND once the source is exhausted.
+     */
+    esp_err_t (*read)(rssi_src_t *src, rssi_sample_t *samples, size_t max,
+                      size_t *num, int *freq);
+
+    /* The clock of this source, replaces get_millis() in task_rssi */
+    int64_t (*now_us)(rssi_src_t *src);
+
+    /* Optional, samples the source lost since the start, e.g. its buffer overran */
+    uint32_t (*lost)(rssi_src_t *src);
+
+    void *priv;
+};
+
+#define RSSI_SRC_MAX_FREQ   8
+#define RSSI_BATCH_MAX      64  /* max samples per read() */
+
+typedef struct {
+    rx5808_t rx5808;
+    int pin_mosi;
+    int pin_clk;
+    int pin_cs;
+    int pin_rssi;
+    bool continuous;    /* DMA batches, else one oneshot read per RSSI_SRC_ONESHOT_PERIOD_MS */
+    int freq;
+    int64_t valid_us;   /* samples before are dropped, the PLL was settling */
+
+    /* measured by characterize(), RSSI_SRC_SETTLE_MS for unknown switches */
+    int settle_freq[RSSI_SRC_MAX_FREQ];
+    size_t settle_cnt;
+    uint16_t settle_us[RSSI_SRC_MAX_FREQ][RSSI_SRC_MAX_FREQ];  /* [from][to] */
+    uint8_t settle_rounds[RSSI_SRC_MAX_FREQ][RSSI_SRC_MAX_FREQ];   /* measured so often */
+} rssi_src_rx5808_t;
+
+typedef struct {
+    uint32_t sample_rate_hz;
+    uint32_t lap_ms;        /* time between two passes of a drone */
+    uint32_t pass_width_ms; /* sigma of the gaussian RSSI bump of a pass */
+    int noise_floor;        /* mV */
+    int noise;              /* mV, peak to peak */
+    int peak;               /* mV at the gate */
+    int peak_step;          /* mV at the gate from peak_step_ms on, 0: peak */
+    uint64_t peak_step_ms;  /* e.g. a pilot changing the VTX power */
+    uint64_t duration_ms;   /* length of the session, 0: endless */
+    uint32_t settle_ms;     /* no samples after a channel switch, like the RX5808 */
+    uint32_t seed;
+} rssi_src_synthetic_cfg_t;
+
+#define RSSI_SRC_SYNTHETIC_DEFAULT() {  \
+    .sample_rate_hz = 2500,             \
+    .lap_ms = 25000,                    \
+    .pass_width_ms = 150,               \
+    .noise_floor = 450,                 \
+    .noise = 40,                        \
+    .peak = 1400,                       \
+    .duration_ms = 60 * 60 * 1000,      \
+    .settle_ms = 20,                    \
+    .seed = 0x5f7,                      \
+}
+
+typedef struct {
+    rssi_src_synthetic_cfg_t cfg;
+    int freq;
+    int64_t t_us;
+    uint32_t seed;
+} rssi_src_synthetic_t;
+
+typedef struct {
+    FILE *fp;
+    bool has_next;          /* one sample look ahead */
+    rssi_sample_t next;
+    int next_freq;
+    int64_t t_us;
+
+    bool binary;            /* rssi_trace.h format, else text */
+    rssi_trace_dec_t dec;
+    uint8_t block[RSSI_TRACE_BLOCK_SIZE];
+} rssi_src_trace_t;
+
+/* RX5808 on SPI/ADC (rx5808_sim.c on the linux target), real time clock */
+void rssi_src_rx5808_init(rssi_src_t *src, rssi_src_rx5808_t *priv,
+                          int mosi, int clk, int cs, int rssi, bool continuous);
+
+/* Parametric drone passes on a virtual clock */
+void rssi_src_synthetic_init(rssi_src_t *src, rssi_src_synthetic_t *priv,
+                             const rssi_src_synthetic_cfg_t *cfg);
+
+/**
+ * Recorded trace on a virtual clock. Either the binary format of
+ * rssi_trace.h, as downloaded from /api/v1/rssi/trace, or a text file with
+ * one sample per line: `<time_us> <freq> <rssi_mV>`, lines starting with
+ * '#' are ignored.
+ */
+esp_err_t rssi_src_trace_init(rssi_src_t *src, rssi_src_trace_t *priv, const char *path);
+void rssi_src_trace_close(rssi_src_t *src);
+
+/* RSSI of the synthetic drone on freq at t_us, also used by rx5808_sim.c */
+int rssi_src_synthetic_rssi(const rssi_src_synthetic_cfg_t *cfg, int freq,
+                            int64_t t_us, uint32_t *seed);
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <math.h>
+#include <string.h>
+#include "rssi_threshold.h"
+
+#define RSSI_THRESHOLD_BLOCK_SAMPLES    128
+#define RSSI_THRESHOLD_EXCURSION_SPREADS 8      /* an excursion starts this many spreads above floor */
+#define RSSI_THRESHOLD_EXCURSION_MIN    50      /* mV, but at least */
+#define RSSI_THRESHOLD_EXCURSION_MAX_MS 10000   /* longer is a new level, e.g. a drone parked at the gate */
+#define RSSI_THRESHOLD_HYST_MIN         10      /* mV between enter and leave */
+
+#define RSSI_THRESHOLD_MEDIAN_MAX \
+    (RSSI_THRESHOLD_PEAKS > RSSI_THRESHOLD_BLOCKS ? RSSI_THRESHOLD_PEAKS : RSSI_THRESHOLD_BLOCKS)
+
+static int rssi_threshold_median(const int *values, int n)
+{
+    int v[RSSI_THRESHOLD_MEDIAN_MAX];
+    int i, j, x;
+
+    for (i = 0; i < n; i++) {
+        x = values[i];
+        for (j = i; j > 0 && v[j - 1] > x; j--)
+            v[j] = v[j - 1];
+        v[j] = x;
+    }
+    return v[n / 2];
+}
+
+static void rssi_threshold_derive(rssi_threshold_t *th)
+{
+    int span, hyst;
+
+    span = th->peak - th->floor;
+    if (span < RSSI_THRESHOLD_EXCURSION_MIN)
+        span = RSSI_THRESHOLD_EXCURSION_MIN;
+
+    th->enter = th->floor + span * th->enter_percent / 100;
+    th->leave = th->floor + span * th->leave_percent / 100;
+
+    hyst = 2 * th->spread;
+    if (hyst < RSSI_THRESHOLD_HYST_MIN)
+        hyst = RSSI_THRESHOLD_HYST_MIN;
+    if (th->enter - th->leave < hyst)
+        th->leave = th->enter - hyst;
+}
+
+static void rssi_threshold_block_reset(rssi_threshold_t *th)
+{
+    th->blk_sum = th->blk_sum2 = 0;
+    th->blk_n = 0;
+}
+
+/* A block is complete, commit the oldest pending one */
+static void rssi_threshold_block_done(rssi_threshold_t *th)
+{
+    int mean = th->blk_sum / th->blk_n;
+    int64_t var = th->blk_sum2 / th->blk_n - (int64_t)mean * mean;
+
+    rssi_threshold_block_reset(th);
+
+    if (th->pending_cnt == RSSI_THRESHOLD_PENDING) {
+        th->block_mean[th->block_pos] = th->pending_mean[0];
+        th->block_dev[th->block_pos] = th->pending_dev[0];
+        th->block_pos = (th->block_pos + 1) % RSSI_THRESHOLD_BLOCKS;
+        if (th->block_cnt < RSSI_THRESHOLD_BLOCKS)
+            th->block_cnt++;
+
+        memmove(th->pending_mean, th->pending_mean + 1, sizeof(int) * (RSSI_THRESHOLD_PENDING - 1));
+        memmove(th->pending_dev, th->pending_dev + 1, sizeof(int) * (RSSI_THRESHOLD_PENDING - 1));
+        th->pending_cnt--;
+
+        th->floor = rssi_threshold_median(th->block_mean, th->block_cnt);
+        th->spread = rssi_threshold_median(th->block_dev, th->block_cnt);
+        rssi_threshold_derive(th);
+    }
+
+    th->pending_mean[th->pending_cnt] = mean;
+    th->pending_dev[th->pending_cnt] = var > 0 ? (int)sqrtf(var) : 0;
+    th->pending_cnt++;
+}
+
+void rssi_threshold_init(rssi_threshold_t *th, const config_rssi_t *cfg)
+{
+    memset(th, 0, sizeof(*th));
+
+    th->enter_percent = cfg->offset_enter;
+    th->leave_percent = cfg->offset_leave;
+    th->min_peak = cfg->calib_min_rssi_peak;
+
+    th->peak = cfg->peak > th->min_peak ? cfg->peak : th->min_peak;
+    for (int i = 0; i < RSSI_THRESHOLD_PEAKS; i++)
+        th->peaks[i] = th->peak;
+
+    /* without a floor the thresholds are the ones of the manual mode */
+    rssi_threshold_derive(th);
+}
+
+bool rssi_threshold_update(rssi_threshold_t *th, int rssi, millis_t time)
+{
+    int start = th->spread * RSSI_THRESHOLD_EXCURSION_SPREADS;
+
+    if (start < RSSI_THRESHOLD_EXCURSION_MIN)
+        start = RSSI_THRESHOLD_EXCURSION_MIN;
+
+    if (!th->excursion) {
+        if (th->floor && rssi > th->floor + start) {
+            /* the rise of the pass is in the current and the pending blocks */
+            th->excursion = true;
+            th->excursion_start = time;
+            th->excursion_max = rssi;
+            th->pending_cnt = 0;
+            rssi_threshold_block_reset(th);
+            return false;
+        }
+
+        th->blk_sum += rssi;
+        th->blk_sum2 += (int64_t)rssi * rssi;
+        if (++th->blk_n == RSSI_THRESHOLD_BLOCK_SAMPLES)
+            rssi_threshold_block_done(th);
+        return false;
+    }
+
+    if (rssi > th->excursion_max)
+        th->excursion_max = rssi;
+
+    if (time - th->excursion_start > RSSI_THRESHOLD_EXCURSION_MAX_MS) {
+        /* not a pass, start over on the new level */
+        th->excursion = false;
+        th->block_cnt = 0;
+        th->floor = 0;
+        return false;
+    }
+
+    if (rssi >= th->floor + start / 2)
+        return false;
+
+    th->excursion = false;
+
+    /* lower excursions are noise or another pilot on a close channel */
+    if (th->excursion_max < th->min_peak)
+        return false;
+
+    th->peaks[th->peak_pos] = th->excursion_max;
+    th->peak_pos = (th->peak_pos + 1) % RSSI_THRESHOLD_PEAKS;
+
+    th->peak = rssi_threshold_median(th->peaks, RSSI_THRESHOLD_PEAKS);
+    if (th->peak < th->min_peak)
+        th->peak = th->min_peak;
+    rssi_threshold_derive(th);
+    return true;
+}
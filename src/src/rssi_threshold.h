@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Automatic enter/leave thresholds of one channel, estimated from the
+ * smoothed RSSI instead of a calibrated peak:
+ *
+ *   floor    median of the mean RSSI of recent blocks of samples
+ *   spread   median of the standard deviation of these blocks, the noise
+ *   peak     median of the highest RSSI of the recent passes
+ *
+ * Blocks with a pass, or right before one, are left out. enter and leave
+ * are offset_enter and offset_leave percent of the way from floor to peak.
+ * A pass is any excursion well above the noise, not only one that crossed
+ * enter, thus a lower peak after a pilot changed the VTX power or the
+ * antenna moves the thresholds down after a few passes.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config_data.h"
+#include "timer.h"
+
+#define RSSI_THRESHOLD_PEAKS        5   /* passes the peak is the median of */
+#define RSSI_THRESHOLD_BLOCKS       8   /* blocks floor and spread are the median of */
+#define RSSI_THRESHOLD_PENDING      2   /* blocks held back, they might hold the rise of a pass */
+
+typedef struct {
+    int enter_percent;
+    int leave_percent;
+    int min_peak;           /* calib_min_rssi_peak, lower passes are noise */
+
+    /* current block */
+    int64_t blk_sum;
+    int64_t blk_sum2;
+    int blk_n;
+
+    int pending_mean[RSSI_THRESHOLD_PENDING];
+    int pending_dev[RSSI_THRESHOLD_PENDING];
+    int pending_cnt;
+
+    int block_mean[RSSI_THRESHOLD_BLOCKS];  /* ring of blocks without a pass */
+    int block_dev[RSSI_THRESHOLD_BLOCKS];
+    int block_cnt;
+    int block_pos;
+
+    bool excursion;         /* RSSI well above floor */
+    millis_t excursion_start;
+    int excursion_max;
+
+    int peaks[RSSI_THRESHOLD_PEAKS];    /* ring of recent pass peaks */
+    int peak_pos;
+
+    /* result */
+    int floor;              /* 0 until the first block */
+    int spread;
+    int peak;
+    int enter;
+    int leave;
+} rssi_threshold_t;
+
+/* The configured peak is the estimate until passes are seen */
+void rssi_threshold_init(rssi_threshold_t *th, const config_rssi_t *cfg);
+
+/* Feed one smoothed sample, returns true if a pass peak got added */
+bool rssi_threshold_update(rssi_threshold_t *th, int rssi, millis_t time);
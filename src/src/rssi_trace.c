@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <string.h>
+#include "rssi_trace.h"
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t) v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t) v;
+    return p;
+}
+
+static bool get_varint(rssi_trace_dec_t *dec, uint64_t *v)
+{
+    uint64_t r = 0;
+    int shift = 0;
+
+    while (dec->ptr < dec->end && shift < 64) {
+        uint8_t b = *dec->ptr++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = r;
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t) v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+void rssi_trace_enc_init(rssi_trace_enc_t *enc, uint8_t *block,
+                         uint32_t session, uint32_t seq)
+{
+    rssi_trace_block_hdr_t *hdr = (rssi_trace_block_hdr_t*) block;
+
+    memset(enc, 0, sizeof(*enc));
+    memcpy(hdr->magic, RSSI_TRACE_MAGIC, sizeof(hdr->magic));
+    hdr->version = RSSI_TRACE_VERSION;
+    hdr->reserved = 0;
+    hdr->len = 0;
+    hdr->session = session;
+    hdr->seq = seq;
+
+    enc->block = block;
+    enc->len = sizeof(rssi_trace_block_hdr_t);
+}
+
+bool rssi_trace_enc_put(rssi_trace_enc_t *enc, int64_t t_us, int freq, int rssi)
+{
+    uint8_t *p = enc->block + enc->len;
+    uint64_t dt;
+
+    if (enc->len + RSSI_TRACE_RECORD_MAX > RSSI_TRACE_BLOCK_SIZE)
+        return false;
+
+    /* time is monotonic within a recording, clamp anything else */
+    dt = t_us > enc->t_us ? (uint64_t)(t_us - enc->t_us) : 0;
+
+    p = put_varint(p, (dt << 1) | (freq != enc->freq));
+    if (freq != enc->freq)
+        p = put_varint(p, (uint32_t) freq);
+    p = put_varint(p, zigzag(rssi - enc->rssi));
+
+    enc->len = p - enc->block;
+    enc->t_us = t_us;
+    enc->freq = freq;
+    enc->rssi = rssi;
+    return true;
+}
+
+size_t rssi_trace_enc_finish(rssi_trace_enc_t *enc)
+{
+    rssi_trace_block_hdr_t *hdr = (rssi_trace_block_hdr_t*) enc->block;
+
+    hdr->len = enc->len - sizeof(rssi_trace_block_hdr_t);
+    return enc->len;
+}
+
+esp_err_t rssi_trace_hdr_check(const rssi_trace_block_hdr_t *hdr, size_t *len)
+{
+    if (memcmp(hdr->magic, RSSI_TRACE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != RSSI_TRACE_VERSION)
+        return ESP_ERR_INVALID_ARG;
+
+    if (hdr->len > RSSI_TRACE_BLOCK_SIZE - sizeof(rssi_trace_block_hdr_t))
+        return ESP_ERR_INVALID_SIZE;
+
+    *len = hdr->len;
+    return ESP_OK;
+}
+
+void rssi_trace_dec_init(rssi_trace_dec_t *dec, const uint8_t *records, size_t len)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->ptr = records;
+    dec->end = records + len;
+}
+
+bool rssi_trace_dec_next(rssi_trace_dec_t *dec, int64_t *t_us, int *freq, int *rssi)
+{
+    uint64_t v, f, r;
+
+    if (!get_varint(dec, &v))
+        return false;
+
+    if ((v & 1) && !get_varint(dec, &f))
+        return false;
+
+    if (!get_varint(dec, &r))
+        return false;
+
+    dec->t_us += v >> 1;
+    if (v & 1)
+        dec->freq = (int) f;
+    dec->rssi += unzigzag((uint32_t) r);
+
+    *t_us = dec->t_us;
+    *freq = dec->freq;
+    *rssi = dec->rssi;
+    return true;
+}
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Compact binary RSSI trace format.
+ *
+ * A trace is a sequence of blocks, each at most one flash sector. A block
+ * starts with rssi_trace_block_hdr_t, followed by `len` bytes of records.
+ * Every record is delta encoded against the previous one of the same
+ * block, thus each block can be decoded on its own:
+ *
+ *   varint  (delta_t_us << 1) | freq_changed
+ *   varint  freq                   only if freq_changed
+ *   varint  zigzag(delta_rssi)
+ *
+ * Varints are LEB128 (7 bit per byte, little endian). A sample in the
+ * middle of a channel dwell takes 2-3 bytes.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define RSSI_TRACE_MAGIC        "SFTR"
+#define RSSI_TRACE_VERSION      1
+#define RSSI_TRACE_BLOCK_SIZE   4096    /* one flash sector */
+#define RSSI_TRACE_RECORD_MAX   20      /* worst case bytes of one record */
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t len;           /* bytes of records following the header */
+    uint32_t session;       /* blocks of one recording share the session */
+    uint32_t seq;           /* block number within the session */
+} rssi_trace_block_hdr_t;
+
+typedef struct {
+    uint8_t *block;         /* RSSI_TRACE_BLOCK_SIZE bytes */
+    size_t len;
+    int64_t t_us;           /* previous record */
+    int freq;
+    int rssi;
+} rssi_trace_enc_t;
+
+typedef struct {
+    const uint8_t *ptr;
+    const uint8_t *end;
+    int64_t t_us;           /* previous record */
+    int freq;
+    int rssi;
+} rssi_trace_dec_t;
+
+void rssi_trace_enc_init(rssi_trace_enc_t *enc, uint8_t *block,
+                         uint32_t session, uint32_t seq);
+
+/* Returns false if the block is full, the record was not added then */
+bool rssi_trace_enc_put(rssi_trace_enc_t *enc, int64_t t_us, int freq, int rssi);
+
+/* Complete the block header, returns the number of bytes to store */
+size_t rssi_trace_enc_finish(rssi_trace_enc_t *enc);
+
+/* Check a block header, returns the number of record bytes following it */
+esp_err_t rssi_trace_hdr_check(const rssi_trace_block_hdr_t *hdr, size_t *len);
+
+void rssi_trace_dec_init(rssi_trace_dec_t *dec, const uint8_t *records, size_t len);
+bool rssi_trace_dec_next(rssi_trace_dec_t *dec, int64_t *t_us, int *freq, int *rssi);
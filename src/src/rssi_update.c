@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <stdatomic.h>
+#include <string.h>
+#include "rssi_update.h"
+
+#define RSSI_UPDATE_ALL     ((1u << RSSI_UPDATE_BLOCKS) - 1)
+
+typedef struct {
+    sft_event_rssi_update_t ev;     /* first, the block is found by &ev */
+    atomic_int refs;
+} rssi_update_block_t;
+
+static rssi_update_block_t blocks[RSSI_UPDATE_BLOCKS];
+static atomic_uint_least32_t used;  /* one bit per block */
+static atomic_int subscribers;
+
+/* written by the producer only */
+static rssi_update_stats_t stats;
+
+void rssi_update_subscribe(void)
+{
+    atomic_fetch_add(&subscribers, 1);
+}
+
+sft_event_rssi_update_t *rssi_update_alloc(void)
+{
+    uint32_t u = atomic_load(&used);
+    uint32_t bit, in_use;
+    rssi_update_block_t *b;
+
+    do {
+        if (u == RSSI_UPDATE_ALL) {
+            stats.exhausted++;
+            return NULL;
+        }
+        bit = 1u << __builtin_ctz(~u);
+    } while (!atomic_compare_exchange_weak(&used, &u, u | bit));
+
+    b = &blocks[__builtin_ctz(bit)];
+    memset(&b->ev, 0, sizeof(b->ev));
+    atomic_store(&b->refs, 1);
+
+    stats.allocs++;
+    in_use = __builtin_popcount(u | bit);
+    if (in_use > stats.hwm)
+        stats.hwm = in_use;
+
+    return &b->ev;
+}
+
+void rssi_update_hold(sft_event_rssi_update_t *ev)
+{
+    atomic_fetch_add(&((rssi_update_block_t*) ev)->refs, 1);
+}
+
+void rssi_update_release(sft_event_rssi_update_t *ev)
+{
+    rssi_update_block_t *b = (rssi_update_block_t*) ev;
+
+    if (atomic_fetch_sub(&b->refs, 1) == 1)
+        atomic_fetch_and(&used, ~(1u << (b - blocks)));
+}
+
+esp_err_t rssi_update_post(sft_event_rssi_update_t *ev, TickType_t ticks_to_wait)
+{
+    rssi_update_block_t *b = (rssi_update_block_t*) ev;
+    sft_event_rssi_update_ref_t ref = { .ev = ev };
+    int n = atomic_load(&subscribers);
+    esp_err_t e;
+
+    if (n > 0) {
+        /* the handlers may run before esp_event_post() returns */
+        atomic_fetch_add(&b->refs, n);
+        e = esp_event_post(SFT_EVENT, SFT_EVENT_RSSI_UPDATE, &ref, sizeof(ref), ticks_to_wait);
+        if (e != ESP_OK) {
+            atomic_fetch_sub(&b->refs, n);
+            stats.post_failed++;
+            return e;
+        }
+        stats.post_bytes += sizeof(ref);
+    }
+
+    stats.posts++;
+    stats.saved_bytes += sizeof(*ev) - (n > 0 ? sizeof(ref) : 0);
+    rssi_update_release(ev);
+    return ESP_OK;
+}
+
+void rssi_update_stats(rssi_update_stats_t *st)
+{
+    *st = stats;
+    st->blocks = RSSI_UPDATE_BLOCKS;
+    st->in_use = __builtin_popcount(atomic_load(&used));
+}
+
+bool rssi_update_encode_json(const sft_event_rssi_update_t *ev, json_writer_t *jw)
+{
+    jw_object(jw){
+        jw_kv_str(jw, "type", "rssi");
+        jw_kv_int(jw, "freq", ev->freq);
+        jw_kv_int(jw, "rate", ev->sample_rate_hz);
+        jw_kv_int(jw, "floor", ev->floor);
+        jw_kv_int(jw, "peak", ev->peak);
+        jw_kv_int(jw, "enter", ev->enter);
+        jw_kv_int(jw, "leave", ev->leave);
+        jw_kv(jw, "data"){
+            jw_array(jw) {
+                for (int i = 0; i < ev->cnt; i++) {
+                    jw_object(jw) {
+                        jw_kv_int(jw, "t", ev->data[i].abs_time_ms);
+                        jw_kv_int(jw, "s", ev->data[i].rssi);
+                        jw_kv_int(jw, "r", ev->data[i].rssi_raw);
+                        jw_kv_int(jw, "i", ev->data[i].drone_in_gate);
+                    }
+                }
+            }
+        }
+    }
+    return !jw->error;
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Pool of reference counted sft_event_rssi_update_t blocks. task_rssi fills
+ * a block in place and posts only a handle (sft_event_rssi_update_ref_t)
+ * with SFT_EVENT_RSSI_UPDATE, instead of copying the whole update into the
+ * event queue.
+ *
+ * Every handler of SFT_EVENT_RSSI_UPDATE counts as subscriber and has to be
+ * announced with rssi_update_subscribe(). A posted block starts with one
+ * reference per subscriber, each handler drops its reference with
+ * rssi_update_release() when it is done, also if it ignores the update.
+ * A handler that keeps the block beyond its return takes another reference
+ * with rssi_update_hold() first.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include "esp_err.h"
+#include "json.h"
+#include "sft_events.h"
+
+#define RSSI_UPDATE_BLOCKS  16  /* one in filling per frequency, the others in flight */
+
+typedef struct {
+    uint32_t blocks;
+    uint32_t in_use;
+    uint32_t hwm;           /* max blocks in use */
+    uint32_t allocs;
+    uint32_t exhausted;     /* allocs failed, the samples were not collected */
+    uint32_t posts;
+    uint32_t post_failed;   /* event queue full, the block stays with the producer */
+    uint32_t post_bytes;    /* copied into the event queue */
+    uint32_t saved_bytes;   /* not copied, compared to posting the update itself */
+} rssi_update_stats_t;
+
+/* A handler of SFT_EVENT_RSSI_UPDATE got registered */
+void rssi_update_subscribe(void);
+
+/* A cleared block owned by the caller, NULL if all are in use */
+sft_event_rssi_update_t *rssi_update_alloc(void);
+
+void rssi_update_hold(sft_event_rssi_update_t *ev);
+void rssi_update_release(sft_event_rssi_update_t *ev);
+
+/**
+ * Post ev as SFT_EVENT_RSSI_UPDATE. On success the caller's reference
+ * passed to the subscribers, on failure the caller still owns ev.
+ */
+esp_err_t rssi_update_post(sft_event_rssi_update_t *ev, TickType_t ticks_to_wait);
+
+void rssi_update_stats(rssi_update_stats_t *st);
+
+/* {"type":"rssi",..,"data":[{"t","s","r","i"},..]}, the JSON RSSI update */
+bool rssi_update_encode_json(const sft_event_rssi_update_t *ev, json_writer_t *jw);
@@ -1,16 +1,24 @@
 // SPDX-License-Identifier: GPL-3.0+
 
+#include <inttypes.h>
 #include <string.h>
 #include <freertos/FreeRTOS.h>
 #include "esp_log.h"
 #include "rx5808.h"
 
+#if !CONFIG_IDF_TARGET_LINUX
+
 static const char * TAG = "rx5808";
 
 #define RX5808_ADC_UNIT       ADC_UNIT_1
 #define RX5808_ADC_ATTEN      ADC_ATTEN_DB_0
 #define RX5808_ADC_BITWIDTH   ADC_BITWIDTH_DEFAULT
 
+/* RX5808_ADC_POOL_MS in bytes, whole frames */
+#define RX5808_ADC_POOL_SIZE  \
+  ((RX5808_ADC_SAMPLE_FREQ_HZ / 1000 * RX5808_ADC_POOL_MS * SOC_ADC_DIGI_RESULT_BYTES + \
+    RX5808_ADC_FRAME_SIZE - 1) / RX5808_ADC_FRAME_SIZE * RX5808_ADC_FRAME_SIZE)
+
 
 static bool rx5808_adc_calibration_init( adc_channel_t channel, adc_cali_handle_t *out_handle)
 {
@@ -137,6 +145,9 @@ esp_err_t rx5808_read_rssi(rx5808_t *handle, int *raw, int *voltage)
   esp_err_t ret;
   int v = 0;
 
+  if (!handle->adc)
+    return ESP_ERR_INVALID_STATE;
+
   if ((ret = adc_oneshot_read(handle->adc, handle->pin_rssi, &v)) != ESP_OK)
     return ret;
 
@@ -152,26 +163,203 @@ esp_err_t rx5808_read_rssi(rx5808_t *handle, int *raw, int *voltage)
 }
 
 
-esp_err_t rx5808_set_channel(rx5808_t *handle, int freq)
+esp_err_t rx5808_set_channel_async(rx5808_t *handle, int freq)
 {
-    static spi_transaction_t trans;
+    spi_transaction_t *trans = &handle->trans;
+    esp_err_t ret;
 
 //    ESP_LOGI(TAG, "set frequency: %d", freq);
 
-    memset(&trans, 0, sizeof(spi_transaction_t));
-    trans.flags = SPI_TRANS_USE_TXDATA;
+    /* the queue holds a single switch, reclaim the previous one */
+    if ((ret = rx5808_set_channel_wait(handle)) != ESP_OK)
+        return ret;
+
+    memset(trans, 0, sizeof(spi_transaction_t));
+    trans->flags = SPI_TRANS_USE_TXDATA;
 
-    trans.length = 25;
+    trans->length = 25;
 
     uint32_t flsb = (freq - 479) / 2;
 
     uint8_t flsbH = flsb >> 5;
     uint8_t flsbL = flsb & 0x1F;
 
-    trans.tx_data[0] = flsbL * 32 + 17;
-    trans.tx_data[1] = flsbH * 16 + flsbL / 8;
-    trans.tx_data[2] = flsbH / 16;
-    trans.tx_data[3] = 0;
+    trans->tx_data[0] = flsbL * 32 + 17;
+    trans->tx_data[1] = flsbH * 16 + flsbL / 8;
+    trans->tx_data[2] = flsbH / 16;
+    trans->tx_data[3] = 0;
+
+    if ((ret = spi_device_queue_trans(handle->spi, trans, 0)) != ESP_OK)
+        return ret;
+
+    handle->trans_pending = true;
+    return ESP_OK;
+}
+
+esp_err_t rx5808_set_channel_wait(rx5808_t *handle)
+{
+    spi_transaction_t *done;
+    esp_err_t ret;
+
+    if (!handle->trans_pending)
+        return ESP_OK;
+
+    if ((ret = spi_device_get_trans_result(handle->spi, &done, portMAX_DELAY)) != ESP_OK)
+        return ret;
+
+    handle->trans_pending = false;
+    return ESP_OK;
+}
+
+esp_err_t rx5808_set_channel(rx5808_t *handle, int freq)
+{
+    esp_err_t ret;
+
+    if ((ret = rx5808_set_channel_async(handle, freq)) != ESP_OK)
+        return ret;
+
+    return rx5808_set_channel_wait(handle);
+}
+
+
+/* ADC ISR, also while the flash cache is disabled */
+static bool IRAM_ATTR rx5808_on_pool_ovf(adc_continuous_handle_t adc,
+                                         const adc_continuous_evt_data_t *ev, void *arg)
+{
+  rx5808_t *handle = arg;
+
+  handle->overruns++;
+  return false;
+}
+
+esp_err_t rx5808_start_continuous(rx5808_t *handle, uint32_t sample_freq_hz, uint16_t oversample)
+{
+  adc_continuous_evt_cbs_t cbs = {
+    .on_pool_ovf = rx5808_on_pool_ovf,
+  };
+  esp_err_t ret;
+
+  if (sample_freq_hz < SOC_ADC_SAMPLE_FREQ_THRES_LOW ||
+      sample_freq_hz > SOC_ADC_SAMPLE_FREQ_THRES_HIGH || oversample == 0)
+    return ESP_ERR_INVALID_ARG;
+
+  /* oneshot and continuous mode can't share ADC1 */
+  if (handle->adc) {
+    if ((ret = adc_oneshot_del_unit(handle->adc)) != ESP_OK)
+      return ret;
+    handle->adc = NULL;
+  }
+
+  adc_continuous_handle_cfg_t handle_cfg = {
+    .max_store_buf_size = RX5808_ADC_POOL_SIZE,
+    .conv_frame_size = RX5808_ADC_FRAME_SIZE,
+  };
+
+  if ((ret = adc_continuous_new_handle(&handle_cfg, &handle->adc_cont)) != ESP_OK)
+    return ret;
+
+  if ((ret = adc_continuous_register_event_callbacks(handle->adc_cont, &cbs, handle)) != ESP_OK)
+    return ret;
+
+  adc_digi_pattern_config_t pattern = {
+    .atten = RX5808_ADC_ATTEN,
+    .channel = handle->pin_rssi & 0x7,
+    .unit = RX5808_ADC_UNIT,
+    .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+  };
+
+  adc_continuous_config_t cont_cfg = {
+    .pattern_num = 1,
+    .adc_pattern = &pattern,
+    .sample_freq_hz = sample_freq_hz,
+    .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+    .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+  };
+
+  if ((ret = adc_continuous_config(handle->adc_cont, &cont_cfg)) != ESP_OK)
+    return ret;
+
+  handle->sample_freq_hz = sample_freq_hz;
+  handle->oversample = oversample;
+  handle->acc = 0;
+  handle->acc_cnt = 0;
+
+  ESP_LOGI(TAG, "continuous ADC: %"PRIu32"Hz oversample:%"PRIu16" pool:%dB",
+           sample_freq_hz, oversample, RX5808_ADC_POOL_SIZE);
+
+  return adc_continuous_start(handle->adc_cont);
+}
+
+
+esp_err_t rx5808_read_rssi_batch(rx5808_t *handle, int *voltage, size_t max, size_t *num, uint32_t timeout_ms)
+{
+  static uint8_t frame[RX5808_ADC_FRAME_SIZE];
+  esp_err_t ret;
+  uint32_t len;
+  size_t n = 0;
+
+  *num = 0;
+  if (!handle->adc_cont)
+    return ESP_ERR_INVALID_STATE;
+
+  while (n < max) {
+    /* never read more conversions than needed for the remaining samples,
+     * so a partial sample in handle->acc can't overflow *voltage */
+    uint32_t want = (max - n) * handle->oversample * SOC_ADC_DIGI_RESULT_BYTES;
+    if (want > sizeof(frame))
+      want = sizeof(frame);
+
+    ret = adc_continuous_read(handle->adc_cont, frame, want, &len, timeout_ms);
+    if (ret == ESP_ERR_TIMEOUT)
+      break;
+    if (ret != ESP_OK)
+      return ret;
 
-    return spi_device_transmit(handle->spi, &trans);
+    /* only block for the first frame */
+    timeout_ms = 0;
+
+    for (uint32_t i = 0; i < len; i += SOC_ADC_DIGI_RESULT_BYTES) {
+      adc_digi_output_data_t *p = (adc_digi_output_data_t*) &frame[i];
+
+      if (p->type1.channel != (handle->pin_rssi & 0x7))
+        continue;
+
+      handle->acc += p->type1.data;
+      if (++handle->acc_cnt < handle->oversample)
+        continue;
+
+      int raw = handle->acc / handle->acc_cnt;
+      handle->acc = 0;
+      handle->acc_cnt = 0;
+
+      if (!handle->adc_calibrated ||
+          adc_cali_raw_to_voltage(handle->adc_cali, raw, &voltage[n]) != ESP_OK)
+        voltage[n] = raw;
+      n++;
+    }
+  }
+
+  *num = n;
+  return n > 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+
+esp_err_t rx5808_flush(rx5808_t *handle)
+{
+  handle->acc = 0;
+  handle->acc_cnt = 0;
+
+  if (!handle->adc_cont)
+    return ESP_OK;
+
+  return adc_continuous_flush_pool(handle->adc_cont);
 }
+
+uint32_t rx5808_lost(const rx5808_t *handle)
+{
+  if (!handle->oversample)
+    return 0;
+  return handle->overruns * (RX5808_ADC_FRAME_SIZE / SOC_ADC_DIGI_RESULT_BYTES) / handle->oversample;
+}
+
+#endif /* !CONFIG_IDF_TARGET_LINUX */
@@ -2,9 +2,29 @@
 
 #pragma  once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#if !CONFIG_IDF_TARGET_LINUX
 #include "freertos/task.h"
 #include "driver/spi_master.h"
 #include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_continuous.h"
+#endif
+
+/* Continuous (DMA) RSSI sampling, see rx5808_start_continuous() */
+#define RX5808_ADC_SAMPLE_FREQ_HZ   20000   /* ADC conversions per second (ESP32 minimum is 20kHz) */
+#define RX5808_ADC_OVERSAMPLE       8       /* conversions averaged into one RSSI sample -> 2.5kHz */
+#define RX5808_ADC_FRAME_SIZE       256     /* bytes per DMA conversion frame */
+/*
+ * The driver's DMA pool, in ms of conversions. It has to bridge a flash
+ * sector erase of the recorder (rssi_recorder.c): the task draining it is
+ * stalled meanwhile, the ADC ISR is not (CONFIG_ADC_CONTINUOUS_ISR_IRAM_SAFE).
+ * A 4kB erase typically takes 45ms, 400ms at most per the flash datasheets.
+ */
+#define RX5808_ADC_POOL_MS          400
 
 typedef struct {
   int pin_mosi;
@@ -12,13 +32,60 @@ typedef struct {
   int pin_cs;
   int pin_rssi;
 
+#if !CONFIG_IDF_TARGET_LINUX
   spi_device_handle_t spi;
+  spi_transaction_t trans;  /* channel switch, see rx5808_set_channel_async() */
   adc_oneshot_unit_handle_t adc;
+  adc_continuous_handle_t adc_cont;
   adc_cali_handle_t adc_cali;
+#else
+  void *spi;
+  void *sim;    /* synthetic ring buffer, see rx5808_sim.c */
+#endif
   bool adc_calibrated;
+  bool trans_pending;   /* channel switch queued, not yet reclaimed */
+
+  /* continuous mode, sample_freq_hz is 0 in oneshot mode */
+  uint32_t sample_freq_hz;
+  uint16_t oversample;
+  uint32_t acc;         /* sum of conversions not yet forming a full sample */
+  uint16_t acc_cnt;
+  volatile uint32_t overruns;   /* DMA frames dropped as the pool was full */
 } rx5808_t;
 
 
 esp_err_t rx5808_init(rx5808_t *handle, int mosi, int clk, int cs, int rssi);
 esp_err_t rx5808_read_rssi(rx5808_t *handle, int *raw, int *voltage);
 esp_err_t rx5808_set_channel(rx5808_t *handle, int freq);
+
+/**
+ * Queue the channel switch on the SPI bus and return right away. The PLL
+ * needs some more time to settle after the transfer, RSSI samples taken
+ * meanwhile are not valid for freq yet.
+ */
+esp_err_t rx5808_set_channel_async(rx5808_t *handle, int freq);
+
+/* Wait until a switch queued by rx5808_set_channel_async() was sent */
+esp_err_t rx5808_set_channel_wait(rx5808_t *handle);
+
+/**
+ * Switch the RSSI ADC from oneshot reads to continuous DMA sampling.
+ * Every `oversample` conversions are averaged into one RSSI sample, thus
+ * the resulting RSSI rate is sample_freq_hz / oversample.
+ */
+esp_err_t rx5808_start_continuous(rx5808_t *handle, uint32_t sample_freq_hz, uint16_t oversample);
+
+/**
+ * Drain up to `max` RSSI samples (mV) from the DMA ring buffer, oldest first.
+ * Blocks at most timeout_ms for the first frame, returns ESP_ERR_TIMEOUT if
+ * no sample was available.
+ */
+esp_err_t rx5808_read_rssi_batch(rx5808_t *handle, int *voltage, size_t max, size_t *num, uint32_t timeout_ms);
+
+/**
+ * Drop all buffered samples, used after a channel switch.
+ */
+esp_err_t rx5808_flush(rx5808_t *handle);
+
+/* RSSI samples lost since the start, the DMA pool was full */
+uint32_t rx5808_lost(const rx5808_t *handle);
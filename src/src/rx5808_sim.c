@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * Host (linux target) replacement for rx5808.c. Instead of SPI and the ADC
+ * it generates a synthetic RSSI signal into a ring buffer, which emulates
+ * the DMA pool of the continuous ADC driver. That way the batch-drain path
+ * of task_rssi can be exercised without a RX5808.
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rx5808.h"
+#include "rssi_src.h"
+
+static const char * TAG = "rx5808-sim";
+
+#define SIM_RING_SIZE       1024    /* samples, like the DMA pool of the real driver */
+#define SIM_SETTLE_US       8000    /* RSSI is off after a channel switch */
+
+typedef struct {
+    int ring[SIM_RING_SIZE];
+    uint32_t head;          /* next write */
+    uint32_t tail;          /* next read */
+    uint32_t dropped;
+
+    rssi_src_synthetic_cfg_t cfg;
+    int freq;
+    int64_t switch_us;
+    int64_t next_us;        /* time of the next sample to generate */
+    uint32_t seed;
+} rx5808_sim_t;
+
+static int rx5808_sim_rssi(rx5808_sim_t *sim, int64_t t_us)
+{
+    int64_t dt = t_us - sim->switch_us;
+    int v = rssi_src_synthetic_rssi(&sim->cfg, sim->freq, t_us, &sim->seed);
+
+    if (dt < 0 || dt >= SIM_SETTLE_US)
+        return v;
+
+    /* unlocked PLL, the RSSI drops and recovers once the PLL locks */
+    return v - (int)(sim->cfg.noise_floor * exp(-4.0 * dt / SIM_SETTLE_US));
+}
+
+/* Producer side: emulates the DMA filling the pool up to now */
+static void rx5808_sim_fill(rx5808_t *handle)
+{
+    rx5808_sim_t *sim = handle->sim;
+    int64_t now = esp_timer_get_time();
+    int64_t period = 1000000LL / (handle->sample_freq_hz / handle->oversample);
+
+    if (!sim->next_us)
+        sim->next_us = now;
+
+    for (; sim->next_us <= now; sim->next_us += period) {
+        if (sim->head - sim->tail >= SIM_RING_SIZE) {
+            sim->tail++;
+            sim->dropped++;
+        }
+        sim->ring[sim->head++ % SIM_RING_SIZE] = rx5808_sim_rssi(sim, sim->next_us);
+    }
+}
+
+esp_err_t rx5808_init(rx5808_t *handle, int mosi, int clk, int cs, int rssi)
+{
+    rx5808_sim_t *sim;
+
+    memset(handle, 0, sizeof(*handle));
+    handle->pin_mosi = mosi;
+    handle->pin_rssi = rssi;
+    handle->pin_cs = cs;
+    handle->pin_clk = clk;
+
+    if (!(sim = calloc(1, sizeof(rx5808_sim_t))))
+        return ESP_ERR_NO_MEM;
+
+    sim->cfg = (rssi_src_synthetic_cfg_t) RSSI_SRC_SYNTHETIC_DEFAULT();
+    sim->seed = sim->cfg.seed;
+    handle->sim = sim;
+    /* non NULL, task_rssi checks it before switching channels */
+    handle->spi = sim;
+
+    ESP_LOGI(TAG, "synthetic RSSI source");
+    return ESP_OK;
+}
+
+esp_err_t rx5808_read_rssi(rx5808_t *handle, int *raw, int *voltage)
+{
+    int v = rx5808_sim_rssi(handle->sim, esp_timer_get_time());
+
+    if (raw)
+        *raw = v;
+    if (voltage)
+        *voltage = v;
+    return ESP_OK;
+}
+
+esp_err_t rx5808_set_channel_async(rx5808_t *handle, int freq)
+{
+    rx5808_sim_t *sim = handle->sim;
+
+    /* samples up to now were taken on the old channel */
+    if (handle->sample_freq_hz)
+        rx5808_sim_fill(handle);
+
+    sim->freq = freq;
+    sim->switch_us = esp_timer_get_time();
+    return ESP_OK;
+}
+
+esp_err_t rx5808_set_channel_wait(rx5808_t *handle)
+{
+    return ESP_OK;
+}
+
+esp_err_t rx5808_set_channel(rx5808_t *handle, int freq)
+{
+    return rx5808_set_channel_async(handle, freq);
+}
+
+esp_err_t rx5808_start_continuous(rx5808_t *handle, uint32_t sample_freq_hz, uint16_t oversample)
+{
+    if (sample_freq_hz == 0 || oversample == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    handle->sample_freq_hz = sample_freq_hz;
+    handle->oversample = oversample;
+    return ESP_OK;
+}
+
+esp_err_t rx5808_read_rssi_batch(rx5808_t *handle, int *voltage, size_t max, size_t *num, uint32_t timeout_ms)
+{
+    rx5808_sim_t *sim = handle->sim;
+    size_t n = 0;
+
+    *num = 0;
+    if (!handle->sample_freq_hz)
+        return ESP_ERR_INVALID_STATE;
+
+    for (;;) {
+        rx5808_sim_fill(handle);
+        if (sim->head != sim->tail || timeout_ms == 0)
+            break;
+        vTaskDelay(pdMS_TO_TICKS(1));
+        timeout_ms--;
+    }
+
+    for (; n < max && sim->tail != sim->head; n++)
+        voltage[n] = sim->ring[sim->tail++ % SIM_RING_SIZE];
+
+    *num = n;
+    return n > 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t rx5808_flush(rx5808_t *handle)
+{
+    rx5808_sim_t *sim = handle->sim;
+
+    if (handle->sample_freq_hz)
+        rx5808_sim_fill(handle);
+    sim->tail = sim->head;
+    return ESP_OK;
+}
+
+uint32_t rx5808_lost(const rx5808_t *handle)
+{
+    return ((rx5808_sim_t*) handle->sim)->dropped;
+}
+
+#endif /* CONFIG_IDF_TARGET_LINUX */
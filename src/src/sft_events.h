@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-3.0+
+
+/*
+ * SFT event definitions, kept free of network/http dependencies so the
+ * RSSI task can be built for the linux target.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_event.h"
+#include "timer.h"
+#include "config_data.h"
+#include "led.h"
+
+typedef enum {
+    SFT_EVENT_DRONE_PASSED,
+    SFT_EVENT_DRONE_ENTER,
+    SFT_EVENT_CFG_CHANGED,
+    SFT_EVENT_RSSI_UPDATE,
+    SFT_EVENT_START_RACE,
+    SFT_EVENT_LED_COMMAND,
+    SFT_EVENT_CTF_CAPTURED,
+    SFT_EVENT_CTF_LOST,
+    SFT_EVENT_CTF_CONFLICT,
+} sft_event_t;
+
+typedef struct {
+    int freq;
+    millis_t abs_time_ms;
+    int rssi;
+    int64_t abs_time_us;    /* interpolated pass time, abs_time_ms is derived from it */
+    uint32_t time_err_us;   /* estimated standard deviation of abs_time_us */
+} sft_event_drone_passed_t;
+
+    typedef sft_event_drone_passed_t sft_event_drone_enter_t;
+
+typedef struct {
+    config_data_t cfg;
+} sft_event_cfg_changed_t;
+
+#define SFT_RSSI_UPDATE_MAX 32
+typedef struct {
+    int cnt;
+    int freq;
+    uint32_t seq;           /* counts the updates of freq */
+    int sample_rate_hz;     /* effective RSSI samples per second on freq */
+    int floor;              /* thresholds at the time of the last sample, mV */
+    int peak;
+    int enter;
+    int leave;
+    struct  {
+        millis_t abs_time_ms;
+        int rssi;
+        int rssi_raw;
+        bool drone_in_gate;
+    } data[SFT_RSSI_UPDATE_MAX];
+} sft_event_rssi_update_t;
+
+/* Data of SFT_EVENT_RSSI_UPDATE, release ev when done (rssi_update.h) */
+typedef struct {
+    sft_event_rssi_update_t *ev;
+} sft_event_rssi_update_ref_t;
+
+typedef struct {
+    millis_t offset;
+} sft_event_start_race_t;
+
+
+enum sft_led_command_type_e {
+    SFT_LED_CMD_TYPE_PERCENT = 0, /* default */
+    SFT_LED_CMD_TYPE_PERCENT_TRANSITION = 1, /* default */
+    SFT_LED_CMD_TYPE_NUM,
+    SFT_LED_CMD_TYPE_NUM_TRANSITION,
+};
+
+typedef struct {
+    color_t color;
+    enum sft_led_command_type_e type;
+    uint16_t offset;
+    uint16_t num;
+    millis_t duration;
+    /* transition */
+    uint16_t offset_end;
+    uint16_t num_end;
+    uint16_t update_interval;
+} sft_led_command_t;
+
+typedef struct {
+    unsigned int num;
+    sft_led_command_t commands[];
+} sft_event_led_command_t;
+
+ESP_EVENT_DECLARE_BASE(SFT_EVENT);
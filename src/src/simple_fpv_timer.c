@@ -4,6 +4,7 @@
 #include "config.h"
 #include "esp_err.h"
 #include "gui.h"
+#include "gui_http.h"
 #include "json.h"
 #include "esp_log.h"
 #include <stdlib.h>
@@ -240,8 +241,12 @@ esp_err_t sft_ctf_send_rssi_config(ctx_t *ctx, ip4_addr_t *ip) {
                         ends_with(cm->name, "freq") ||
                         ends_with(cm->name, "peak") ||
                         ends_with(cm->name, "filter") ||
+                        ends_with(cm->name, "filter_median") ||
+                        ends_with(cm->name, "filter_kalman_q") ||
+                        ends_with(cm->name, "filter_kalman_r") ||
                         ends_with(cm->name, "offset_enter") ||
                         ends_with(cm->name, "offset_leave") ||
+                        ends_with(cm->name, "auto_threshold") ||
                         ends_with(cm->name, "led_color")
                     ) {
                         cfg_meta_json_encode(&ctx->cfg.eeprom, cm, jw);
@@ -251,7 +256,7 @@ esp_err_t sft_ctf_send_rssi_config(ctx_t *ctx, ip4_addr_t *ip) {
         }
         if (!jw->error) {
             ESP_LOGI(TAG, "%s", jw->buf);
-            gui_send_http(ctx, url, jw->buf);
+            err = gui_http_post(url, jw->buf, false);
         } else {
             ESP_LOGE(TAG, "JSON error on sending CTF/RSSI cfg, need %"PRIu16" more", jw->needed_space);
         }
@@ -269,8 +274,12 @@ esp_err_t sft_ctf_send_rssi_config(ctx_t *ctx, ip4_addr_t *ip) {
                     ends_with(cm->name, "freq") ||
                     ends_with(cm->name, "peak") ||
                     ends_with(cm->name, "filter") ||
+                    ends_with(cm->name, "filter_median") ||
+                    ends_with(cm->name, "filter_kalman_q") ||
+                    ends_with(cm->name, "filter_kalman_r") ||
                     ends_with(cm->name, "offset_enter") ||
                     ends_with(cm->name, "offset_leave") ||
+                    ends_with(cm->name, "auto_threshold") ||
                     ends_with(cm->name, "led_color")
                 ) {
                     cfg_meta_json_encode(&ctx->cfg.eeprom, cm, jw);
@@ -280,7 +289,7 @@ esp_err_t sft_ctf_send_rssi_config(ctx_t *ctx, ip4_addr_t *ip) {
     }
     if (!jw->error) {
         ESP_LOGI(TAG, "%s", jw->buf);
-        gui_send_http(ctx, url, jw->buf);
+        err = gui_http_post(url, jw->buf, false);
     } else {
         ESP_LOGE(TAG, "JSON error on sending CTF/RSSI cfg, need %"PRIu16" more", jw->needed_space);
     }
@@ -357,7 +366,7 @@ void sft_send_players_update_to_gui(ctx_t *ctx)
     }
 
     if (!jw.error)
-        gui_send_all(ctx, buf);
+        gui_send_all(ctx, GUI_TOPIC_PLAYERS, buf);
 
 out:
     free(buf);
@@ -382,10 +391,27 @@ struct lap_s* sft_player_add_lap(struct player_s *player,
     return lap;
 }
 
-esp_err_t sft_on_player_lap(ctx_t *ctx, ip4_addr_t ip4, int id, int rssi, millis_t duration) {
+/* seq: of the lap on its node, 0 if the node does not count them, epoch: of the node's outbox */
+esp_err_t sft_on_player_lap(ctx_t *ctx, ip4_addr_t ip4, int id, int rssi, millis_t duration,
+                            uint32_t epoch, uint32_t seq) {
+    struct player_s *player = sft_player_get_or_create(&ctx->lc, ip4, NULL);
 
-    if (sft_player_add_lap(sft_player_get_or_create(&ctx->lc, ip4, NULL),
-                                       id, rssi, duration, get_millis())) {
+    /* the node lost its outbox (erased, reflashed), seq starts over */
+    if (player && epoch != player->last_epoch) {
+        ESP_LOGI(TAG, "New lap epoch %08"PRIx32" of %s", epoch, player->name);
+        player->last_epoch = epoch;
+        player->last_seq = 0;
+    }
+
+    /* a replay of the node's outbox, the ack got lost */
+    if (player && seq && seq <= player->last_seq) {
+        ESP_LOGI(TAG, "Duplicate lap seq:%"PRIu32" of %s", seq, player->name);
+        return ESP_OK;
+    }
+
+    if (sft_player_add_lap(player, id, rssi, duration, get_millis())) {
+        if (seq)
+            player->last_seq = seq;
         sft_send_players_update_to_gui(ctx);
         return ESP_OK;
     }
@@ -763,11 +789,11 @@ static void sft_ctf_send_status_update(ctx_t *ctx)
                 free(url);
                 goto out;
             }
-            gui_send_http(ctx, url, jw->buf);
+            gui_http_post(url, jw->buf, true);
 
             free (url);
         } else {
-            gui_send_all(ctx, jw->buf);
+            gui_send_all(ctx, GUI_TOPIC_CTF, jw->buf);
         }
     } else {
         ESP_LOGE(TAG, "Buffer to small for sending CTF stats, need %"PRIu16" more", jw->needed_space);
@@ -907,10 +933,14 @@ bool sft_update_settings(ctx_t *ctx)
     /* will be handled in task_rssi() event handler */                  \
     cfg_set_running(cfg, rssi[idx].peak);                                 \
     cfg_set_running(cfg, rssi[idx].filter);                               \
+    cfg_set_running(cfg, rssi[idx].filter_median);                        \
+    cfg_set_running(cfg, rssi[idx].filter_kalman_q);                      \
+    cfg_set_running(cfg, rssi[idx].filter_kalman_r);                      \
     cfg_set_running(cfg, rssi[idx].offset_enter);                         \
     cfg_set_running(cfg, rssi[idx].offset_leave);                         \
     cfg_set_running(cfg, rssi[idx].calib_max_lap_count);                  \
     cfg_set_running(cfg, rssi[idx].calib_min_rssi_peak);                  \
+    cfg_set_running(cfg, rssi[idx].auto_threshold);                       \
     if (cfg_differ(cfg, rssi[idx].led_color)) {                         \
         name_changed = true;                                            \
         cfg_set_running(cfg, rssi[idx].led_color);                            \
@@ -1097,7 +1127,7 @@ void sft_register_me(ctx_t *ctx)
         }
     }
 
-    gui_send_http(ctx, url, jw.buf);
+    gui_http_post(url, jw.buf, true);
     free(url);
 }
 
@@ -1106,35 +1136,14 @@ void sft_register_me(ctx_t *ctx)
  */
 void sft_send_new_lap(ctx_t *ctx, lap_t *lap)
 {
-    static const int buf_len = 64;
-    char *buf;
-    char *json;
-    json_writer_t jw;
+    char url[GUI_HTTP_URL_LEN];
     ip4_addr_t local_ip;
 
-    if (!(buf = malloc(buf_len * 2))) {
-        ESP_LOGE(TAG, "Out of memory!");
+    if (!sft_build_api_url(ctx, "api/v1/player/lap", url, sizeof(url)))
         return;
-    }
-    json = &buf[buf_len];
 
     local_ip = get_ip(ctx);
-    jw_init(&jw, json, sizeof(json));
-    jw_object(&jw){
-        jw_kv_str(&jw, "player", ctx->cfg.eeprom.rssi[0].name);
-        jw_kv_int(&jw, "id", lap->id);
-        jw_kv_int(&jw, "rssi", lap->rssi);
-        jw_kv_int(&jw, "duration", lap->duration_ms);
-        jw_kv_str(&jw, "ipv4", ip4addr_ntoa(&local_ip));
-    }
-
-    if (!sft_build_api_url(ctx, "api/v1/player/lap", buf, buf_len))
-        goto out;
-
-    gui_send_http(ctx, buf, json);
-
-out:
-    free(buf);
+    gui_http_post_lap(url, ctx->cfg.eeprom.rssi[0].name, ip4addr_ntoa(&local_ip), lap);
 }
 
 void ip_event_handler(void *ctxp, esp_event_base_t event_base,
@@ -1157,6 +1166,9 @@ void ip_event_handler(void *ctxp, esp_event_base_t event_base,
 void sft_event_drone_passed(void* ctx, esp_event_base_t base, int32_t id, void* event_data)
 {
     sft_event_drone_passed_t *ev = (sft_event_drone_passed_t*)event_data;
+
+    ESP_LOGI(TAG, "Drone passed freq:%d at %"PRIi64"us +-%"PRIu32"us",
+             ev->freq, ev->abs_time_us, ev->time_err_us);
     sft_on_drone_passed(ctx, ev->freq, ev->rssi, ev->abs_time_ms);
 }
 
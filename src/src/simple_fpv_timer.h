@@ -12,6 +12,7 @@
 #include "config.h"
 #include "osd.h"
 #include "led.h"
+#include "sft_events.h"
 
 #define min(a,b) \
 ({ __typeof__ (a) _a = (a); \
@@ -23,74 +24,6 @@
     __typeof__ (b) _b = (b); \
     _a > _b ? _a : _b; })
 
-typedef enum {
-    SFT_EVENT_DRONE_PASSED,
-    SFT_EVENT_DRONE_ENTER,
-    SFT_EVENT_CFG_CHANGED,
-    SFT_EVENT_RSSI_UPDATE,
-    SFT_EVENT_START_RACE,
-    SFT_EVENT_LED_COMMAND,
-    SFT_EVENT_CTF_CAPTURED,
-    SFT_EVENT_CTF_LOST,
-    SFT_EVENT_CTF_CONFLICT,
-} sft_event_t;
-
-typedef struct {
-    int freq;
-    millis_t abs_time_ms;
-    int rssi;
-} sft_event_drone_passed_t;
-
-    typedef sft_event_drone_passed_t sft_event_drone_enter_t;
-
-typedef struct {
-    config_data_t cfg;
-} sft_event_cfg_changed_t;
-
-#define SFT_RSSI_UPDATE_MAX 32
-typedef struct {
-    int cnt;
-    int freq;
-    struct  {
-        millis_t abs_time_ms;
-        int rssi;
-        int rssi_raw;
-        bool drone_in_gate;
-    } data[SFT_RSSI_UPDATE_MAX];
-} sft_event_rssi_update_t;
-
-typedef struct {
-    millis_t offset;
-} sft_event_start_race_t;
-
-
-enum sft_led_command_type_e {
-    SFT_LED_CMD_TYPE_PERCENT = 0, /* default */
-    SFT_LED_CMD_TYPE_PERCENT_TRANSITION = 1, /* default */
-    SFT_LED_CMD_TYPE_NUM,
-    SFT_LED_CMD_TYPE_NUM_TRANSITION,
-};
-
-typedef struct {
-    color_t color;
-    enum sft_led_command_type_e type;
-    uint16_t offset;
-    uint16_t num;
-    millis_t duration;
-    /* transition */
-    uint16_t offset_end;
-    uint16_t num_end;
-    uint16_t update_interval;
-} sft_led_command_t;
-
-typedef struct {
-    unsigned int num;
-    sft_led_command_t commands[];
-} sft_event_led_command_t;
-
-ESP_EVENT_DECLARE_BASE(SFT_EVENT);
-
-
 typedef struct lap_s {
     int id;
     int rssi;
@@ -106,6 +39,8 @@ typedef struct player_s {
     lap_t laps[MAX_LAPS];
     int next_idx;
     ip4_addr_t ip4;
+    uint32_t last_epoch;    /* of the node's outbox, its seq restarts with a new one */
+    uint32_t last_seq;      /* of the node's last lap, to drop replays */
 } player_t;
 
 #define MAX_PLAYER 8
@@ -167,7 +102,8 @@ void sft_init(ctx_t *ctx);
 bool sft_encode_lapcounter(lap_counter_t *lc, json_writer_t *jw);
 bool sft_encode_settings(ctx_t *ctx, json_writer_t *jw);
 esp_err_t sft_on_player_connect(ctx_t *ctx, ip4_addr_t ip, const char *name);
-esp_err_t sft_on_player_lap(ctx_t *ctx, ip4_addr_t ip4, int id, int rssi, millis_t duration);
+esp_err_t sft_on_player_lap(ctx_t *ctx, ip4_addr_t ip4, int id, int rssi, millis_t duration,
+                            uint32_t epoch, uint32_t seq);
 bool sft_update_settings(ctx_t *ctx);
 void sft_start_calibration(ctx_t *ctx);
 void sft_emit_led_blink(ctx_t *ctx, color_t color);
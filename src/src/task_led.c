@@ -6,6 +6,7 @@
 #include "esp_timer.h"
 #include "config.h"
 #include "led.h"
+#include "rssi_update.h"
 #include "timer.h"
 
 #define LED_GPIO 2
@@ -69,20 +70,17 @@ static void task_led_show_rssi(task_led_t *tskled, int rssi)
 void task_led_on_rssi_update(void* ctx, esp_event_base_t base, int32_t id, void* event_data)
 {
     task_led_t *task = (task_led_t*) ctx;
-    sft_event_rssi_update_t *ev = (sft_event_rssi_update_t*) event_data;
+    sft_event_rssi_update_t *ev = ((sft_event_rssi_update_ref_t*) event_data)->ev;
     int rssi = 0;
 
-    if (task->cfg.game_mode != CFG_GAME_MODE_SPECTRUM)
-        return;
-
-    if (ev->cnt <= 0)
-        return;
+    if (task->cfg.game_mode == CFG_GAME_MODE_SPECTRUM && ev->cnt > 0) {
+        for (int i = 0; i < ev->cnt; i++)
+            rssi += ev->data[i].rssi;
+        rssi /= ev->cnt;
 
-    for (int i = 0; i < ev->cnt; i++)
-        rssi += ev->data[i].rssi;
-    rssi /= ev->cnt;
-
-    task_led_show_rssi(task, rssi);
+        task_led_show_rssi(task, rssi);
+    }
+    rssi_update_release(ev);
 }
 
 void task_led_increase_num_leds(task_led_t *task)
@@ -333,6 +331,7 @@ void task_led_init(const ctx_t *ctx)
     ESP_ERROR_CHECK(esp_timer_create(&timer_args, &led.timer));
 
     esp_event_handler_register(SFT_EVENT, SFT_EVENT_RSSI_UPDATE, task_led_on_rssi_update, &led);
+    rssi_update_subscribe();
     esp_event_handler_register(SFT_EVENT, SFT_EVENT_START_RACE, task_led_on_start_race, &led);
     esp_event_handler_register(SFT_EVENT, SFT_EVENT_CFG_CHANGED, task_led_on_cfg_change, &led);
     esp_event_handler_register(SFT_EVENT, SFT_EVENT_LED_COMMAND, task_led_on_led_command, &led);
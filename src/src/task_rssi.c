@@ -1,52 +1,97 @@
+#include <inttypes.h>
+#include <math.h>
 #include <stdint.h>
+#include <string.h>
 #include <task_rssi.h>
 #include "esp_err.h"
-#include "simple_fpv_timer.h"
 #include "timer.h"
-#include <config.h>
 #include "esp_log.h"
+#include "rssi_update.h"
 
 #define PIN_NUM_MOSI 23
 #define PIN_NUM_CLK  18
 #define PIN_NUM_CS   5
+#if CONFIG_IDF_TARGET_LINUX
+#define PIN_RSSI     6  /* ignored by rx5808_sim.c */
+#else
 #define PIN_RSSI     ADC_CHANNEL_6
+#endif
+
+#define RSSI_ADC_CONTINUOUS     1   /* 1: drain DMA batches, 0: one adc_oneshot read per loop */
+
+/*
+ * Channel scheduler: a channel with activity gets a longer dwell and is
+ * revisited sooner, see task_rssi_schedule().
+ */
+#define RSSI_DWELL_IDLE_MS      10  /* nothing going on */
+#define RSSI_DWELL_NEAR_MS      40  /* smoothed RSSI approaches enter */
+#define RSSI_DWELL_GATE_MS      80  /* drone in gate, follow the peak until it leaves */
+#define RSSI_NEAR_PERCENT       70  /* smoothed above this share of enter is 'near' */
+#define RSSI_WEIGHT_NEAR        2   /* waiting time multiplier */
+#define RSSI_WEIGHT_GATE        4
+#define RSSI_STARVE_MS          400 /* max time a channel goes without samples */
+#define RSSI_RATE_PERIOD_MS     1000
+#define RSSI_CHARACTERIZE_MS    500 /* one settle time measured per period, while idle */
+
+/*
+ * What the scheduler knows of detection: one word per channel, stored by
+ * the detecting side after each batch. The frequency is part of it, the
+ * word of a replaced frequency does not count for the new one.
+ */
+#define RSSI_STATE_GATE         (1u << 0)
+#define RSSI_STATE_NEAR         (1u << 1)
+#define RSSI_STATE(freq, flags) ((uint32_t)(freq) << 8 | (flags))
 
 #define STACK_SIZE 4096
 StackType_t task_rssi_stack[ STACK_SIZE ];
 StaticTask_t task_rssi_buffer;
 
+#define DETECT_STACK_SIZE 4096
+StackType_t task_rssi_detect_stack[ DETECT_STACK_SIZE ];
+StaticTask_t task_rssi_detect_buffer;
+
+static uint8_t task_rssi_cfg_storage[2][sizeof(config_data_t)];
+static StaticQueue_t task_rssi_cfg_buffer[2];
+
 static const char * TAG = "task-rssi";
 
+static task_rssi_t *task_rssi_running;
+
 static esp_err_t task_rssi_next_channel(task_rssi_t *tsk);
+static void task_rssi_dwell_start(task_rssi_t *tsk);
 
 
-static void task_rssi_set_config(task_rssi_t *tsk, const config_data_t *cfg)
+/* Releases the blocks in filling of channels gone or retuned, the next sample starts a new one */
+static void task_rssi_update_restart(task_rssi_t *tsk)
 {
-    ESP_LOGI(TAG, "%s - ENTER", __func__);
-
-    for (int i=0; i< CFG_MAX_FREQ; i++)
-        printf("%d ", cfg->rssi[i].freq);
+    for (int i = 0; i < MAX_FREQ; i++) {
+        sft_event_rssi_update_t **ev = &tsk->rssi_update_ev[i];
 
+        if (*ev && (i >= tsk->rssi_cnt || tsk->rssi_array[i].freq != (*ev)->freq)) {
+            rssi_update_release(*ev);
+            *ev = NULL;
+        }
+    }
+}
 
+/* Detection side of a config, in the detection task between two batches */
+static void task_rssi_config_detect(task_rssi_t *tsk, const config_data_t *cfg)
+{
     tsk->rssi_cnt = 0;
     tsk->rssi_offset = cfg->rssi_offset;
 
     for (int i=0; i< CFG_MAX_FREQ; i++) {
         rssi_t *rssi = &tsk->rssi_array[i];
         const config_rssi_t *cfg_rssi = &cfg->rssi[i];
-        sft_event_rssi_update_t *ev = &tsk->rssi_update_ev[i];
 
         if (cfg_rssi->freq == 0) {
             memset(rssi, 0, sizeof(rssi_t) * (MAX_FREQ - i));
-            memset(ev, 0, sizeof(sft_event_rssi_update_t) * (MAX_FREQ - i));
             break;
         }
 
         tsk->rssi_cnt++;
         rssi->freq = cfg_rssi->freq;
-        rssi->filter = cfg_rssi->filter / 100.0f;
-        if (rssi->filter < 0.01)
-            rssi->filter = 0.01;
+        rssi_filter_init(&rssi->filter, cfg_rssi);
 
         rssi->peak = cfg_rssi->peak;
         rssi->offset_enter = cfg_rssi->offset_enter / 100.0f;
@@ -55,6 +100,9 @@ static void task_rssi_set_config(task_rssi_t *tsk, const config_data_t *cfg)
         rssi->enter = rssi->peak * rssi->offset_enter;
         rssi->leave = rssi->peak * rssi->offset_leave;
 
+        rssi->auto_threshold = cfg_rssi->auto_threshold;
+        rssi_threshold_init(&rssi->threshold, cfg_rssi);
+
         rssi->calibration_min_rssi = cfg_rssi->calib_min_rssi_peak;
         rssi->calibration_max_laps = cfg_rssi->calib_max_lap_count;
         rssi->calibration_lap_count = 0;
@@ -63,29 +111,147 @@ static void task_rssi_set_config(task_rssi_t *tsk, const config_data_t *cfg)
         rssi->drone_in_gate = 0;
         rssi->in_gate_peak_rssi = 0;
         rssi->in_gate_peak_millis = 0;
+        rssi->in_gate_enter_us = 0;
+        rssi->gate_blocked = 0;
+        rssi->fit_n = 0;
 
-
-        if (rssi->freq != ev->freq) {
-            memset(ev, 0, sizeof(sft_event_rssi_update_t));
-            ev->freq = rssi->freq;
-        }
+        rssi->rate_cnt = 0;
+        rssi->sample_rate_hz = 0;
+        rssi->samples = 0;
     }
 
-    tsk->rssi = NULL;
+    tsk->detect_rssi = NULL;
+    tsk->rate_us = 0;
+    task_rssi_update_restart(tsk);
+}
+
+/* Sampler side of a config, in the sampling loop between two batches */
+static void task_rssi_config_sampler(task_rssi_t *tsk, const config_data_t *cfg)
+{
+    tsk->chan_cnt = 0;
+
+    for (int i = 0; i < MAX_FREQ; i++) {
+        rssi_chan_t *chan = &tsk->chan_array[i];
+        int freq = tsk->chan_cnt == i ? cfg->rssi[i].freq : 0;
 
+        /* new frequencies need a new settle time characterization */
+        if (chan->freq != freq)
+            tsk->characterize = true;
+
+        chan->freq = freq;
+        chan->left_us = 0;
+        chan->sample_us = 0;
+        if (freq)
+            tsk->chan_cnt++;
+    }
+    ESP_LOGI(TAG, "%d channels", tsk->chan_cnt);
+
+    tsk->chan = NULL;
     task_rssi_next_channel(tsk);
+    task_rssi_dwell_start(tsk);
 }
 
+/* Runs in the event loop, the config is applied by the tasks themselves */
 static void task_rssi_on_update_cfg(void* priv, esp_event_base_t base, int32_t id, void* event_data)
 {
     task_rssi_t *tsk = (task_rssi_t*) priv;
     config_data_t *cfg = &((sft_event_cfg_changed_t*) event_data)->cfg;
 
     ESP_LOGI(TAG, "On config update!");
-    task_rssi_set_config(tsk, cfg);
+    xQueueOverwrite(tsk->cfg_sampler, cfg);
+    xQueueOverwrite(tsk->cfg_detect, cfg);
+    xTaskNotifyGive(tsk->detect_task);
 }
 
-static void task_rssi_process_rssi(task_rssi_t *tsk, sft_timer_t *gate_blocked, int rssi_raw)
+/*
+ * Samples go into the fit while fit_n > 0, a new fit starts with fit_n = 0.
+ * A sample is weighted by its height above leave, the top of a pass is
+ * closer to a parabola than its flanks.
+ */
+static void task_rssi_fit_add(rssi_t *rssi, int64_t t_us, int y)
+{
+    double t, w, tk;
+
+    if (!rssi->fit_n) {
+        rssi->fit_origin_us = rssi->fit_last_us = t_us;
+        memset(rssi->fit_t, 0, sizeof(rssi->fit_t));
+        memset(rssi->fit_ty, 0, sizeof(rssi->fit_ty));
+        rssi->fit_yy = 0;
+    }
+
+    t = (t_us - rssi->fit_origin_us) / 1000.0;
+    w = y - rssi->leave + 1;
+
+    rssi->fit_last_us = t_us;
+    rssi->fit_n++;
+
+    tk = w;
+    for (int k = 0; k < 5; k++, tk *= t) {
+        rssi->fit_t[k] += tk;
+        if (k < 3)
+            rssi->fit_ty[k] += tk * y;
+    }
+    rssi->fit_yy += w * y * y;
+}
+
+/**
+ * The pass time is the vertex of the parabola fitted to the raw samples
+ * above leave around the pass. Unlike the peak of the smoothed RSSI it is
+ * not delayed by the filter and not bound to the sample times, which are
+ * tens of ms apart if several channels are hopped. The error is the
+ * standard deviation of the vertex, propagated from the covariance of the
+ * fit. Returns false if the samples do not form a peak.
+ */
+static bool task_rssi_fit_peak(const rssi_t *rssi, int64_t *t_us, uint32_t *err_us)
+{
+    const double *s = rssi->fit_t, *sy = rssi->fit_ty;
+    double m00, m01, m02, m11, m12, m22, det;
+    double a, b, c, var, t0, ga, gb, var_t0;
+
+    if (rssi->fit_n < 8)
+        return false;
+
+    /*
+     * Normal equations M * (a b c) = (sy2 sy1 sy0), with the symmetric
+     * M = | s4 s3 s2 |
+     *     | s3 s2 s1 |
+     *     | s2 s1 s0 |, solved by its inverse, which also is the covariance.
+     */
+    m00 = s[2] * s[0] - s[1] * s[1];
+    m01 = s[2] * s[1] - s[3] * s[0];
+    m02 = s[3] * s[1] - s[2] * s[2];
+    m11 = s[4] * s[0] - s[2] * s[2];
+    m12 = s[3] * s[2] - s[4] * s[1];
+    m22 = s[4] * s[2] - s[3] * s[3];
+    det = s[4] * m00 + s[3] * m01 + s[2] * m02;
+    if (det <= 0)
+        return false;
+
+    a = (m00 * sy[2] + m01 * sy[1] + m02 * sy[0]) / det;
+    b = (m01 * sy[2] + m11 * sy[1] + m12 * sy[0]) / det;
+    c = (m02 * sy[2] + m12 * sy[1] + m22 * sy[0]) / det;
+    if (a >= 0)
+        return false;
+
+    t0 = -b / (2 * a);
+    if (t0 < 0 || t0 > (rssi->fit_last_us - rssi->fit_origin_us) / 1000.0)
+        return false;
+
+    /* residual variance, then d(t0)/da and d(t0)/db */
+    var = (rssi->fit_yy - a * sy[2] - b * sy[1] - c * sy[0]) / (rssi->fit_n - 3);
+    if (var < 0)
+        var = 0;
+    ga = b / (2 * a * a);
+    gb = -1 / (2 * a);
+    var_t0 = var * (ga * ga * m00 + 2 * ga * gb * m01 + gb * gb * m11) / det;
+
+    *t_us = rssi->fit_origin_us + (int64_t)(t0 * 1000.0);
+    *err_us = (uint32_t)(sqrt(var_t0 > 0 ? var_t0 : 0) * 1000.0);
+    return true;
+}
+
+static void task_rssi_process_rssi(task_rssi_t *tsk, rssi_t *rssi, int rssi_raw,
+                                   int rssi_smoothed, int64_t t_us)
 {
     /*                    Drone
      *                    left
@@ -97,17 +263,21 @@ static void task_rssi_process_rssi(task_rssi_t *tsk, sft_timer_t *gate_blocked,
      */
     #define COLLECT_MIN  700     /* 1s */
     #define GATE_BLOCKED 2000    /* 2s */
-
-    rssi_t *rssi = tsk->rssi;
+    millis_t time = t_us / 1000;
 
     if (!rssi)
         return;
 
 
     rssi->raw = rssi_raw;
+    rssi->smoothed = rssi_smoothed;
 
-    rssi->smoothed = (rssi->filter * rssi->raw) +
-                         ((1.0f - rssi->filter) * rssi->smoothed);
+    if (rssi->auto_threshold) {
+        rssi_threshold_update(&rssi->threshold, rssi->smoothed, time);
+        rssi->peak = rssi->threshold.peak;
+        rssi->enter = rssi->threshold.enter;
+        rssi->leave = rssi->threshold.leave;
+    }
 
     if( rssi->calibration) {
         if (rssi->smoothed > rssi->peak &&
@@ -118,31 +288,43 @@ static void task_rssi_process_rssi(task_rssi_t *tsk, sft_timer_t *gate_blocked,
             rssi->leave = rssi->peak * rssi->offset_leave;
             rssi->drone_in_gate = false;
 
-            timer_start(gate_blocked, COLLECT_MIN, NULL, NULL);
+            rssi->gate_blocked = time + COLLECT_MIN;
         }
     }
 
     /*ESP_LOGI(TAG, "rssi %d  enter:%d leave:%d in-gate:%d blocked:%d", */
     /*                    rssi->smoothed,*/
     /*                    rssi->enter , rssi->leave, rssi->drone_in_gate,*/
-    /*                     !timer_over(gate_blocked, NULL));*/
+    /*                     time < rssi->gate_blocked);*/
 
     if (!rssi->enter || !rssi->leave)
         return;
 
+    /*
+     * The raw samples above leave form the peak, the ones before the drone
+     * entered included. The filter delays the smoothed RSSI, the raw
+     * samples are symmetric around the real pass.
+     */
+    if (rssi->raw >= rssi->leave)
+        task_rssi_fit_add(rssi, t_us, rssi->raw);
+    else if (!rssi->drone_in_gate)
+        rssi->fit_n = 0;
+
     if (rssi->enter < rssi->smoothed &&
-            timer_over(gate_blocked, NULL) &&
+            time >= rssi->gate_blocked &&
             !rssi->drone_in_gate) {
         ESP_LOGI(TAG, "Drone enter gate! rssi: %d", rssi->smoothed);
-        timer_start(gate_blocked, COLLECT_MIN, NULL, NULL);
+        rssi->gate_blocked = time + COLLECT_MIN;
         rssi->drone_in_gate = true;
         rssi->in_gate_peak_rssi = rssi->smoothed;
-        rssi->in_gate_peak_millis = get_millis();
+        rssi->in_gate_peak_millis = time;
+        rssi->in_gate_enter_us = t_us;
 
         sft_event_drone_enter_t e = {
             .freq = rssi->freq,
             .abs_time_ms = rssi->in_gate_peak_millis,
             .rssi = rssi->in_gate_peak_rssi,
+            .abs_time_us = t_us,
         };
 
         ESP_ERROR_CHECK(
@@ -150,18 +332,28 @@ static void task_rssi_process_rssi(task_rssi_t *tsk, sft_timer_t *gate_blocked,
                            &e, sizeof(e), pdMS_TO_TICKS(500)));
 
     } else if (rssi->drone_in_gate &&
-            timer_over(gate_blocked, NULL) &&
+            time >= rssi->gate_blocked &&
             rssi->leave > rssi->smoothed) {
         rssi->drone_in_gate = false;
 
-        timer_start(gate_blocked, GATE_BLOCKED, NULL, NULL);
+        rssi->gate_blocked = time + GATE_BLOCKED;
 
         sft_event_drone_passed_t e = {
             .freq = rssi->freq,
-            .abs_time_ms = rssi->in_gate_peak_millis,
             .rssi = rssi->in_gate_peak_rssi,
         };
 
+        /*
+         * Fall back to the peak of the smoothed RSSI, +-half the time in the
+         * gate. Not the span of the fit, which may be of an earlier pass.
+         */
+        if (!task_rssi_fit_peak(rssi, &e.abs_time_us, &e.time_err_us)) {
+            e.abs_time_us = rssi->in_gate_peak_millis * 1000LL;
+            e.time_err_us = (t_us - rssi->in_gate_enter_us) / 2;
+        }
+        e.abs_time_ms = e.abs_time_us / 1000;
+        rssi->fit_n = 0;
+
         ESP_LOGI(TAG, "DRONE PASSED");
         ESP_ERROR_CHECK(
             esp_event_post(SFT_EVENT, SFT_EVENT_DRONE_PASSED,
@@ -170,23 +362,29 @@ static void task_rssi_process_rssi(task_rssi_t *tsk, sft_timer_t *gate_blocked,
     } else if (rssi->drone_in_gate) {
         if (rssi->in_gate_peak_rssi < rssi->smoothed) {
             rssi->in_gate_peak_rssi = rssi->smoothed;
-            rssi->in_gate_peak_millis = get_millis();
+            rssi->in_gate_peak_millis = time;
         }
     }
 }
 
-static void task_rssi_collect_rssi(task_rssi_t *tsk, millis_t time)
+static void task_rssi_collect_rssi(task_rssi_t *tsk, rssi_t *rssi, millis_t time)
 {
 #define TIME_SLOT 300    /* Send out collected data after at 300s */
 #define TIME_OFFSET 100  /* only every 100ms one datapoint for displaying */
 
-    rssi_t *rssi = tsk->rssi;
-
     if (!rssi)
         return;
-    int idx = rssi - tsk->rssi_array;
+    sft_event_rssi_update_t **slot = &tsk->rssi_update_ev[rssi - tsk->rssi_array];
+    sft_event_rssi_update_t *ev = *slot;
+    int idx;
 
-    sft_event_rssi_update_t *ev = &tsk->rssi_update_ev[idx];
+    if (!ev) {
+        /* all blocks in flight, skip the sample */
+        if (!(ev = rssi_update_alloc()))
+            return;
+        ev->freq = rssi->freq;
+        *slot = ev;
+    }
 
     idx = ev->cnt > 0 ? ev->cnt -1 : 0;
 
@@ -197,15 +395,25 @@ static void task_rssi_collect_rssi(task_rssi_t *tsk, millis_t time)
             (ev->cnt > 0 &&
             ev->data[idx].abs_time_ms - ev->data[0].abs_time_ms >= TIME_SLOT)){
 
-            if (esp_event_post(SFT_EVENT, SFT_EVENT_RSSI_UPDATE,
-                               ev, sizeof(*ev), pdMS_TO_TICKS(100)) == ESP_OK) {
-                ev->cnt = 0;
+            ev->seq = rssi->update_seq;
+            if (rssi_update_post(ev, pdMS_TO_TICKS(100)) == ESP_OK) {
+                rssi->update_seq++;
+                *slot = NULL;
+                if (!(ev = rssi_update_alloc()))
+                    return;
+                ev->freq = rssi->freq;
+                *slot = ev;
             } else {
                 if (ev->cnt +1 >= SFT_RSSI_UPDATE_MAX)
                     ev->cnt = 0;
             }
         }
         idx = ev->cnt++;
+        ev->sample_rate_hz = rssi->sample_rate_hz;
+        ev->floor = rssi->auto_threshold ? rssi->threshold.floor : 0;
+        ev->peak = rssi->peak;
+        ev->enter = rssi->enter;
+        ev->leave = rssi->leave;
         ev->data[idx].abs_time_ms = time;
         ev->data[idx].rssi = rssi->smoothed;
         ev->data[idx].rssi_raw = rssi->raw;
@@ -219,49 +427,46 @@ static void task_rssi_collect_rssi(task_rssi_t *tsk, millis_t time)
     }
 }
 
-static esp_err_t task_rssi_set_channel(task_rssi_t *tsk, rssi_t *rssi)
+static esp_err_t task_rssi_set_channel(task_rssi_t *tsk, rssi_chan_t *chan)
 {
     int idx;
     esp_err_t e;
 
-    if (tsk->rssi == rssi) {
+    if (tsk->chan == chan) {
         return ESP_OK;
     }
 
     /* SANITY CHECK */
-    idx = rssi - tsk->rssi_array;
+    idx = chan - tsk->chan_array;
     if (idx < 0 || idx >= MAX_FREQ) {
-        tsk->rssi = NULL;
+        tsk->chan = NULL;
         return ESP_ERR_INVALID_ARG;
     }
 
-    if (!tsk->rx5808.spi) {
-        tsk->rssi = NULL;
+    if (!tsk->src) {
+        tsk->chan = NULL;
         return ESP_ERR_NOT_ALLOWED;
     }
 
-    if ((e = rx5808_set_channel(&tsk->rx5808, rssi->freq)) != ESP_OK) {
-        tsk->rssi = NULL;
+    if ((e = tsk->src->set_channel(tsk->src, chan->freq, &tsk->valid_us)) != ESP_OK) {
+        tsk->chan = NULL;
         return e;
     }
 
-    // add a delay to allow the channel to settle
-    vTaskDelay(pdMS_TO_TICKS(20));
-
-    tsk->rssi = rssi;
+    tsk->chan = chan;
     return ESP_OK;
 }
 
 static esp_err_t task_rssi_set_channel_by_freq(task_rssi_t *tsk, int freq)
 {
     int idx;
-    rssi_t *ptr;
+    rssi_chan_t *ptr;
 
-    if (tsk->rssi && tsk->rssi->freq == freq) {
+    if (tsk->chan && tsk->chan->freq == freq) {
         return ESP_OK;
     }
 
-    for (idx=0, ptr = tsk->rssi_array; idx < MAX_FREQ; idx++, ptr++) {
+    for (idx=0, ptr = tsk->chan_array; idx < MAX_FREQ; idx++, ptr++) {
         if (ptr->freq == freq)
             break;
     }
@@ -273,8 +478,8 @@ static esp_err_t task_rssi_next_channel(task_rssi_t *tsk)
 {
     int idx = 0;
 
-    if (tsk->rssi) {
-        idx = tsk->rssi - tsk->rssi_array;
+    if (tsk->chan) {
+        idx = tsk->chan - tsk->chan_array;
 
         if (idx < 0 || idx >= MAX_FREQ)
             return ESP_ERR_NOT_ALLOWED;
@@ -282,72 +487,349 @@ static esp_err_t task_rssi_next_channel(task_rssi_t *tsk)
         idx = (idx + 1) % MAX_FREQ;
     }
 
-    if (tsk->rssi_array[idx].freq == 0) {
+    if (tsk->chan_array[idx].freq == 0) {
         idx = 0;
     }
 
-    return task_rssi_set_channel(tsk, &tsk->rssi_array[idx]);
+    return task_rssi_set_channel(tsk, &tsk->chan_array[idx]);
 
 }
 
-void task_rssi( void * priv )
+/* Detection side, after a batch of the channel went through task_rssi_process_rssi() */
+static void task_rssi_publish_state(task_rssi_t *tsk, rssi_t *rssi)
 {
-    task_rssi_t *tsk = (task_rssi_t*) priv;
-    sft_timer_t gate_blocked = {0};
-    sft_timer_t loop = {0};
-    sft_timer_t s1 = {0};
-    uint32_t read_cnt = 0;
-    millis_t ms;
-    int voltage = 0;
+    uint32_t flags = 0;
 
-    printf("rx5808 init\n");
-    ESP_ERROR_CHECK(rx5808_init(&tsk->rx5808, PIN_NUM_MOSI,
-                                PIN_NUM_CLK, PIN_NUM_CS, PIN_RSSI));
+    if (rssi->drone_in_gate)
+        flags = RSSI_STATE_GATE;
+    else if (rssi->enter && rssi->smoothed * 100 >= rssi->enter * RSSI_NEAR_PERCENT)
+        flags = RSSI_STATE_NEAR;
 
-    ESP_ERROR_CHECK_WITHOUT_ABORT(task_rssi_next_channel(tsk));
+    atomic_store_explicit(&tsk->chan_state[rssi - tsk->rssi_array],
+                          RSSI_STATE(rssi->freq, flags), memory_order_release);
+}
 
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(SFT_EVENT, SFT_EVENT_CFG_CHANGED,
-                                                        task_rssi_on_update_cfg,
-                                                        tsk, NULL));
-    timer_start(&s1, 1000, NULL, NULL);
-    uint16_t change_channel_counter = 0;
-    for(;;) {
-        timer_start(&loop, 5, NULL, NULL);
+/* Scheduler side, the only thing it reads of the detection */
+static int task_rssi_dwell_ms(task_rssi_t *tsk, const rssi_chan_t *chan, int *weight)
+{
+    uint32_t state = atomic_load_explicit(&tsk->chan_state[chan - tsk->chan_array],
+                                          memory_order_acquire);
 
-        read_cnt++;
-        rx5808_read_rssi(&tsk->rx5808, NULL, &voltage);
-        voltage += tsk->rssi_offset;
+    if (state >> 8 != (uint32_t) chan->freq)
+        state = 0;
 
-        ms = get_millis();
-        task_rssi_process_rssi(tsk, &gate_blocked, voltage);
-        task_rssi_collect_rssi(tsk, ms);
+    if (state & RSSI_STATE_GATE) {
+        *weight = RSSI_WEIGHT_GATE;
+        return RSSI_DWELL_GATE_MS;
+    }
+
+    if (state & RSSI_STATE_NEAR) {
+        *weight = RSSI_WEIGHT_NEAR;
+        return RSSI_DWELL_NEAR_MS;
+    }
 
-        if (tsk->rssi_cnt > 1 && change_channel_counter++ > 10) {
-            ESP_ERROR_CHECK_WITHOUT_ABORT(task_rssi_next_channel(tsk));
-            change_channel_counter = 0;
+    *weight = 1;
+    return RSSI_DWELL_IDLE_MS;
+}
+
+/* The dwell on the current channel starts once it settled, read() drops the samples before */
+static void task_rssi_dwell_start(task_rssi_t *tsk)
+{
+    int64_t start_us = tsk->src->now_us(tsk->src);
+    int weight;
+
+    tsk->hop_us = start_us;
+    if (!tsk->chan)
+        return;
+
+    if (tsk->valid_us > start_us)
+        start_us = tsk->valid_us;
+    tsk->hop_us = start_us + task_rssi_dwell_ms(tsk, tsk->chan, &weight) * 1000LL;
+}
+
+/**
+ * Pick the channel to sample next and set tsk->hop_us. A channel without
+ * samples for RSSI_STARVE_MS goes first. Then the current channel continues if a
+ * drone is near or in the gate, otherwise the channel with the longest
+ * waiting time, weighted by its state, is next.
+ */
+static esp_err_t task_rssi_schedule(task_rssi_t *tsk, int64_t now_us)
+{
+    rssi_chan_t *best = NULL;
+    int64_t best_score = -1;
+    int weight;
+    esp_err_t e;
+
+    if (tsk->chan)
+        tsk->chan->left_us = now_us;
+
+    for (int i = 0; i < tsk->chan_cnt; i++) {
+        rssi_chan_t *chan = &tsk->chan_array[i];
+        int64_t wait_us = now_us - chan->left_us;
+        int64_t starve_us = now_us - chan->sample_us;
+        int64_t score;
+
+        task_rssi_dwell_ms(tsk, chan, &weight);
+
+        if (chan == tsk->chan) {
+            /* stay while something is going on, idle channels move on */
+            if (weight == 1 && tsk->chan_cnt > 1)
+                continue;
+            score = INT64_MAX / 4;
+        } else if (starve_us >= RSSI_STARVE_MS * 1000LL) {
+            score = INT64_MAX / 2 + starve_us;
+        } else {
+            score = wait_us * weight;
         }
 
-        ms = get_millis();
-        if (loop.end > ms)
-            vTaskDelay(pdMS_TO_TICKS(loop.end - ms));
+        if (score > best_score) {
+            best_score = score;
+            best = chan;
+        }
+    }
 
-        if (timer_over(&s1, &ms)) {
-            ms = 1000 - ms;
-            /*printf("rx5808 rssi reads %lu/%llums (%0.2f) millis:%llu\n",*/
-            /*       read_cnt, ms, (float)read_cnt/ms, get_millis());*/
-            read_cnt=0;
-            timer_start(&s1, 1000, NULL, NULL);
+    if (!best)
+        return ESP_ERR_NOT_FOUND;
+
+    e = task_rssi_set_channel(tsk, best);
+    task_rssi_dwell_start(tsk);
+    return e;
+}
+
+/* Detection side, t_us of the last sample detected */
+static void task_rssi_update_rates(task_rssi_t *tsk, int64_t t_us)
+{
+    int64_t period_us = t_us - tsk->rate_us;
+
+    /* the first sample after a config starts the period */
+    if (!tsk->rate_us)
+        tsk->rate_us = t_us;
+    if (!tsk->rate_us || period_us < RSSI_RATE_PERIOD_MS * 1000LL)
+        return;
+
+    for (int i = 0; i < tsk->rssi_cnt; i++) {
+        rssi_t *rssi = &tsk->rssi_array[i];
+
+        rssi->sample_rate_hz = (int)(rssi->rate_cnt * 1000000LL / period_us);
+        rssi->rate_cnt = 0;
+    }
+    tsk->rate_us = t_us;
+}
+
+/* Sampler side, the ring counters are written by the sampler */
+static void task_rssi_check_ring(task_rssi_t *tsk, int64_t now_us)
+{
+    if (now_us - tsk->log_us < RSSI_RATE_PERIOD_MS * 1000LL)
+        return;
+    tsk->log_us = now_us;
+
+    if (tsk->ring.dropped != tsk->dropped_logged) {
+        ESP_LOGW(TAG, "Detection fell behind, %"PRIu32" samples dropped, max %"PRIu32" waiting",
+                 tsk->ring.dropped - tsk->dropped_logged, tsk->ring.hwm);
+        tsk->dropped_logged = tsk->ring.dropped;
+    }
+}
+
+/*
+ * Measuring a switch blanks all channels for some 60ms, so one is measured
+ * per RSSI_CHARACTERIZE_MS and only if no drone is near any gate. The
+ * switches not measured yet wait the fixed settle time meanwhile.
+ */
+static void task_rssi_characterize(task_rssi_t *tsk, int64_t now_us)
+{
+    int freqs[MAX_FREQ];
+    int weight;
+    esp_err_t e;
+
+    if (!tsk->src->characterize || tsk->chan_cnt < 2) {
+        tsk->characterize = false;
+        return;
+    }
+
+    if (now_us < tsk->characterize_us)
+        return;
+    tsk->characterize_us = now_us + RSSI_CHARACTERIZE_MS * 1000LL;
+
+    for (int i = 0; i < tsk->chan_cnt; i++) {
+        task_rssi_dwell_ms(tsk, &tsk->chan_array[i], &weight);
+        if (weight != 1)
+            return;
+        freqs[i] = tsk->chan_array[i].freq;
+    }
+
+    e = tsk->src->characterize(tsk->src, freqs, tsk->chan_cnt);
+    if (e != ESP_ERR_NOT_FINISHED)
+        tsk->characterize = false;
+    if (e != ESP_OK && e != ESP_ERR_NOT_SUPPORTED && e != ESP_ERR_NOT_FINISHED)
+        ESP_LOGE(TAG, "Settle time characterization failed: %s", esp_err_to_name(e));
+
+    /* the characterization left the receiver on some channel */
+    tsk->chan = NULL;
+    task_rssi_next_channel(tsk);
+    task_rssi_dwell_start(tsk);
+}
+
+static rssi_t *task_rssi_detect_find(task_rssi_t *tsk, int freq)
+{
+    if (tsk->detect_rssi && tsk->detect_rssi->freq == freq)
+        return tsk->detect_rssi;
+
+    tsk->detect_rssi = NULL;
+    for (int i = 0; i < tsk->rssi_cnt; i++) {
+        if (tsk->rssi_array[i].freq == freq)
+            tsk->detect_rssi = &tsk->rssi_array[i];
+    }
+    return tsk->detect_rssi;
+}
+
+/* Consumer of tsk->ring: filter, detect the passes and collect the updates */
+static void task_rssi_detect_drain(task_rssi_t *tsk)
+{
+    static rssi_ring_rec_t recs[RSSI_BATCH_MAX];
+    static int raw[RSSI_BATCH_MAX], smoothed[RSSI_BATCH_MAX];
+    rssi_t *rssi;
+    size_t num, i, j, k;
+
+    while ((num = rssi_ring_pop(&tsk->ring, recs, RSSI_BATCH_MAX)) > 0) {
+        /* the samples of one channel are filtered at once */
+        for (i = 0; i < num; i = j) {
+            for (j = i; j < num && recs[j].freq == recs[i].freq; j++)
+                raw[j - i] = recs[j].rssi + tsk->rssi_offset;
+
+            if ((rssi = task_rssi_detect_find(tsk, recs[i].freq))) {
+                rssi_filter_run(&rssi->filter, raw, smoothed, j - i);
+                rssi->rate_cnt += j - i;
+                rssi->samples += j - i;
+            }
+
+            for (k = i; k < j; k++) {
+                task_rssi_process_rssi(tsk, rssi, raw[k - i], smoothed[k - i], recs[k].t_us);
+                task_rssi_collect_rssi(tsk, rssi, recs[k].t_us / 1000);
+            }
+            if (rssi)
+                task_rssi_publish_state(tsk, rssi);
         }
+        task_rssi_update_rates(tsk, recs[num - 1].t_us);
     }
 }
 
-void task_rssi_init(const ctx_t *ctx)
+static void task_rssi_detect(void *priv)
 {
-    static task_rssi_t tsk;
+    static config_data_t cfg;
+    task_rssi_t *tsk = (task_rssi_t*) priv;
 
-    memset (&tsk, 0, sizeof(tsk));
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (xQueueReceive(tsk->cfg_detect, &cfg, 0) == pdTRUE)
+            task_rssi_config_detect(tsk, &cfg);
+        task_rssi_detect_drain(tsk);
+    }
+}
+
+esp_err_t task_rssi_run(task_rssi_t *tsk)
+{
+    static rssi_sample_t batch[RSSI_BATCH_MAX];
+    static config_data_t cfg;
+    rssi_src_t *src = tsk->src;
+    int64_t now_us;
+    size_t num;
+    int freq;
+    esp_err_t e;
+
+    tsk->log_us = src->now_us(src);
+    task_rssi_dwell_start(tsk);
+
+    for(;;) {
+        if (tsk->cfg_sampler && xQueueReceive(tsk->cfg_sampler, &cfg, 0) == pdTRUE)
+            task_rssi_config_sampler(tsk, &cfg);
+
+        if (tsk->characterize)
+            task_rssi_characterize(tsk, src->now_us(src));
+
+        e = src->read(src, batch, RSSI_BATCH_MAX, &num, &freq);
+        if (e == ESP_ERR_NOT_FOUND)
+            return ESP_OK;
+
+        if (e == ESP_OK) {
+            /* replayed traces decide on the channel themselves */
+            task_rssi_set_channel_by_freq(tsk, freq);
+            if (tsk->chan && tsk->chan->freq == freq)
+                tsk->chan->sample_us = batch[num - 1].t_us;
+
+            for (size_t i = 0; tsk->record && i < num; i++)
+                tsk->record(batch[i].t_us, freq, batch[i].rssi);
+
+            rssi_ring_push(&tsk->ring, batch, num, freq);
+            if (tsk->detect_task)
+                xTaskNotifyGive(tsk->detect_task);
+            else
+                task_rssi_detect_drain(tsk);
+        }
+
+        /*
+         * The switch is only queued, the source drops the samples taken
+         * while the receiver settles instead of blocking the loop.
+         */
+        now_us = src->now_us(src);
+        task_rssi_check_ring(tsk, now_us);
+
+        if (tsk->chan_cnt > 1 && now_us >= tsk->hop_us)
+            ESP_ERROR_CHECK_WITHOUT_ABORT(task_rssi_schedule(tsk, now_us));
+    }
+}
+
+void task_rssi( void * priv )
+{
+    task_rssi_t *tsk = (task_rssi_t*) priv;
 
-    task_rssi_set_config(&tsk, &ctx->cfg.eeprom);
+    printf("rx5808 init\n");
+    ESP_ERROR_CHECK(tsk->src->start(tsk->src));
+
+    ESP_ERROR_CHECK_WITHOUT_ABORT(task_rssi_next_channel(tsk));
+
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(SFT_EVENT, SFT_EVENT_CFG_CHANGED,
+                                                        task_rssi_on_update_cfg,
+                                                        tsk, NULL));
+    task_rssi_run(tsk);
+}
+
+void task_rssi_setup(task_rssi_t *tsk, rssi_src_t *src, const config_data_t *cfg)
+{
+    memset(tsk, 0, sizeof(*tsk));
+    tsk->src = src;
+    rssi_ring_init(&tsk->ring);
+
+    /* no task runs yet */
+    task_rssi_config_detect(tsk, cfg);
+    task_rssi_config_sampler(tsk, cfg);
+}
+
+void task_rssi_init(const config_data_t *cfg, task_rssi_record_fn record)
+{
+    static task_rssi_t tsk;
+    static rssi_src_t src;
+    static rssi_src_rx5808_t rx5808;
+
+    rssi_src_rx5808_init(&src, &rx5808, PIN_NUM_MOSI, PIN_NUM_CLK,
+                         PIN_NUM_CS, PIN_RSSI, RSSI_ADC_CONTINUOUS);
+    task_rssi_setup(&tsk, &src, cfg);
+    tsk.record = record;
+    task_rssi_running = &tsk;
+
+    tsk.cfg_sampler = xQueueCreateStatic(1, sizeof(config_data_t), task_rssi_cfg_storage[0],
+                                         &task_rssi_cfg_buffer[0]);
+    tsk.cfg_detect = xQueueCreateStatic(1, sizeof(config_data_t), task_rssi_cfg_storage[1],
+                                        &task_rssi_cfg_buffer[1]);
+
+    /*
+     * Above the sampling loop, a batch is detected once it is handed over.
+     * The loop blocks in the source's read() until the next samples are
+     * there (rx5808_read_rssi_batch(), vTaskDelay() when oneshot), which
+     * leaves the core to the tasks of idle priority meanwhile.
+     */
+    tsk.detect_task = xTaskCreateStaticPinnedToCore(task_rssi_detect, "task_rssi_det",
+                                  DETECT_STACK_SIZE, &tsk, tskIDLE_PRIORITY + 1,
+                                  task_rssi_detect_stack, &task_rssi_detect_buffer, 1);
 
     printf("START TASK\n");
     xTaskCreateStaticPinnedToCore(task_rssi, "task_rssi",
@@ -355,4 +837,12 @@ void task_rssi_init(const ctx_t *ctx)
                                   task_rssi_stack, &task_rssi_buffer, 1);
 }
 
+void task_rssi_stats(task_rssi_stats_t *st)
+{
+    task_rssi_t *tsk = task_rssi_running;
 
+    st->ring_size = RSSI_RING_SIZE;
+    st->ring_hwm = tsk ? tsk->ring.hwm : 0;
+    st->ring_dropped = tsk ? tsk->ring.dropped : 0;
+    st->src_lost = tsk && tsk->src->lost ? tsk->src->lost(tsk->src) : 0;
+}
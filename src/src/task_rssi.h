@@ -1,9 +1,15 @@
 #pragma once
 
 #include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <stdatomic.h>
 #include <stdbool.h>
-#include "simple_fpv_timer.h"
-#include "rx5808.h"
+#include "sft_events.h"
+#include "rssi_src.h"
+#include "rssi_filter.h"
+#include "rssi_ring.h"
+#include "rssi_threshold.h"
 #include "timer.h"
 
 #define MAX_FREQ 8
@@ -18,33 +24,107 @@ typedef struct {
     int enter;
     int leave;
 
-    float filter;
+    rssi_filter_t filter;   /* raw -> smoothed */
     float offset_enter;
     float offset_leave;
 
     bool drone_in_gate;
     int in_gate_peak_rssi;
     millis_t in_gate_peak_millis;
+    int64_t in_gate_enter_us;
+
+    bool auto_threshold;    /* peak, enter and leave by threshold */
+    rssi_threshold_t threshold;
 
     bool calibration;
     int calibration_min_rssi;
     int calibration_lap_count;
     int calibration_max_laps;
 
+    /* least squares parabola over the samples in the gate, see task_rssi_fit_peak() */
+    int64_t fit_origin_us;  /* t = 0, the drone entered */
+    int64_t fit_last_us;
+    uint32_t fit_n;
+    double fit_t[5];        /* sum of w * t^k, t in ms */
+    double fit_ty[3];       /* sum of w * y * t^k */
+    double fit_yy;          /* sum of w * y^2 */
+
     millis_t collect_next;
+    uint32_t update_seq;    /* of the next posted sft_event_rssi_update_t */
+    millis_t gate_blocked;  /* no detection on this freq before this time */
+
+    /* effective sample rate, counted by the detection */
+    uint32_t rate_cnt;      /* samples in the current rate period */
+    int sample_rate_hz;     /* of the last period */
+    uint64_t samples;       /* total */
 } rssi_t;
 
+/* A channel as the sampler sees it, see task_rssi_schedule() */
+typedef struct {
+    int freq;
+    int64_t left_us;        /* source clock, when the channel was left */
+    int64_t sample_us;      /* source clock, of the last sample delivered */
+} rssi_chan_t;
+
+/* Gets every sample as delivered by the source, before rssi_offset */
+typedef void (*task_rssi_record_fn)(int64_t t_us, int freq, int rssi);
+
 typedef struct {
-    rx5808_t rx5808;
+    rssi_src_t *src;        /* delivers the samples and the clock */
+    task_rssi_record_fn record;     /* optional, see rssi_recorder.h */
+
+    /*
+     * The sampling loop only reads the source and hands the samples over,
+     * detection and the events run in detect_task, which may block. Each
+     * side only writes its own state, a new config reaches both through
+     * their queue and is applied between two batches.
+     */
+    rssi_ring_t ring;
+    TaskHandle_t detect_task;   /* NULL: task_rssi_run() detects inline */
+    QueueHandle_t cfg_sampler;  /* config_data_t, the latest one only */
+    QueueHandle_t cfg_detect;
 
+    /* sampler side */
+    rssi_chan_t chan_array[MAX_FREQ];
+    uint16_t chan_cnt;
+    rssi_chan_t *chan;      /* the current one */
+    bool characterize;      /* measure the settle times of the frequencies */
+    int64_t characterize_us;    /* not before this time */
+    int64_t valid_us;       /* the current channel settled at this time */
+    int64_t hop_us;         /* leave the current channel at this time */
+    int64_t log_us;         /* last check of the ring */
+    uint32_t dropped_logged;
+
+    /* detection side */
     rssi_t rssi_array[MAX_FREQ];
     uint16_t rssi_cnt;
     int16_t rssi_offset;
-    rssi_t *rssi;           /* pointer to current rssi_array[idx] */
-
-    sft_event_rssi_update_t rssi_update_ev[MAX_FREQ];
+    rssi_t *detect_rssi;    /* of the last record */
+    int64_t rate_us;        /* sample time, start of the current rate period */
+    sft_event_rssi_update_t *rssi_update_ev[MAX_FREQ];    /* in filling, rssi_update.h */
 
+    /* RSSI_STATE() of rssi_array[i] for the scheduler, stored by the detection */
+    atomic_uint_least32_t chan_state[MAX_FREQ];
 } task_rssi_t;
 
 
-void task_rssi_init(const ctx_t *ctx);
+typedef struct {
+    uint32_t ring_size;     /* samples */
+    uint32_t ring_hwm;      /* max samples waiting for detection */
+    uint32_t ring_dropped;  /* samples lost because detection fell behind */
+    uint32_t src_lost;      /* samples lost by the source, e.g. ADC pool overruns */
+} task_rssi_stats_t;
+
+void task_rssi_init(const config_data_t *cfg, task_rssi_record_fn record);
+
+/* Of the task started by task_rssi_init() */
+void task_rssi_stats(task_rssi_stats_t *st);
+
+/* Used by task_rssi_init() and host builds, which bring their own source */
+void task_rssi_setup(task_rssi_t *tsk, rssi_src_t *src, const config_data_t *cfg);
+
+/**
+ * Process samples of tsk->src until the source is exhausted, which never
+ * happens for the RX5808.
+ */
+esp_err_t task_rssi_run(task_rssi_t *tsk);